@@ -66,6 +66,13 @@ static ngx_command_t  ngx_core_commands[] =
       offsetof(ngx_core_conf_t, master),
       NULL },
 
+    { ngx_string("worker_handoff"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_core_conf_t, handoff),
+      NULL },
+
     { ngx_string("timer_resolution"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_msec_slot,
@@ -190,6 +197,7 @@ static ngx_uint_t   ngx_show_configure;
 static u_char      *ngx_prefix;
 static u_char      *ngx_conf_file;
 static u_char      *ngx_conf_params;
+static u_char      *ngx_conf_image;
 static char        *ngx_signal;
 
 
@@ -410,7 +418,8 @@ static void ngx_show_version_info(void)
     if (ngx_show_help) {
         ngx_write_stderr(
             "Usage: nginx [-?hvVtTq] [-s signal] [-c filename] "
-                         "[-p prefix] [-g directives]" NGX_LINEFEED
+                         "[-C filename] [-p prefix] [-g directives]"
+                         NGX_LINEFEED
                          NGX_LINEFEED
             "Options:" NGX_LINEFEED
             "  -?,-h         : this help" NGX_LINEFEED
@@ -432,6 +441,9 @@ static void ngx_show_version_info(void)
 #endif
             "  -c filename   : set configuration file (default: " NGX_CONF_PATH
                                ")" NGX_LINEFEED
+            "  -C filename   : set pre-parsed configuration image, "
+                               "it is updated when configuration files change"
+                               NGX_LINEFEED
             "  -g directives : set global directives out of configuration "
                                "file" NGX_LINEFEED NGX_LINEFEED
         );
@@ -805,6 +817,21 @@ static ngx_int_t ngx_get_options(int argc, char *const *argv)
                 ngx_log_stderr(0, "option \"-c\" requires file name");
                 return NGX_ERROR;
 
+            //预编译的配置,与配置文件一致时跳过读取和分析配置文件
+            case 'C':
+                if (*p) {
+                    ngx_conf_image = p;
+                    goto next;
+                }
+
+                if (argv[++i]) {
+                    ngx_conf_image = (u_char *) argv[i];
+                    goto next;
+                }
+
+                ngx_log_stderr(0, "option \"-C\" requires file name");
+                return NGX_ERROR;
+
             //ngx_conf_params,指定一些全局配置，例如-g "pid /var/nginx.pid"
             case 'g':
                 if (*p) {
@@ -983,6 +1010,15 @@ ngx_process_options(ngx_cycle_t *cycle)
             break;
         }
     }
+    if (ngx_conf_image) {
+        cycle->conf_image.len = ngx_strlen(ngx_conf_image);
+        cycle->conf_image.data = ngx_conf_image;
+
+        if (ngx_conf_full_name(cycle, &cycle->conf_image, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
     //全局配置
     if (ngx_conf_params) {
         cycle->conf_param.len = ngx_strlen(ngx_conf_params);
@@ -1020,6 +1056,7 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
 
     ccf->daemon = NGX_CONF_UNSET;
     ccf->master = NGX_CONF_UNSET;
+    ccf->handoff = NGX_CONF_UNSET;
     ccf->timer_resolution = NGX_CONF_UNSET_MSEC;
 
     ccf->worker_processes = NGX_CONF_UNSET;
@@ -1048,6 +1085,7 @@ ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
 
     ngx_conf_init_value(ccf->daemon, 1);
     ngx_conf_init_value(ccf->master, 1);
+    ngx_conf_init_value(ccf->handoff, 0);
     ngx_conf_init_msec_value(ccf->timer_resolution, 0);
 
     ngx_conf_init_value(ccf->worker_processes, 1);
@@ -7,12 +7,64 @@
 
 #include <ngx_config.h>
 #include <ngx_core.h>
+#include <ngx_md5.h>
+#include <nginx.h>
 
 #define NGX_CONF_BUFFER  4096
 
+
+/*
+ * the configuration image (-C) keeps the tokens of every configuration
+ * file, a file with the same MD5 of its content is not tokenized again;
+ * module configurations are still created and merged on every parse
+ */
+
+#define NGX_CONF_IMAGE_MAGIC  "NGXCONF2"
+#define NGX_CONF_IMAGE_BUILD  NGINX_VER_BUILD " " NGX_CONFIGURE              \
+                              " " __DATE__ " " __TIME__
+#define NGX_CONF_IMAGE_HASH   256
+
+
+struct ngx_conf_image_file_s {
+    ngx_str_t                 name;
+    off_t                     size;
+    u_char                    md5[16];
+
+    u_char                   *start;
+    u_char                   *end;
+    ngx_array_t              *tokens;
+    ngx_md5_t                 md5ctx;
+
+    ngx_uint_t                visited;  /* unsigned  visited:1; */
+
+    ngx_conf_image_file_t    *next;
+};
+
+
+typedef struct {
+    ngx_array_t               files;
+    ngx_conf_image_file_t    *hash[NGX_CONF_IMAGE_HASH];
+    ngx_uint_t                changed;  /* unsigned  changed:1; */
+} ngx_conf_image_t;
+
+
 static ngx_int_t ngx_conf_handler(ngx_conf_t *cf, ngx_int_t last);
+static ngx_int_t ngx_conf_commands_index(ngx_cycle_t *cycle);
 static ngx_int_t ngx_conf_read_token(ngx_conf_t *cf);
 static void ngx_conf_flush_files(ngx_cycle_t *cycle);
+static void ngx_conf_image_cleanup(void *data);
+static ngx_int_t ngx_conf_image_load(ngx_conf_t *cf, ngx_conf_image_t *image);
+static ngx_conf_image_file_t *ngx_conf_image_add(ngx_conf_t *cf,
+    ngx_conf_image_t *image, ngx_str_t *name);
+static ngx_int_t ngx_conf_image_start(ngx_conf_t *cf, ngx_str_t *filename,
+    ngx_conf_file_t *conf_file, ngx_buf_t *buf);
+static ngx_int_t ngx_conf_image_md5(ngx_conf_t *cf, ngx_str_t *filename,
+    ngx_file_info_t *fi, u_char *md5);
+static ngx_int_t ngx_conf_image_token(ngx_conf_t *cf);
+static ngx_int_t ngx_conf_image_record(ngx_conf_t *cf, ngx_int_t rc);
+
+
+static ngx_conf_image_t  *ngx_conf_image;
 
 
 static ngx_command_t  ngx_conf_commands[] = {
@@ -116,10 +168,22 @@ ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
 
 #if (NGX_SUPPRESS_WARN)
     fd = NGX_INVALID_FILE;
-    prev = NULL;
 #endif
 
-    if (filename) {
+    prev = cf->conf_file;
+
+    if (filename
+        && ngx_conf_image_start(cf, filename, &conf_file, &buf) == NGX_OK)
+    {
+        /* the tokens are replayed from the configuration image */
+
+        fd = NGX_INVALID_FILE;
+
+        cf->conf_file = &conf_file;
+
+        type = parse_file;
+
+    } else if (filename) {
 
         /* open configuration file */
 
@@ -131,8 +195,6 @@ ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
             return NGX_CONF_ERROR;
         }
 
-        prev = cf->conf_file;
-
         cf->conf_file = &conf_file;
 
         if (ngx_fd_info(fd, &cf->conf_file->file.info) == NGX_FILE_ERROR) {
@@ -194,8 +256,9 @@ ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
             cf->conf_file->dump = NULL;
         }
 
-    } else if (cf->conf_file->file.fd != NGX_INVALID_FILE) {
-
+    } else if (cf->conf_file->file.fd != NGX_INVALID_FILE
+               || cf->conf_file->image)
+    {
         type = parse_block;
 
     } else {
@@ -204,7 +267,13 @@ ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
 
 
     for ( ;; ) {
-        rc = ngx_conf_read_token(cf);
+
+        if (cf->conf_file->image) {
+            rc = ngx_conf_image_token(cf);
+
+        } else {
+            rc = ngx_conf_read_token(cf);
+        }
 
         /*
          * ngx_conf_read_token() may return
@@ -220,6 +289,12 @@ ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
             goto done;
         }
 
+        if (cf->conf_file->record) {
+            if (ngx_conf_image_record(cf, rc) != NGX_OK) {
+                goto failed;
+            }
+        }
+
         if (rc == NGX_CONF_BLOCK_DONE) {
 
             if (type != parse_block) {
@@ -298,16 +373,16 @@ done:
             ngx_free(cf->conf_file->buffer->start);
         }
 
-        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        if (fd != NGX_INVALID_FILE && ngx_close_file(fd) == NGX_FILE_ERROR) {
             ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
                           ngx_close_file_n " %s failed",
                           filename->data);
             rc = NGX_ERROR;
         }
-
-        cf->conf_file = prev;
     }
 
+    cf->conf_file = prev;
+
     if (rc == NGX_ERROR) {
         return NGX_CONF_ERROR;
     }
@@ -319,126 +394,134 @@ done:
 static ngx_int_t
 ngx_conf_handler(ngx_conf_t *cf, ngx_int_t last)
 {
-    char           *rv;
-    void           *conf, **confp;
-    ngx_uint_t      i, found;
-    ngx_str_t      *name;
-    ngx_command_t  *cmd;
+    char                *rv;
+    void                *conf, **confp;
+    ngx_uint_t           found;
+    ngx_str_t           *name;
+    ngx_module_t        *module;
+    ngx_command_t       *cmd;
+    ngx_conf_command_t  *cc;
 
     name = cf->args->elts;
 
     found = 0;
 
-    for (i = 0; cf->cycle->modules[i]; i++) {
+    /* the index is rebuilt when dynamic modules are loaded */
 
-        cmd = cf->cycle->modules[i]->commands;
-        if (cmd == NULL) {
-            continue;
+    if (cf->cycle->commands_n != cf->cycle->modules_n) {
+        if (ngx_conf_commands_index(cf->cycle) != NGX_OK) {
+            return NGX_ERROR;
         }
+    }
 
-        for ( /* void */ ; cmd->name.len; cmd++) {
-
-            if (name->len != cmd->name.len) {
-                continue;
-            }
+    cc = cf->cycle->commands[ngx_hash_key(name->data, name->len)
+                             % NGX_CONF_COMMANDS_HASH];
 
-            if (ngx_strcmp(name->data, cmd->name.data) != 0) {
-                continue;
-            }
+    for ( /* void */ ; cc; cc = cc->next) {
 
-            found = 1;
+        cmd = cc->cmd;
+        module = cc->module;
 
-            if (cf->cycle->modules[i]->type != NGX_CONF_MODULE
-                && cf->cycle->modules[i]->type != cf->module_type)
-            {
-                continue;
-            }
-
-            /* is the directive's location right ? */
+        if (name->len != cmd->name.len) {
+            continue;
+        }
 
-            if (!(cmd->type & cf->cmd_type)) {
-                continue;
-            }
+        if (ngx_strcmp(name->data, cmd->name.data) != 0) {
+            continue;
+        }
 
-            if (!(cmd->type & NGX_CONF_BLOCK) && last != NGX_OK) {
-                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                                  "directive \"%s\" is not terminated by \";\"",
-                                  name->data);
-                return NGX_ERROR;
-            }
+        found = 1;
 
-            if ((cmd->type & NGX_CONF_BLOCK) && last != NGX_CONF_BLOCK_START) {
-                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                                   "directive \"%s\" has no opening \"{\"",
-                                   name->data);
-                return NGX_ERROR;
-            }
+        if (module->type != NGX_CONF_MODULE
+            && module->type != cf->module_type)
+        {
+            continue;
+        }
 
-            /* is the directive's argument count right ? */
+        /* is the directive's location right ? */
 
-            if (!(cmd->type & NGX_CONF_ANY)) {
+        if (!(cmd->type & cf->cmd_type)) {
+            continue;
+        }
 
-                if (cmd->type & NGX_CONF_FLAG) {
+        if (!(cmd->type & NGX_CONF_BLOCK) && last != NGX_OK) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                              "directive \"%s\" is not terminated by \";\"",
+                              name->data);
+            return NGX_ERROR;
+        }
 
-                    if (cf->args->nelts != 2) {
-                        goto invalid;
-                    }
+        if ((cmd->type & NGX_CONF_BLOCK) && last != NGX_CONF_BLOCK_START) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "directive \"%s\" has no opening \"{\"",
+                               name->data);
+            return NGX_ERROR;
+        }
 
-                } else if (cmd->type & NGX_CONF_1MORE) {
+        /* is the directive's argument count right ? */
 
-                    if (cf->args->nelts < 2) {
-                        goto invalid;
-                    }
+        if (!(cmd->type & NGX_CONF_ANY)) {
 
-                } else if (cmd->type & NGX_CONF_2MORE) {
+            if (cmd->type & NGX_CONF_FLAG) {
 
-                    if (cf->args->nelts < 3) {
-                        goto invalid;
-                    }
+                if (cf->args->nelts != 2) {
+                    goto invalid;
+                }
 
-                } else if (cf->args->nelts > NGX_CONF_MAX_ARGS) {
+            } else if (cmd->type & NGX_CONF_1MORE) {
 
+                if (cf->args->nelts < 2) {
                     goto invalid;
+                }
 
-                } else if (!(cmd->type & argument_number[cf->args->nelts - 1]))
-                {
+            } else if (cmd->type & NGX_CONF_2MORE) {
+
+                if (cf->args->nelts < 3) {
                     goto invalid;
                 }
-            }
 
-            /* set up the directive's configuration context */
+            } else if (cf->args->nelts > NGX_CONF_MAX_ARGS) {
 
-            conf = NULL;
+                goto invalid;
 
-            if (cmd->type & NGX_DIRECT_CONF) {
-                conf = ((void **) cf->ctx)[cf->cycle->modules[i]->index];
+            } else if (!(cmd->type & argument_number[cf->args->nelts - 1]))
+            {
+                goto invalid;
+            }
+        }
 
-            } else if (cmd->type & NGX_MAIN_CONF) {
-                conf = &(((void **) cf->ctx)[cf->cycle->modules[i]->index]);
+        /* set up the directive's configuration context */
 
-            } else if (cf->ctx) {
-                confp = *(void **) ((char *) cf->ctx + cmd->conf);
+        conf = NULL;
 
-                if (confp) {
-                    conf = confp[cf->cycle->modules[i]->ctx_index];
-                }
-            }
+        if (cmd->type & NGX_DIRECT_CONF) {
+            conf = ((void **) cf->ctx)[module->index];
 
-            rv = cmd->set(cf, cmd, conf);
+        } else if (cmd->type & NGX_MAIN_CONF) {
+            conf = &(((void **) cf->ctx)[module->index]);
 
-            if (rv == NGX_CONF_OK) {
-                return NGX_OK;
-            }
+        } else if (cf->ctx) {
+            confp = *(void **) ((char *) cf->ctx + cmd->conf);
 
-            if (rv == NGX_CONF_ERROR) {
-                return NGX_ERROR;
+            if (confp) {
+                conf = confp[module->ctx_index];
             }
+        }
 
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "\"%s\" directive %s", name->data, rv);
+        rv = cmd->set(cf, cmd, conf);
+
+        if (rv == NGX_CONF_OK) {
+            return NGX_OK;
+        }
 
+        if (rv == NGX_CONF_ERROR) {
             return NGX_ERROR;
         }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%s\" directive %s", name->data, rv);
+
+        return NGX_ERROR;
     }
 
     if (found) {
@@ -463,6 +546,57 @@ invalid:
 }
 
 
+//按指令名建立所有模块指令的散列表,代替对每个模块指令的逐个比较
+static ngx_int_t
+ngx_conf_commands_index(ngx_cycle_t *cycle)
+{
+    ngx_uint_t            i, key;
+    ngx_command_t        *cmd;
+    ngx_conf_command_t   *cc, **last, **commands;
+
+    commands = ngx_pcalloc(cycle->pool,
+                           NGX_CONF_COMMANDS_HASH * sizeof(ngx_conf_command_t *));
+    if (commands == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; cycle->modules[i]; i++) {
+
+        cmd = cycle->modules[i]->commands;
+        if (cmd == NULL) {
+            continue;
+        }
+
+        for ( /* void */ ; cmd->name.len; cmd++) {
+
+            cc = ngx_palloc(cycle->pool, sizeof(ngx_conf_command_t));
+            if (cc == NULL) {
+                return NGX_ERROR;
+            }
+
+            cc->cmd = cmd;
+            cc->module = cycle->modules[i];
+            cc->next = NULL;
+
+            //追加到链表尾部,保持模块原来的顺序
+            key = ngx_hash_key(cmd->name.data, cmd->name.len)
+                  % NGX_CONF_COMMANDS_HASH;
+
+            for (last = &commands[key]; *last; last = &(*last)->next) {
+                /* void */
+            }
+
+            *last = cc;
+        }
+    }
+
+    cycle->commands = commands;
+    cycle->commands_n = cycle->modules_n;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_conf_read_token(ngx_conf_t *cf)
 {
@@ -569,6 +703,11 @@ ngx_conf_read_token(ngx_conf_t *cf)
             b->last = b->pos + n;
             start = b->start;
 
+            if (cf->conf_file->record) {
+                ngx_md5_update(&cf->conf_file->record->md5ctx, b->pos, n);
+                cf->conf_file->record->size += n;
+            }
+
             if (dump) {
                 dump->last = ngx_cpymem(dump->last, b->pos, size);
             }
@@ -775,6 +914,665 @@ ngx_conf_read_token(ngx_conf_t *cf)
 }
 
 
+//开始一次配置解析时读取预编译配置,没有或不可用时所有配置文件都重新记录
+void
+ngx_conf_image_open(ngx_conf_t *cf)
+{
+    ngx_conf_image_t    *image;
+    ngx_pool_cleanup_t  *cln;
+
+    ngx_conf_image = NULL;
+
+    if (cf->cycle->conf_image.len == 0 || ngx_dump_config) {
+        return;
+    }
+
+    image = ngx_pcalloc(cf->temp_pool, sizeof(ngx_conf_image_t));
+    if (image == NULL) {
+        return;
+    }
+
+    //解析失败时临时内存池被销毁,同时清除指向它的预编译配置
+    cln = ngx_pool_cleanup_add(cf->temp_pool, 0);
+    if (cln == NULL) {
+        return;
+    }
+
+    cln->handler = ngx_conf_image_cleanup;
+    cln->data = image;
+
+    if (ngx_array_init(&image->files, cf->temp_pool, 16,
+                       sizeof(ngx_conf_image_file_t *))
+        != NGX_OK)
+    {
+        return;
+    }
+
+    if (ngx_conf_image_load(cf, image) != NGX_OK) {
+        ngx_memzero(image->hash, sizeof(image->hash));
+        image->files.nelts = 0;
+        image->changed = 1;
+    }
+
+    ngx_conf_image = image;
+}
+
+
+static void
+ngx_conf_image_cleanup(void *data)
+{
+    if (ngx_conf_image == data) {
+        ngx_conf_image = NULL;
+    }
+}
+
+
+static ngx_int_t
+ngx_conf_image_load(ngx_conf_t *cf, ngx_conf_image_t *image)
+{
+    u_char                 *p, *last;
+    size_t                  len, size;
+    ssize_t                 n;
+    ngx_str_t               name;
+    ngx_uint_t              i, nfiles;
+    ngx_file_t              file;
+    ngx_file_info_t         fi;
+    ngx_conf_image_file_t  *f;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = cf->cycle->conf_image;
+    file.log = cf->log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, cf->log, ngx_errno,
+                          ngx_open_file_n " \"%s\" failed", file.name.data);
+        }
+
+        return NGX_ERROR;
+    }
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, cf->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file.name.data);
+        goto failed;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    p = ngx_pnalloc(cf->temp_pool, size);
+    if (p == NULL) {
+        goto failed;
+    }
+
+    n = ngx_read_file(&file, p, size, 0);
+
+    if (n == NGX_ERROR) {
+        goto failed;
+    }
+
+    if ((size_t) n != size) {
+        ngx_log_error(NGX_LOG_CRIT, cf->log, 0,
+                      ngx_read_file_n " \"%s\" returned only %z bytes "
+                      "instead of %uz", file.name.data, n, size);
+        goto failed;
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    last = p + size;
+
+    len = sizeof(NGX_CONF_IMAGE_MAGIC) - 1;
+
+    if (size < len + sizeof(size_t)
+        || ngx_memcmp(p, NGX_CONF_IMAGE_MAGIC, len) != 0)
+    {
+        goto invalid;
+    }
+
+    p += len;
+
+    ngx_memcpy(&len, p, sizeof(size_t));
+    p += sizeof(size_t);
+
+    if (len != sizeof(NGX_CONF_IMAGE_BUILD) - 1
+        || (size_t) (last - p) < len + sizeof(ngx_uint_t)
+        || ngx_memcmp(p, NGX_CONF_IMAGE_BUILD, len) != 0)
+    {
+        ngx_log_error(NGX_LOG_NOTICE, cf->log, 0,
+                      "configuration image \"%s\" was created by "
+                      "another build, ignored", file.name.data);
+        return NGX_ERROR;
+    }
+
+    p += len;
+
+    ngx_memcpy(&nfiles, p, sizeof(ngx_uint_t));
+    p += sizeof(ngx_uint_t);
+
+    for (i = 0; i < nfiles; i++) {
+
+        if ((size_t) (last - p) < sizeof(size_t)) {
+            goto invalid;
+        }
+
+        ngx_memcpy(&name.len, p, sizeof(size_t));
+        p += sizeof(size_t);
+
+        if ((size_t) (last - p) < name.len + 1 + sizeof(off_t) + 16
+                                  + sizeof(size_t))
+        {
+            goto invalid;
+        }
+
+        name.data = p;
+        p += name.len + 1;
+
+        f = ngx_conf_image_add(cf, image, &name);
+        if (f == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(&f->size, p, sizeof(off_t));
+        p += sizeof(off_t);
+
+        ngx_memcpy(f->md5, p, 16);
+        p += 16;
+
+        ngx_memcpy(&len, p, sizeof(size_t));
+        p += sizeof(size_t);
+
+        if ((size_t) (last - p) < len) {
+            goto invalid;
+        }
+
+        f->start = p;
+        f->end = p + len;
+
+        p += len;
+    }
+
+    if (p != last) {
+        goto invalid;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    return NGX_ERROR;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_NOTICE, cf->log, 0,
+                  "invalid configuration image \"%s\", ignored",
+                  file.name.data);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_conf_image_file_t *
+ngx_conf_image_add(ngx_conf_t *cf, ngx_conf_image_t *image, ngx_str_t *name)
+{
+    ngx_uint_t               key;
+    ngx_conf_image_file_t   *f, **files;
+
+    f = ngx_pcalloc(cf->temp_pool, sizeof(ngx_conf_image_file_t));
+    if (f == NULL) {
+        return NULL;
+    }
+
+    f->name.len = name->len;
+    f->name.data = ngx_pnalloc(cf->temp_pool, name->len + 1);
+    if (f->name.data == NULL) {
+        return NULL;
+    }
+
+    ngx_cpystrn(f->name.data, name->data, name->len + 1);
+
+    files = ngx_array_push(&image->files);
+    if (files == NULL) {
+        return NULL;
+    }
+
+    *files = f;
+
+    key = ngx_hash_key(name->data, name->len) % NGX_CONF_IMAGE_HASH;
+
+    f->next = image->hash[key];
+    image->hash[key] = f;
+
+    return f;
+}
+
+
+//配置文件未修改时从预编译配置中回放token,否则读取文件并记录token
+static ngx_int_t
+ngx_conf_image_start(ngx_conf_t *cf, ngx_str_t *filename,
+    ngx_conf_file_t *conf_file, ngx_buf_t *buf)
+{
+    u_char                  md5[16];
+    ngx_uint_t              key;
+    ngx_file_info_t         fi;
+    ngx_conf_image_t       *image;
+    ngx_conf_image_file_t  *f;
+
+    conf_file->image = NULL;
+    conf_file->record = NULL;
+
+    image = ngx_conf_image;
+
+    if (image == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_file_info(filename->data, &fi) == NGX_FILE_ERROR) {
+        return NGX_DECLINED;
+    }
+
+    key = ngx_hash_key(filename->data, filename->len) % NGX_CONF_IMAGE_HASH;
+
+    for (f = image->hash[key]; f; f = f->next) {
+        if (f->name.len == filename->len
+            && ngx_strncmp(f->name.data, filename->data, filename->len) == 0)
+        {
+            break;
+        }
+    }
+
+    /*
+     * the file is compared by its content: an edit that keeps the size
+     * and is made within the same second does not change mtime
+     */
+
+    if (f && f->start
+        && f->size == ngx_file_size(&fi)
+        && ngx_conf_image_md5(cf, filename, &fi, md5) == NGX_OK
+        && ngx_memcmp(f->md5, md5, 16) == 0)
+    {
+        f->visited = 1;
+
+        ngx_memzero(buf, sizeof(ngx_buf_t));
+
+        buf->pos = f->start;
+        buf->last = f->end;
+
+        conf_file->buffer = buf;
+        conf_file->dump = NULL;
+        conf_file->image = f;
+
+        conf_file->file.fd = NGX_INVALID_FILE;
+        conf_file->file.name.len = filename->len;
+        conf_file->file.name.data = filename->data;
+        conf_file->file.info = fi;
+        conf_file->file.offset = 0;
+        conf_file->file.log = cf->log;
+        conf_file->line = 1;
+
+        return NGX_OK;
+    }
+
+    if (f && f->tokens) {
+
+        /* the file was already recorded by this parse */
+
+        return NGX_DECLINED;
+    }
+
+    if (f == NULL) {
+        f = ngx_conf_image_add(cf, image, filename);
+        if (f == NULL) {
+            return NGX_DECLINED;
+        }
+    }
+
+    f->tokens = ngx_array_create(cf->temp_pool, NGX_CONF_BUFFER, 1);
+    if (f->tokens == NULL) {
+        return NGX_DECLINED;
+    }
+
+    /* the size and MD5 are of the bytes actually tokenized */
+
+    f->start = NULL;
+    f->end = NULL;
+    f->size = 0;
+    f->visited = 1;
+
+    ngx_md5_init(&f->md5ctx);
+
+    image->changed = 1;
+
+    conf_file->record = f;
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_conf_image_md5(ngx_conf_t *cf, ngx_str_t *filename, ngx_file_info_t *fi,
+    u_char *md5)
+{
+    off_t       size;
+    u_char     *buf;
+    ssize_t     n;
+    ngx_int_t   rc;
+    ngx_md5_t   ctx;
+    ngx_file_t  file;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = *filename;
+    file.log = cf->log;
+
+    file.fd = ngx_open_file(filename->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (file.fd == NGX_INVALID_FILE) {
+        return NGX_ERROR;
+    }
+
+    buf = ngx_alloc(NGX_CONF_BUFFER * 16, cf->log);
+    if (buf == NULL) {
+        rc = NGX_ERROR;
+        goto done;
+    }
+
+    ngx_md5_init(&ctx);
+
+    size = ngx_file_size(fi);
+    rc = NGX_OK;
+
+    while (file.offset < size) {
+
+        n = ngx_read_file(&file, buf,
+                          (size_t) ngx_min(size - file.offset,
+                                           NGX_CONF_BUFFER * 16),
+                          file.offset);
+
+        if (n == NGX_ERROR || n == 0) {
+            rc = NGX_ERROR;
+            break;
+        }
+
+        ngx_md5_update(&ctx, buf, n);
+    }
+
+    ngx_md5_final(md5, &ctx);
+
+    ngx_free(buf);
+
+done:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", filename->data);
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_conf_image_token(ngx_conf_t *cf)
+{
+    u_char      *p, *last;
+    size_t       len;
+    ngx_int_t    rc;
+    ngx_str_t   *word;
+    ngx_buf_t   *b;
+    ngx_uint_t   i, line, nargs;
+
+    cf->args->nelts = 0;
+
+    b = cf->conf_file->buffer;
+
+    p = b->pos;
+    last = b->last;
+
+    if ((size_t) (last - p) < sizeof(ngx_int_t) + 2 * sizeof(ngx_uint_t)) {
+        goto invalid;
+    }
+
+    ngx_memcpy(&rc, p, sizeof(ngx_int_t));
+    p += sizeof(ngx_int_t);
+
+    ngx_memcpy(&line, p, sizeof(ngx_uint_t));
+    p += sizeof(ngx_uint_t);
+
+    ngx_memcpy(&nargs, p, sizeof(ngx_uint_t));
+    p += sizeof(ngx_uint_t);
+
+    for (i = 0; i < nargs; i++) {
+
+        if ((size_t) (last - p) < sizeof(size_t)) {
+            goto invalid;
+        }
+
+        ngx_memcpy(&len, p, sizeof(size_t));
+        p += sizeof(size_t);
+
+        if ((size_t) (last - p) < len + 1) {
+            goto invalid;
+        }
+
+        word = ngx_array_push(cf->args);
+        if (word == NULL) {
+            return NGX_ERROR;
+        }
+
+        word->data = ngx_pnalloc(cf->pool, len + 1);
+        if (word->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(word->data, p, len + 1);
+        word->len = len;
+
+        p += len + 1;
+    }
+
+    b->pos = p;
+    cf->conf_file->line = line;
+
+    return rc;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid configuration image \"%V\"",
+                       &cf->cycle->conf_image);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_conf_image_record(ngx_conf_t *cf, ngx_int_t rc)
+{
+    u_char      *p;
+    size_t       size;
+    ngx_str_t   *word;
+    ngx_uint_t   i, line, nargs;
+
+    word = cf->args->elts;
+    nargs = cf->args->nelts;
+    line = cf->conf_file->line;
+
+    size = sizeof(ngx_int_t) + 2 * sizeof(ngx_uint_t);
+
+    for (i = 0; i < nargs; i++) {
+        size += sizeof(size_t) + word[i].len + 1;
+    }
+
+    p = ngx_array_push_n(cf->conf_file->record->tokens, size);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_cpymem(p, &rc, sizeof(ngx_int_t));
+    p = ngx_cpymem(p, &line, sizeof(ngx_uint_t));
+    p = ngx_cpymem(p, &nargs, sizeof(ngx_uint_t));
+
+    for (i = 0; i < nargs; i++) {
+        p = ngx_cpymem(p, &word[i].len, sizeof(size_t));
+        p = ngx_cpymem(p, word[i].data, word[i].len);
+        *p++ = '\0';
+    }
+
+    return NGX_OK;
+}
+
+
+//配置解析成功后,有配置文件被修改、增加或删除时重写预编译配置
+void
+ngx_conf_image_write(ngx_conf_t *cf)
+{
+    u_char                  *p, *data;
+    size_t                   len, size;
+    ngx_fd_t                 fd;
+    ngx_str_t                temp, *name;
+    ngx_uint_t               i, n;
+    ngx_conf_image_t        *image;
+    ngx_conf_image_file_t  **files, *f;
+
+    image = ngx_conf_image;
+    ngx_conf_image = NULL;
+
+    if (image == NULL) {
+        return;
+    }
+
+    files = image->files.elts;
+
+    n = 0;
+    size = sizeof(NGX_CONF_IMAGE_MAGIC) - 1 + sizeof(size_t)
+           + sizeof(NGX_CONF_IMAGE_BUILD) - 1 + sizeof(ngx_uint_t);
+
+    for (i = 0; i < image->files.nelts; i++) {
+        f = files[i];
+
+        if (!f->visited) {
+            image->changed = 1;
+            continue;
+        }
+
+        len = f->tokens ? f->tokens->nelts : (size_t) (f->end - f->start);
+
+        size += sizeof(size_t) + f->name.len + 1 + sizeof(off_t) + 16
+                + sizeof(size_t) + len;
+        n++;
+    }
+
+    if (!image->changed) {
+        return;
+    }
+
+    data = ngx_pnalloc(cf->temp_pool, size);
+    if (data == NULL) {
+        return;
+    }
+
+    p = ngx_cpymem(data, NGX_CONF_IMAGE_MAGIC,
+                   sizeof(NGX_CONF_IMAGE_MAGIC) - 1);
+
+    len = sizeof(NGX_CONF_IMAGE_BUILD) - 1;
+    p = ngx_cpymem(p, &len, sizeof(size_t));
+    p = ngx_cpymem(p, NGX_CONF_IMAGE_BUILD, len);
+    p = ngx_cpymem(p, &n, sizeof(ngx_uint_t));
+
+    for (i = 0; i < image->files.nelts; i++) {
+        f = files[i];
+
+        if (!f->visited) {
+            continue;
+        }
+
+        p = ngx_cpymem(p, &f->name.len, sizeof(size_t));
+        p = ngx_cpymem(p, f->name.data, f->name.len + 1);
+        if (f->tokens) {
+            ngx_md5_final(f->md5, &f->md5ctx);
+        }
+
+        p = ngx_cpymem(p, &f->size, sizeof(off_t));
+        p = ngx_cpymem(p, f->md5, 16);
+
+        if (f->tokens) {
+            len = f->tokens->nelts;
+            p = ngx_cpymem(p, &len, sizeof(size_t));
+            p = ngx_cpymem(p, f->tokens->elts, len);
+
+        } else {
+            len = f->end - f->start;
+            p = ngx_cpymem(p, &len, sizeof(size_t));
+            p = ngx_cpymem(p, f->start, len);
+        }
+    }
+
+    /* the image is replaced atomically */
+
+    name = &cf->cycle->conf_image;
+
+    temp.len = name->len + sizeof(".tmp") - 1;
+    temp.data = ngx_pnalloc(cf->temp_pool, temp.len + 1);
+    if (temp.data == NULL) {
+        return;
+    }
+
+    ngx_sprintf(temp.data, "%V.tmp%Z", name);
+
+    fd = ngx_open_file(temp.data, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                       NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, cf->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", temp.data);
+        return;
+    }
+
+    if (ngx_write_fd(fd, data, size) != (ssize_t) size) {
+        ngx_log_error(NGX_LOG_CRIT, cf->log, ngx_errno,
+                      ngx_write_fd_n " \"%s\" failed", temp.data);
+
+        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", temp.data);
+        }
+
+        if (ngx_delete_file(temp.data) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", temp.data);
+        }
+
+        return;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp.data);
+    }
+
+    if (ngx_rename_file(temp.data, name->data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, cf->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      temp.data, name->data);
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, cf->log, 0,
+                  "configuration image \"%s\" updated, %ui files", name->data, n);
+}
+
+
 char *
 ngx_conf_include(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -87,6 +87,17 @@ struct ngx_command_s
 
 #define ngx_null_command  { ngx_null_string, 0, NULL, 0, 0, NULL }
 
+
+//指令名的散列表,同名的指令按模块的顺序排列
+#define NGX_CONF_COMMANDS_HASH  1024
+
+struct ngx_conf_command_s
+{
+    ngx_command_t        *cmd;
+    ngx_module_t         *module;
+    ngx_conf_command_t   *next;
+};
+
 //打开的文件结构体
 struct ngx_open_file_s 
 {
@@ -98,12 +109,17 @@ struct ngx_open_file_s
 };
 
 
+//预编译配置(-C)中一个配置文件的token记录
+typedef struct ngx_conf_image_file_s  ngx_conf_image_file_t;
+
 typedef struct 
 {
-    ngx_file_t            file;
-    ngx_buf_t            *buffer;
-    ngx_buf_t            *dump;
-    ngx_uint_t            line;
+    ngx_file_t              file;
+    ngx_buf_t              *buffer;
+    ngx_buf_t              *dump;
+    ngx_uint_t              line;
+    ngx_conf_image_file_t  *image;//不为NULL时从预编译配置中回放token
+    ngx_conf_image_file_t  *record;//不为NULL时记录读到的token和文件内容的MD5
 } ngx_conf_file_t;
 
 
@@ -273,6 +289,8 @@ char *ngx_conf_check_num_bounds(ngx_conf_t *cf, void *post, void *data);
 
 char *ngx_conf_param(ngx_conf_t *cf);
 char *ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename);
+void ngx_conf_image_open(ngx_conf_t *cf);
+void ngx_conf_image_write(ngx_conf_t *cf);
 char *ngx_conf_include(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 
@@ -20,6 +20,7 @@ typedef struct ngx_chain_s       ngx_chain_t;
 typedef struct ngx_log_s         ngx_log_t;         //日志结构体
 typedef struct ngx_open_file_s   ngx_open_file_t;   //打开文件的结构体
 typedef struct ngx_command_s     ngx_command_t;     //命令结构体
+typedef struct ngx_conf_command_s  ngx_conf_command_t; //指令名索引的节点
 typedef struct ngx_file_s        ngx_file_t;        //文件结构体
 typedef struct ngx_event_s       ngx_event_t;       //时间结构体
 typedef struct ngx_event_aio_s   ngx_event_aio_t;   //异步io结构体
@@ -27,6 +28,7 @@ typedef struct ngx_connection_s  ngx_connection_t;  //连接对应的结构体
 
 #if (NGX_THREADS)
 typedef struct ngx_thread_task_s  ngx_thread_task_t;
+typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
 #endif
 
 typedef void (*ngx_event_handler_pt)(ngx_event_t *ev);
@@ -72,6 +74,7 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 #include <ngx_regex.h>
 #endif
 #include <ngx_radix_tree.h>
+#include <ngx_prefix_tree.h>
 #include <ngx_times.h>
 #include <ngx_rwlock.h>
 #include <ngx_shmtx.h>
@@ -11,6 +11,7 @@
 
 
 static void ngx_destroy_cycle_pools(ngx_conf_t *conf);
+static ngx_msec_t ngx_cycle_msec(void);
 static ngx_int_t ngx_init_zone_pool(ngx_cycle_t *cycle,
     ngx_shm_zone_t *shm_zone);
 static ngx_int_t ngx_test_lockfile(u_char *file, ngx_log_t *log);
@@ -50,6 +51,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     ngx_listening_t     *ls, *nls;
     ngx_core_conf_t     *ccf, *old_ccf;
     ngx_core_module_t   *module;
+    ngx_msec_t           start, parsed, configured, opened, shared,
+                         listened, initialized;
     char                 hostname[NGX_MAXHOSTNAMELEN];
     //获取当前时区的时间
     ngx_timezone_update();
@@ -61,6 +64,9 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     //更新时间
     ngx_time_update();
 
+    //各阶段的耗时,初始化完成后输出到日志
+    start = ngx_cycle_msec();
+
     //初始化log
     log = old_cycle->log;
     //创建内存池,默认大小16k
@@ -68,6 +74,9 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     if (pool == NULL) {
         return NULL;
     }
+
+    ngx_pool_set_type(pool, NGX_POOL_CYCLE);
+
     //log就是之前的log
     pool->log = log;
     //分配一个cycle，并初始化为0
@@ -104,6 +113,15 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     ngx_cpystrn(cycle->conf_file.data, old_cycle->conf_file.data,
                 old_cycle->conf_file.len + 1);
 
+    cycle->conf_image.len = old_cycle->conf_image.len;
+    cycle->conf_image.data = ngx_pnalloc(pool, old_cycle->conf_image.len + 1);
+    if (cycle->conf_image.data == NULL) {
+        ngx_destroy_pool(pool);
+        return NULL;
+    }
+    ngx_cpystrn(cycle->conf_image.data, old_cycle->conf_image.data,
+                old_cycle->conf_image.len + 1);
+
     cycle->conf_param.len = old_cycle->conf_param.len;
     cycle->conf_param.data = ngx_pstrdup(pool, &old_cycle->conf_param);
     if (cycle->conf_param.data == NULL) {
@@ -266,6 +284,9 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     log->log_level = NGX_LOG_DEBUG_ALL;
 #endif
 
+    //有-C时从预编译配置中读取未修改的配置文件
+    ngx_conf_image_open(&conf);
+
     if (ngx_conf_param(&conf) != NGX_CONF_OK) {
         environ = senv;
         ngx_destroy_cycle_pools(&conf);
@@ -278,6 +299,10 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         return NULL;
     }
 
+    ngx_conf_image_write(&conf);
+
+    parsed = ngx_cycle_msec();
+
     if (ngx_test_config && !ngx_quiet_mode) {
         ngx_log_stderr(0, "the configuration file %s syntax is ok",
                        cycle->conf_file.data);
@@ -302,6 +327,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         }
     }
 
+    configured = ngx_cycle_msec();
+
     if (ngx_process == NGX_PROCESS_SIGNALLER) {
         return cycle;
     }
@@ -400,6 +427,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     cycle->log = &cycle->new_log;
     pool->log = &cycle->new_log;
 
+    opened = ngx_cycle_msec();
+
 
     /* create shared memory */
 
@@ -493,6 +522,9 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     }
 
 
+    shared = ngx_cycle_msec();
+
+
     /* handle the listening sockets */
 
     if (old_cycle->listening.nelts) {
@@ -615,6 +647,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         ngx_configure_listening_sockets(cycle);
     }
 
+    listened = ngx_cycle_msec();
+
 
     /* commit the new cycle configuration */
 
@@ -629,6 +663,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         exit(1);
     }
 
+    initialized = ngx_cycle_msec();
+
 
     /* close and delete stuff that lefts from an old cycle */
 
@@ -746,6 +782,15 @@ old_shm_zone_done:
 
     ngx_destroy_pool(conf.temp_pool);
 
+    ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                  "cycle initialized in %Mms: parse %Mms, init conf %Mms, "
+                  "files %Mms, shared memory %Mms, listen %Mms, "
+                  "init modules %Mms, cleanup %Mms",
+                  ngx_cycle_msec() - start, parsed - start,
+                  configured - parsed, opened - configured, shared - opened,
+                  listened - shared, initialized - listened,
+                  ngx_cycle_msec() - initialized);
+
     if (ngx_process == NGX_PROCESS_MASTER || ngx_is_init_cycle(old_cycle)) {
 
         /*
@@ -876,6 +921,18 @@ ngx_destroy_cycle_pools(ngx_conf_t *conf)
 }
 
 
+//不依赖缓存时间的毫秒数,用于统计初始化各阶段的耗时
+static ngx_msec_t
+ngx_cycle_msec(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (ngx_msec_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
 static ngx_int_t
 ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
 {
@@ -52,6 +52,9 @@ struct ngx_cycle_s {
     ngx_uint_t                modules_n;//module数量
     ngx_uint_t                modules_used;    /* unsigned  modules_used:1; */
 
+    ngx_conf_command_t      **commands;//按指令名索引的所有模块的指令
+    ngx_uint_t                commands_n;//建索引时的module数量
+
     ngx_queue_t               reusable_connections_queue;
 
     ngx_array_t               listening;//侦听的array
@@ -71,6 +74,7 @@ struct ngx_cycle_s {
 
     ngx_str_t                 conf_file;//配置文件
     ngx_str_t                 conf_param;
+    ngx_str_t                 conf_image;//预编译配置的文件(-C)
     ngx_str_t                 conf_prefix;
     ngx_str_t                 prefix;
     ngx_str_t                 lock_file;
@@ -81,6 +85,7 @@ struct ngx_cycle_s {
 typedef struct {
     ngx_flag_t                daemon;//守护进程
     ngx_flag_t                master;//master-salver
+    ngx_flag_t                handoff;//退出时把空闲连接交给新的worker
 
     ngx_msec_t                timer_resolution;
 
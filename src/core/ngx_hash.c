@@ -12,6 +12,7 @@
 void *
 ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
 {
+    u_char           tag;
     ngx_uint_t       i;
     ngx_hash_elt_t  *elt;
 
@@ -25,8 +26,11 @@ ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
         return NULL;
     }
 
+    tag = ngx_hash_tag(key);
+
+    //先比较tag和长度,大部分不匹配的元素不需要逐字节比较name
     while (elt->value) {
-        if (len != (size_t) elt->len) {
+        if (tag != elt->tag || len != (size_t) elt->len) {
             goto next;
         }
 
@@ -246,7 +250,11 @@ ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key, u_char *name,
 
 
 #define NGX_HASH_ELT_SIZE(name)                                               \
-    (sizeof(void *) + ngx_align((name)->key.len + 2, sizeof(void *)))
+    (sizeof(void *) + ngx_align((name)->key.len + 3, sizeof(void *)))
+
+//自动调整时bucket_size最多增加到配置值的这个倍数
+#define NGX_HASH_AUTO_BUCKET      4
+#define NGX_HASH_MAX_BUCKET_SIZE  32768
 
 ngx_int_t
 ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
@@ -254,7 +262,7 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
     u_char          *elts;
     size_t           len;
     u_short         *test;
-    ngx_uint_t       i, n, key, size, start, bucket_size;
+    ngx_uint_t       i, n, key, size, start, bucket_size, max_bucket;
     ngx_hash_elt_t  *elt, **buckets;
 
     if (hinit->max_size == 0) {
@@ -265,25 +273,51 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
         return NGX_ERROR;
     }
 
+    /*
+     * bucket_size太小放不下某个元素时,不再报错,
+     * 而是自动增加到能放下最大元素的大小(按cache line对齐)
+     */
+
+    max_bucket = hinit->bucket_size;
+
     for (n = 0; n < nelts; n++) {
-        if (hinit->bucket_size < NGX_HASH_ELT_SIZE(&names[n]) + sizeof(void *))
-        {
-            ngx_log_error(NGX_LOG_EMERG, hinit->pool->log, 0,
-                          "could not build %s, you should "
-                          "increase %s_bucket_size: %i",
-                          hinit->name, hinit->name, hinit->bucket_size);
-            return NGX_ERROR;
+        len = NGX_HASH_ELT_SIZE(&names[n]) + sizeof(void *);
+
+        if (max_bucket < len) {
+            max_bucket = len;
         }
     }
 
+    if (max_bucket > NGX_HASH_MAX_BUCKET_SIZE) {
+        ngx_log_error(NGX_LOG_EMERG, hinit->pool->log, 0,
+                      "could not build %s, you should "
+                      "increase %s_bucket_size: %i",
+                      hinit->name, hinit->name, hinit->bucket_size);
+        return NGX_ERROR;
+    }
+
+    if (max_bucket != hinit->bucket_size) {
+        max_bucket = ngx_align(max_bucket, ngx_cacheline_size);
+    }
+
+    bucket_size = max_bucket;
+
+    max_bucket = ngx_max(max_bucket, hinit->bucket_size * NGX_HASH_AUTO_BUCKET);
+    max_bucket = ngx_min(max_bucket, NGX_HASH_MAX_BUCKET_SIZE);
+
     test = ngx_alloc(hinit->max_size * sizeof(u_short), hinit->pool->log);
     if (test == NULL) {
         return NGX_ERROR;
     }
 
-    bucket_size = hinit->bucket_size - sizeof(void *);
+    /*
+     * 在max_size以内找不到合适的大小时,把bucket_size加倍后重新查找,
+     * 直到配置值的NGX_HASH_AUTO_BUCKET倍
+     */
+
+retry:
 
-    start = nelts / (bucket_size / (2 * sizeof(void *)));
+    start = nelts / ((bucket_size - sizeof(void *)) / (2 * sizeof(void *)));
     start = start ? start : 1;
 
     if (hinit->max_size > 10000 && nelts && hinit->max_size / nelts < 100) {
@@ -308,7 +342,7 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
                           size, key, test[key], &names[n].key);
 #endif
 
-            if (test[key] > (u_short) bucket_size) {
+            if (test[key] > (u_short) (bucket_size - sizeof(void *))) {
                 goto next;
             }
         }
@@ -320,6 +354,11 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
         continue;
     }
 
+    if (bucket_size * 2 <= max_bucket) {
+        bucket_size *= 2;
+        goto retry;
+    }
+
     size = hinit->max_size;
 
     ngx_log_error(NGX_LOG_WARN, hinit->pool->log, 0,
@@ -329,8 +368,19 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
                   hinit->name, hinit->name, hinit->max_size,
                   hinit->name, hinit->bucket_size, hinit->name);
 
+    goto build;
+
 found:
 
+    if (bucket_size != hinit->bucket_size) {
+        ngx_log_error(NGX_LOG_INFO, hinit->pool->log, 0,
+                      "%s: using %s_bucket_size %ui instead of %i",
+                      hinit->name, hinit->name, bucket_size,
+                      hinit->bucket_size);
+    }
+
+build:
+
     for (i = 0; i < size; i++) {
         test[i] = sizeof(void *);
     }
@@ -407,6 +457,7 @@ found:
 
         elt->value = names[n].value;
         elt->len = (u_short) names[n].key.len;
+        elt->tag = ngx_hash_tag(names[n].key_hash);
 
         ngx_strlow(elt->name, names[n].key.data, names[n].key.len);
 
@@ -16,6 +16,7 @@
 typedef struct {
     void             *value;//存储值
     u_short           len;  //存储值的长度
+    u_char            tag;  //key的hash值的一个字节,比较name之前先比较它
     u_char            name[1];
 } ngx_hash_elt_t;
 
@@ -110,6 +111,8 @@ ngx_int_t ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
 
 //产生hash key
 #define ngx_hash(key, c)   ((ngx_uint_t) key * 31 + c)
+//同一个桶中的key低位相关,所以混合几个字节作为tag
+#define ngx_hash_tag(key)  ((u_char) ((key) ^ ((key) >> 8) ^ ((key) >> 16)))
 ngx_uint_t ngx_hash_key(u_char *data, size_t len);
 ngx_uint_t ngx_hash_key_lc(u_char *data, size_t len);
 ngx_uint_t ngx_hash_strlow(u_char *dst, u_char *src, size_t n);
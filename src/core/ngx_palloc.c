@@ -8,19 +8,88 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
+
+#if (NGX_PALLOC_PROFILE)
+//这里定义的是真正的分配函数,不能被统计用的宏替换
+#undef ngx_palloc
+#undef ngx_pnalloc
+#undef ngx_pcalloc
+#undef ngx_pmemalign
+#endif
+
 //这几个函数为static,不能在文件外部使用
 static ngx_inline void *ngx_palloc_small(ngx_pool_t *pool, size_t size,
     ngx_uint_t align);//分配小内存
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);//分配块
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);//分配大块内存
+static void *ngx_pool_cache_alloc(size_t size, ngx_log_t *log);//从缓存中取块
+static void ngx_pool_cache_free(void *p, size_t size);//把块放回缓存
+static size_t ngx_pool_cache_class(size_t size);//大块内存的尺寸等级
+#if (NGX_PALLOC_PROFILE)
+static void ngx_pool_profile_destroy(ngx_pool_t *pool);//销毁时按类型统计
+#endif
+
+
+#define NGX_POOL_CACHE_SLOTS       16           //缓存的尺寸种类数
+#define NGX_POOL_CACHE_SLOT_SIZE   (512 * 1024) //每种尺寸最多缓存的字节数(高水位)
+#define NGX_POOL_CACHE_MIN_BLOCKS  4            //每种尺寸至少能缓存的块数
+#define NGX_POOL_CACHE_MAX_LARGE   (64 * 1024)  //超过这个大小的大块内存不缓存
+
+
+typedef struct ngx_pool_cached_block_s  ngx_pool_cached_block_t;
+
+//空闲块复用块本身的头部作为链表指针
+struct ngx_pool_cached_block_s {
+    ngx_pool_cached_block_t  *next;
+};
+
+
+typedef struct {
+    size_t                    size;     //块的大小,同一个slot中的块大小完全相同
+    ngx_pool_cached_block_t  *free;     //空闲块链表
+    ngx_uint_t                number;   //空闲块个数
+    ngx_uint_t                max;      //高水位,超过后直接free
+    ngx_uint_t                hits;     //命中次数
+    ngx_uint_t                misses;   //未命中,需要调用memalign的次数
+    ngx_uint_t                trimmed;  //超过高水位被释放的次数
+} ngx_pool_cache_slot_t;
+
+
+typedef struct {
+    ngx_pool_cache_slot_t     slots[NGX_POOL_CACHE_SLOTS];
+    ngx_uint_t                nslots;
+    ngx_uint_t                enabled;  //只在worker进程中开启
+#if (NGX_THREADS)
+    ngx_atomic_t              lock;     //线程池中的线程也可能分配内存(比如ssl握手)
+#endif
+} ngx_pool_cache_t;
+
+
+static ngx_pool_cache_slot_t *ngx_pool_cache_slot(size_t size);//查找尺寸对应的slot
+
+
+static ngx_pool_cache_t  ngx_pool_cache;
+
+
+/*
+ * 缓存只给主线程使用,其他线程拿不到锁时直接走malloc/free,
+ * 所以这里只用trylock,不会等待
+ */
+#if (NGX_THREADS)
+#define ngx_pool_cache_lock()    ngx_trylock(&ngx_pool_cache.lock)
+#define ngx_pool_cache_unlock()  ngx_unlock(&ngx_pool_cache.lock)
+#else
+#define ngx_pool_cache_lock()    1
+#define ngx_pool_cache_unlock()
+#endif
 
 //创建内存池
 ngx_pool_t * ngx_create_pool(size_t size, ngx_log_t *log)
 {
     ngx_pool_t  *p;
 
-    //分配内存
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    //分配内存,worker进程中优先从缓存中取
+    p = ngx_pool_cache_alloc(size, log);
     if (p == NULL) {
         return NULL;
     }
@@ -41,6 +110,12 @@ ngx_pool_t * ngx_create_pool(size_t size, ngx_log_t *log)
     p->cleanup = NULL;
     p->log = log;
 
+#if (NGX_PALLOC_PROFILE)
+    p->type = NGX_POOL_OTHER;
+    p->allocated = 0;
+    p->nlarge = 0;
+#endif
+
     return p;
 }
 
@@ -48,6 +123,7 @@ ngx_pool_t * ngx_create_pool(size_t size, ngx_log_t *log)
 void
 ngx_destroy_pool(ngx_pool_t *pool)
 {
+    size_t               size;
     ngx_pool_t          *p, *n;
     ngx_pool_large_t    *l;
     ngx_pool_cleanup_t  *c;
@@ -60,6 +136,10 @@ ngx_destroy_pool(ngx_pool_t *pool)
         }
     }
 
+#if (NGX_PALLOC_PROFILE)
+    ngx_pool_profile_destroy(pool);
+#endif
+
 #if (NGX_DEBUG)
 
     /*
@@ -84,12 +164,14 @@ ngx_destroy_pool(ngx_pool_t *pool)
     //释放大块内存
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
         }
     }
+    //所有的块大小都相同,必须在释放第一个块之前取得
+    size = (size_t) (pool->d.end - (u_char *) pool);
     //释放pool的内存
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        ngx_pool_cache_free(p, size);
 
         if (n == NULL) {
             break;
@@ -106,7 +188,7 @@ ngx_reset_pool(ngx_pool_t *pool)
     //释放大块的内存
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
         }
     }
     //重置pool的last指针和failed次数
@@ -124,6 +206,10 @@ ngx_reset_pool(ngx_pool_t *pool)
 void *
 ngx_palloc(ngx_pool_t *pool, size_t size)
 {
+#if (NGX_PALLOC_PROFILE)
+    pool->allocated += size;
+#endif
+
 #if !(NGX_DEBUG_PALLOC)
     if (size <= pool->max) {//如果size比pool的max小，则从pool中分配
         return ngx_palloc_small(pool, size, 1);
@@ -137,6 +223,10 @@ ngx_palloc(ngx_pool_t *pool, size_t size)
 void *
 ngx_pnalloc(ngx_pool_t *pool, size_t size)
 {
+#if (NGX_PALLOC_PROFILE)
+    pool->allocated += size;
+#endif
+
 #if !(NGX_DEBUG_PALLOC)
     if (size <= pool->max) {
         return ngx_palloc_small(pool, size, 0);
@@ -185,7 +275,7 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
     //获取之前内存池的大小
     psize = (size_t) (pool->d.end - (u_char *) pool);
     //分配内存
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    m = ngx_pool_cache_alloc(psize, pool->log);
     if (m == NULL) {
         return NULL;
     }
@@ -216,10 +306,24 @@ static void *
 ngx_palloc_large(ngx_pool_t *pool, size_t size)
 {
     void              *p;
+    size_t             csize;
     ngx_uint_t         n;
     ngx_pool_large_t  *large;
-    //其实就是直接调用malloc函数
-    p = ngx_alloc(size, pool->log);
+
+#if (NGX_PALLOC_PROFILE)
+    pool->nlarge++;
+#endif
+
+    //可以缓存的大小按2的幂取整后从缓存中取,否则直接调用malloc函数
+    csize = ngx_pool_cache_class(size);
+
+    if (csize) {
+        p = ngx_pool_cache_alloc(csize, pool->log);
+
+    } else {
+        p = ngx_alloc(size, pool->log);
+    }
+
     if (p == NULL) {
         return NULL;
     }
@@ -229,6 +333,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     for (large = pool->large; large; large = large->next) {
         if (large->alloc == NULL) {
             large->alloc = p;
+            large->size = csize;
             return p;
         }
         //最大查找三次
@@ -239,11 +344,12 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     //分配内存初始化large结构体
     large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
     if (large == NULL) {
-        ngx_free(p);
+        ngx_pool_cache_free(p, csize);
         return NULL;
     }
     //放在链表头
     large->alloc = p;
+    large->size = csize;
     large->next = pool->large;
     pool->large = large;
 
@@ -256,6 +362,12 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
 {
     void              *p;
     ngx_pool_large_t  *large;
+
+#if (NGX_PALLOC_PROFILE)
+    pool->allocated += size;
+    pool->nlarge++;
+#endif
+
     //内存对齐分配内存
     p = ngx_memalign(alignment, size, pool->log);
     if (p == NULL) {
@@ -269,6 +381,7 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
     }
     //初始化large,分配的内存指针保存在pool->large中，这里分配的内存有可能会释放，所以有上面查找large指针指向的数据为null的操作
     large->alloc = p;
+    large->size = 0;//对齐方式不确定,不放回缓存
     large->next = pool->large;
     pool->large = large;
     //返回分配的内存
@@ -285,7 +398,7 @@ ngx_pfree(ngx_pool_t *pool, void *p)
         if (p == l->alloc) {
             ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
                            "free: %p", l->alloc);
-            ngx_free(l->alloc); //释放内存
+            ngx_pool_cache_free(l->alloc, l->size); //释放内存
             l->alloc = NULL;    //large的数据指向null
 
             return NGX_OK;
@@ -403,30 +516,362 @@ ngx_pool_delete_file(void *data)
 }
 
 
-#if 0
 
-static void *
-ngx_get_cached_block(size_t size)
+//worker进程初始化时开启块缓存
+void
+ngx_pool_cache_init(ngx_cycle_t *cycle)
+{
+#if !(NGX_DEBUG_PALLOC)
+    //NGX_DEBUG_PALLOC时每次都调用malloc,方便valgrind等工具检查
+    ngx_pool_cache.enabled = 1;
+#endif
+}
+
+
+//在日志中输出缓存的统计信息
+void
+ngx_pool_cache_log(ngx_log_t *log)
 {
-    void                     *p;
-    ngx_cached_block_slot_t  *slot;
+    ngx_uint_t              i;
+    ngx_pool_cache_slot_t  *slot;
+
+    for (i = 0; i < ngx_pool_cache.nslots; i++) {
+        slot = &ngx_pool_cache.slots[i];
+
+        ngx_log_error(NGX_LOG_INFO, log, 0,
+                      "pool cache %uz: free:%ui hits:%ui misses:%ui "
+                      "trimmed:%ui",
+                      slot->size, slot->number, slot->hits, slot->misses,
+                      slot->trimmed);
+    }
+}
+
+
+//查找size对应的slot,没有就新建一个,slot用完时返回NULL
+static ngx_pool_cache_slot_t *
+ngx_pool_cache_slot(size_t size)
+{
+    ngx_uint_t              i;
+    ngx_pool_cache_slot_t  *slot;
+
+    slot = ngx_pool_cache.slots;
+
+    for (i = 0; i < ngx_pool_cache.nslots; i++) {
+        if (slot[i].size == size) {
+            return &slot[i];
+        }
+    }
 
-    if (ngx_cycle->cache == NULL) {
+    if (ngx_pool_cache.nslots == NGX_POOL_CACHE_SLOTS) {
         return NULL;
     }
 
-    slot = &ngx_cycle->cache[(size + ngx_pagesize - 1) / ngx_pagesize];
+    slot = &slot[ngx_pool_cache.nslots++];
+
+    slot->size = size;
+    slot->max = ngx_max(NGX_POOL_CACHE_SLOT_SIZE / size,
+                        NGX_POOL_CACHE_MIN_BLOCKS);
+
+    return slot;
+}
+
+
+static void *
+ngx_pool_cache_alloc(size_t size, ngx_log_t *log)
+{
+    ngx_pool_cached_block_t  *b;
+    ngx_pool_cache_slot_t    *slot;
+
+    if (ngx_pool_cache.enabled && ngx_pool_cache_lock()) {
+
+        slot = ngx_pool_cache_slot(size);
+
+        if (slot) {
+            b = slot->free;
+
+            if (b) {
+                slot->free = b->next;
+                slot->number--;
+                slot->hits++;
+
+                ngx_pool_cache_unlock();
+
+                ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0,
+                               "pool cache: %p:%uz", b, size);
+                return b;
+            }
+
+            slot->misses++;
+        }
+
+        ngx_pool_cache_unlock();
+    }
+
+    return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+}
+
+
+//size为0的块不是从缓存分配的,直接free
+static void
+ngx_pool_cache_free(void *p, size_t size)
+{
+    ngx_pool_cached_block_t  *b;
+    ngx_pool_cache_slot_t    *slot;
+
+    if (size && ngx_pool_cache.enabled && ngx_pool_cache_lock()) {
+
+        slot = ngx_pool_cache_slot(size);
+
+        if (slot) {
+            if (slot->number < slot->max) {
+                b = p;
+                b->next = slot->free;
+                slot->free = b;
+                slot->number++;
+
+                ngx_pool_cache_unlock();
+                return;
+            }
+
+            slot->trimmed++;
+        }
+
+        ngx_pool_cache_unlock();
+    }
+
+    ngx_free(p);
+}
+
+
+//大块内存按2的幂取整,不缓存时返回0
+static size_t
+ngx_pool_cache_class(size_t size)
+{
+    size_t  n;
+
+    if (!ngx_pool_cache.enabled || size > NGX_POOL_CACHE_MAX_LARGE) {
+        return 0;
+    }
+
+    for (n = ngx_pagesize; n < size; n <<= 1) { /* void */ }
+
+    return n;
+}
+
+
+#if (NGX_PALLOC_PROFILE)
+
+#define NGX_POOL_PROFILE_SITES  4096    //调用位置的哈希表大小,必须是2的幂
+
+
+typedef struct {
+    char                     *file;
+    ngx_uint_t                line;
+    ngx_uint_t                count;    //分配次数
+    ngx_uint_t                large;    //其中大块内存的次数
+    size_t                    bytes;    //分配的字节数
+} ngx_pool_profile_site_t;
+
+
+typedef struct {
+    ngx_uint_t                pools;    //已经销毁的pool个数
+    ngx_uint_t                blocks;   //额外分配的块数,说明pool的初始大小不够
+    ngx_uint_t                large;
+    size_t                    bytes;
+    size_t                    max;      //单个pool分配的最大字节数
+} ngx_pool_profile_type_t;
+
+
+static ngx_pool_profile_site_t  ngx_pool_profile_sites[NGX_POOL_PROFILE_SITES];
+static ngx_pool_profile_type_t  ngx_pool_profile_types[NGX_POOL_NTYPES];
+static ngx_uint_t               ngx_pool_profile_lost;
+#if (NGX_THREADS)
+static ngx_atomic_t             ngx_pool_profile_lock;
+#endif
+
+static char *ngx_pool_profile_names[] = {
+    "other", "cycle", "connection", "request", "upstream", "v2 stream"
+};
+
+
+//记录一次分配,哈希表满或者其他线程正在记录时丢弃
+static void
+ngx_pool_profile(ngx_pool_t *pool, size_t size, char *file, ngx_uint_t line)
+{
+    ngx_uint_t                i, n;
+    ngx_pool_profile_site_t  *site;
+
+#if (NGX_THREADS)
+    if (!ngx_trylock(&ngx_pool_profile_lock)) {
+        return;
+    }
+#endif
+
+    i = (((uintptr_t) file >> 3) ^ (line * 31)) & (NGX_POOL_PROFILE_SITES - 1);
+
+    for (n = 0; n < NGX_POOL_PROFILE_SITES; n++) {
+        site = &ngx_pool_profile_sites[i];
+
+        if (site->file == NULL) {
+            site->file = file;
+            site->line = line;
+            break;
+        }
+
+        if (site->file == file && site->line == line) {
+            break;
+        }
+
+        i = (i + 1) & (NGX_POOL_PROFILE_SITES - 1);
+    }
+
+    if (n == NGX_POOL_PROFILE_SITES) {
+        ngx_pool_profile_lost++;
+
+    } else {
+        site->count++;
+        site->bytes += size;
+
+        if (size > pool->max) {
+            site->large++;
+        }
+    }
+
+#if (NGX_THREADS)
+    ngx_unlock(&ngx_pool_profile_lock);
+#endif
+}
+
+
+static void
+ngx_pool_profile_destroy(ngx_pool_t *pool)
+{
+    ngx_pool_t               *p;
+    ngx_pool_profile_type_t  *type;
+
+    type = &ngx_pool_profile_types[pool->type];
+
+    type->pools++;
+    type->bytes += pool->allocated;
+    type->large += pool->nlarge;
+
+    if (pool->allocated > type->max) {
+        type->max = pool->allocated;
+    }
+
+    for (p = pool->d.next; p; p = p->d.next) {
+        type->blocks++;
+    }
+}
+
+
+void *
+ngx_palloc_profile(ngx_pool_t *pool, size_t size, char *file, ngx_uint_t line)
+{
+    ngx_pool_profile(pool, size, file, line);
+
+    return ngx_palloc(pool, size);
+}
+
+
+void *
+ngx_pnalloc_profile(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line)
+{
+    ngx_pool_profile(pool, size, file, line);
+
+    return ngx_pnalloc(pool, size);
+}
+
+
+void *
+ngx_pcalloc_profile(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line)
+{
+    ngx_pool_profile(pool, size, file, line);
+
+    return ngx_pcalloc(pool, size);
+}
+
+
+void *
+ngx_pmemalign_profile(ngx_pool_t *pool, size_t size, size_t alignment,
+    char *file, ngx_uint_t line)
+{
+    ngx_pool_profile(pool, size, file, line);
+
+    return ngx_pmemalign(pool, size, alignment);
+}
+
 
-    slot->tries++;
+//按字节数从大到小排序
+static int ngx_libc_cdecl
+ngx_pool_profile_cmp(const void *one, const void *two)
+{
+    ngx_pool_profile_site_t  *first, *second;
+
+    first = *(ngx_pool_profile_site_t **) one;
+    second = *(ngx_pool_profile_site_t **) two;
+
+    if (first->bytes == second->bytes) {
+        return 0;
+    }
+
+    return (first->bytes < second->bytes) ? 1 : -1;
+}
+
+
+void
+ngx_pool_profile_log(ngx_log_t *log)
+{
+    ngx_uint_t                 i, n;
+    ngx_pool_profile_type_t   *type;
+    ngx_pool_profile_site_t  **sites;
+
+    for (i = 0; i < NGX_POOL_NTYPES; i++) {
+        type = &ngx_pool_profile_types[i];
+
+        if (type->pools == 0) {
+            continue;
+        }
+
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "pool profile %s: pools:%ui avg:%uz max:%uz "
+                      "blocks:%ui large:%ui",
+                      ngx_pool_profile_names[i], type->pools,
+                      type->bytes / type->pools, type->max,
+                      type->blocks, type->large);
+    }
+
+    sites = ngx_alloc(NGX_POOL_PROFILE_SITES * sizeof(void *), log);
+    if (sites == NULL) {
+        return;
+    }
+
+    n = 0;
+
+    for (i = 0; i < NGX_POOL_PROFILE_SITES; i++) {
+        if (ngx_pool_profile_sites[i].file) {
+            sites[n++] = &ngx_pool_profile_sites[i];
+        }
+    }
+
+    ngx_qsort(sites, n, sizeof(void *), ngx_pool_profile_cmp);
+
+    for (i = 0; i < n; i++) {
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "pool profile %s:%ui count:%ui bytes:%uz large:%ui",
+                      sites[i]->file, sites[i]->line, sites[i]->count,
+                      sites[i]->bytes, sites[i]->large);
+    }
 
-    if (slot->number) {
-        p = slot->block;
-        slot->block = slot->block->next;
-        slot->number--;
-        return p;
+    if (ngx_pool_profile_lost) {
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "pool profile: %ui allocations not recorded",
+                      ngx_pool_profile_lost);
     }
 
-    return NULL;
+    ngx_free(sites);
 }
 
 #endif
@@ -43,6 +43,7 @@ typedef struct ngx_pool_large_s  ngx_pool_large_t;
 struct ngx_pool_large_s {
     ngx_pool_large_t     *next;     //指向下个结构体
     void                 *alloc;    //分配的内存
+    size_t                size;     //缓存的尺寸等级,0表示不是从缓存中分配的
 };
 
 
@@ -54,6 +55,16 @@ typedef struct {
 } ngx_pool_data_t;
 
 
+//pool的类型,只用于统计
+#define NGX_POOL_OTHER           0
+#define NGX_POOL_CYCLE           1
+#define NGX_POOL_CONNECTION      2
+#define NGX_POOL_REQUEST         3
+#define NGX_POOL_UPSTREAM        4
+#define NGX_POOL_V2_STREAM       5
+#define NGX_POOL_NTYPES          6
+
+
 struct ngx_pool_s {
     ngx_pool_data_t       d;        //内存节点的相关数据
     size_t                max;      //最大内存
@@ -62,6 +73,11 @@ struct ngx_pool_s {
     ngx_pool_large_t     *large;    //pool_large指针
     ngx_pool_cleanup_t   *cleanup;  //清理资源
     ngx_log_t            *log;      //日志
+#if (NGX_PALLOC_PROFILE)
+    ngx_uint_t            type;     //pool的类型
+    size_t                allocated;//一共分配的字节数
+    ngx_uint_t            nlarge;   //大块内存的分配次数
+#endif
 };
 
 
@@ -91,5 +107,43 @@ void ngx_pool_run_cleanup_file(ngx_pool_t *p, ngx_fd_t fd);//执行清理文件
 void ngx_pool_cleanup_file(void *data);//清理文件资源
 void ngx_pool_delete_file(void *data);//删除文件
 
+void ngx_pool_cache_init(ngx_cycle_t *cycle);//开启worker进程的块缓存
+void ngx_pool_cache_log(ngx_log_t *log);//输出块缓存的统计
+
+
+#if (NGX_PALLOC_PROFILE)
+
+/*
+ * --with-palloc-profile: 用宏把调用位置(文件:行号)传给分配函数,
+ * 按调用位置和pool类型统计分配的次数和字节数,收到USR1信号时输出到日志
+ */
+
+void *ngx_palloc_profile(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line);
+void *ngx_pnalloc_profile(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line);
+void *ngx_pcalloc_profile(ngx_pool_t *pool, size_t size, char *file,
+    ngx_uint_t line);
+void *ngx_pmemalign_profile(ngx_pool_t *pool, size_t size, size_t alignment,
+    char *file, ngx_uint_t line);
+void ngx_pool_profile_log(ngx_log_t *log);//输出统计
+
+#define ngx_palloc(pool, size)                                                \
+    ngx_palloc_profile(pool, size, __FILE__, __LINE__)
+#define ngx_pnalloc(pool, size)                                               \
+    ngx_pnalloc_profile(pool, size, __FILE__, __LINE__)
+#define ngx_pcalloc(pool, size)                                               \
+    ngx_pcalloc_profile(pool, size, __FILE__, __LINE__)
+#define ngx_pmemalign(pool, size, alignment)                                  \
+    ngx_pmemalign_profile(pool, size, alignment, __FILE__, __LINE__)
+
+#define ngx_pool_set_type(pool, t)  (pool)->type = t
+
+#else
+
+#define ngx_pool_set_type(pool, t)
+
+#endif
+
 
 #endif /* _NGX_PALLOC_H_INCLUDED_ */
@@ -0,0 +1,508 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define ngx_prefix_bit(key, n)  (((key)[(n) >> 5] >> (31 - ((n) & 31))) & 1)
+
+
+static uintptr_t ngx_prefix_tree_find(ngx_prefix_tree_t *tree, uint32_t *key);
+static ngx_int_t ngx_prefix_tree_insert(ngx_prefix_tree_t *tree,
+    uint32_t *key, ngx_uint_t len, uintptr_t value);
+static ngx_int_t ngx_prefix_tree_delete(ngx_prefix_tree_t *tree,
+    uint32_t *key, ngx_uint_t len);
+static ngx_prefix_node_t **ngx_prefix_tree_link(ngx_prefix_tree_t *tree,
+    uint32_t *key, ngx_uint_t len, ngx_uint_t create);
+static ngx_uint_t ngx_prefix_common(uint32_t *a, uint32_t *b, ngx_uint_t len);
+static ngx_int_t ngx_prefix_tree_walk_node(ngx_prefix_node_t *node,
+    ngx_prefix_walk_pt handler, void *data);
+static ngx_uint_t ngx_prefix_mask_len(uint32_t *mask, ngx_uint_t words);
+static ngx_prefix_node_t *ngx_prefix_alloc(ngx_prefix_tree_t *tree,
+    uint32_t *key, ngx_uint_t len, uintptr_t value);
+static void ngx_prefix_free(ngx_prefix_tree_t *tree, ngx_prefix_node_t *node);
+
+
+ngx_prefix_tree_t *
+ngx_prefix_tree_create(ngx_pool_t *pool, ngx_uint_t bits)
+{
+    ngx_prefix_tree_t  *tree;
+
+    tree = ngx_palloc(pool, sizeof(ngx_prefix_tree_t));
+    if (tree == NULL) {
+        return NULL;
+    }
+
+    tree->slots = NULL;
+    tree->root = NULL;
+    tree->bits = bits;
+
+    /*
+     * IPv6 prefixes in use are /16 and longer, so the first 16 bits are
+     * resolved by an index; the index is allocated on the first such prefix
+     */
+
+    tree->stride = (bits == 32) ? 8 : 16;
+
+    tree->node_size = ngx_align(offsetof(ngx_prefix_node_t, key)
+                                + bits / 8, sizeof(void *));
+    tree->pool = pool;
+    tree->free = NULL;
+    tree->start = NULL;
+    tree->size = 0;
+
+    return tree;
+}
+
+
+ngx_int_t
+ngx_prefix32tree_insert(ngx_prefix_tree_t *tree, uint32_t key, uint32_t mask,
+    uintptr_t value)
+{
+    return ngx_prefix_tree_insert(tree, &key, ngx_prefix_mask_len(&mask, 1),
+                                  value);
+}
+
+
+ngx_int_t
+ngx_prefix32tree_delete(ngx_prefix_tree_t *tree, uint32_t key, uint32_t mask)
+{
+    return ngx_prefix_tree_delete(tree, &key, ngx_prefix_mask_len(&mask, 1));
+}
+
+
+uintptr_t
+ngx_prefix32tree_find(ngx_prefix_tree_t *tree, uint32_t key)
+{
+    return ngx_prefix_tree_find(tree, &key);
+}
+
+
+#if (NGX_HAVE_INET6)
+
+static void
+ngx_prefix128_words(uint32_t *w, u_char *p)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < 4; i++) {
+        w[i] = (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+        p += 4;
+    }
+}
+
+
+ngx_int_t
+ngx_prefix128tree_insert(ngx_prefix_tree_t *tree, u_char *key, u_char *mask,
+    uintptr_t value)
+{
+    uint32_t  k[4], m[4];
+
+    ngx_prefix128_words(k, key);
+    ngx_prefix128_words(m, mask);
+
+    return ngx_prefix_tree_insert(tree, k, ngx_prefix_mask_len(m, 4), value);
+}
+
+
+ngx_int_t
+ngx_prefix128tree_delete(ngx_prefix_tree_t *tree, u_char *key, u_char *mask)
+{
+    uint32_t  k[4], m[4];
+
+    ngx_prefix128_words(k, key);
+    ngx_prefix128_words(m, mask);
+
+    return ngx_prefix_tree_delete(tree, k, ngx_prefix_mask_len(m, 4));
+}
+
+
+uintptr_t
+ngx_prefix128tree_find(ngx_prefix_tree_t *tree, u_char *key)
+{
+    uint32_t  k[4];
+
+    ngx_prefix128_words(k, key);
+
+    return ngx_prefix_tree_find(tree, k);
+}
+
+#endif
+
+
+ngx_int_t
+ngx_prefix_tree_walk(ngx_prefix_tree_t *tree, ngx_prefix_walk_pt handler,
+    void *data)
+{
+    ngx_uint_t  i;
+
+    if (ngx_prefix_tree_walk_node(tree->root, handler, data) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (tree->slots == NULL) {
+        return NGX_OK;
+    }
+
+    for (i = 0; i < ((ngx_uint_t) 1 << tree->stride); i++) {
+        if (ngx_prefix_tree_walk_node(tree->slots[i], handler, data)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_prefix_tree_walk_node(ngx_prefix_node_t *node, ngx_prefix_walk_pt handler,
+    void *data)
+{
+    if (node == NULL) {
+        return NGX_OK;
+    }
+
+    if (node->value != NGX_RADIX_NO_VALUE) {
+        if (handler(data, node->key, node->len, node->value) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (ngx_prefix_tree_walk_node(node->child[0], handler, data) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_prefix_tree_walk_node(node->child[1], handler, data);
+}
+
+
+static ngx_inline ngx_uint_t
+ngx_prefix_match(uint32_t *key, ngx_prefix_node_t *node)
+{
+    ngx_uint_t  i, len;
+
+    len = node->len;
+
+    for (i = 0; len >= 32; i++, len -= 32) {
+        if (key[i] != node->key[i]) {
+            return 0;
+        }
+    }
+
+    return len == 0 || ((key[i] ^ node->key[i]) >> (32 - len)) == 0;
+}
+
+
+static ngx_inline uintptr_t
+ngx_prefix_lookup(ngx_prefix_tree_t *tree, ngx_prefix_node_t *node,
+    uint32_t *key)
+{
+    uintptr_t  value;
+
+    value = NGX_RADIX_NO_VALUE;
+
+    while (node && ngx_prefix_match(key, node)) {
+
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            value = node->value;
+        }
+
+        if (node->len == tree->bits) {
+            break;
+        }
+
+        node = node->child[ngx_prefix_bit(key, node->len)];
+    }
+
+    return value;
+}
+
+
+static uintptr_t
+ngx_prefix_tree_find(ngx_prefix_tree_t *tree, uint32_t *key)
+{
+    uintptr_t  value;
+
+    /* any prefix in the index is longer than ones in the root */
+
+    if (tree->slots) {
+        value = ngx_prefix_lookup(tree,
+                                  tree->slots[key[0] >> (32 - tree->stride)],
+                                  key);
+
+        if (value != NGX_RADIX_NO_VALUE) {
+            return value;
+        }
+    }
+
+    return ngx_prefix_lookup(tree, tree->root, key);
+}
+
+
+static ngx_int_t
+ngx_prefix_tree_insert(ngx_prefix_tree_t *tree, uint32_t *key,
+    ngx_uint_t len, uintptr_t value)
+{
+    ngx_uint_t           n;
+    ngx_prefix_node_t  **link, *node, *new, *fork;
+
+    link = ngx_prefix_tree_link(tree, key, len, 1);
+    if (link == NULL) {
+        return NGX_ERROR;
+    }
+
+    for ( ;; ) {
+        node = *link;
+
+        if (node == NULL) {
+            new = ngx_prefix_alloc(tree, key, len, value);
+            if (new == NULL) {
+                return NGX_ERROR;
+            }
+
+            *link = new;
+            return NGX_OK;
+        }
+
+        n = ngx_prefix_common(key, node->key, ngx_min(len, node->len));
+
+        if (n == node->len) {
+
+            if (n == len) {
+                if (node->value != NGX_RADIX_NO_VALUE) {
+                    return NGX_BUSY;
+                }
+
+                node->value = value;
+                return NGX_OK;
+            }
+
+            link = &node->child[ngx_prefix_bit(key, n)];
+            continue;
+        }
+
+        /* the node's path is split at the bit n */
+
+        new = ngx_prefix_alloc(tree, key, len, value);
+        if (new == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (n == len) {
+            new->child[ngx_prefix_bit(node->key, n)] = node;
+            *link = new;
+            return NGX_OK;
+        }
+
+        fork = ngx_prefix_alloc(tree, key, n, NGX_RADIX_NO_VALUE);
+        if (fork == NULL) {
+            return NGX_ERROR;
+        }
+
+        fork->child[ngx_prefix_bit(key, n)] = new;
+        fork->child[ngx_prefix_bit(node->key, n)] = node;
+        *link = fork;
+
+        return NGX_OK;
+    }
+}
+
+
+static ngx_int_t
+ngx_prefix_tree_delete(ngx_prefix_tree_t *tree, uint32_t *key,
+    ngx_uint_t len)
+{
+    ngx_prefix_node_t  **link, **parent, *node, *fork;
+
+    link = ngx_prefix_tree_link(tree, key, len, 0);
+    if (link == NULL) {
+        return NGX_ERROR;
+    }
+
+    parent = NULL;
+
+    for ( ;; ) {
+        node = *link;
+
+        if (node == NULL
+            || node->len > len
+            || ngx_prefix_common(key, node->key, node->len) != node->len)
+        {
+            return NGX_ERROR;
+        }
+
+        if (node->len == len) {
+            break;
+        }
+
+        parent = link;
+        link = &node->child[ngx_prefix_bit(key, node->len)];
+    }
+
+    if (node->value == NGX_RADIX_NO_VALUE) {
+        return NGX_ERROR;
+    }
+
+    node->value = NGX_RADIX_NO_VALUE;
+
+    if (node->child[0] && node->child[1]) {
+        return NGX_OK;
+    }
+
+    *link = node->child[0] ? node->child[0] : node->child[1];
+    ngx_prefix_free(tree, node);
+
+    if (*link || parent == NULL) {
+        return NGX_OK;
+    }
+
+    /* a fork node without a value is left with the only child */
+
+    fork = *parent;
+
+    if (fork->value == NGX_RADIX_NO_VALUE) {
+        *parent = fork->child[0] ? fork->child[0] : fork->child[1];
+        ngx_prefix_free(tree, fork);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_prefix_node_t **
+ngx_prefix_tree_link(ngx_prefix_tree_t *tree, uint32_t *key, ngx_uint_t len,
+    ngx_uint_t create)
+{
+    if (len < tree->stride) {
+        return &tree->root;
+    }
+
+    if (tree->slots == NULL) {
+        if (!create) {
+            return NULL;
+        }
+
+        tree->slots = ngx_pcalloc(tree->pool,
+                                  sizeof(ngx_prefix_node_t *) << tree->stride);
+        if (tree->slots == NULL) {
+            return NULL;
+        }
+    }
+
+    return &tree->slots[key[0] >> (32 - tree->stride)];
+}
+
+
+static ngx_uint_t
+ngx_prefix_common(uint32_t *a, uint32_t *b, ngx_uint_t len)
+{
+    uint32_t    x;
+    ngx_uint_t  i, n;
+
+    for (i = 0, n = 0; n < len; i++, n += 32) {
+        x = a[i] ^ b[i];
+
+        if (x == 0) {
+            continue;
+        }
+
+        while ((x & 0x80000000) == 0) {
+            x <<= 1;
+            n++;
+        }
+
+        return ngx_min(n, len);
+    }
+
+    return len;
+}
+
+
+static ngx_uint_t
+ngx_prefix_mask_len(uint32_t *mask, ngx_uint_t words)
+{
+    uint32_t    m;
+    ngx_uint_t  i, len;
+
+    len = 0;
+
+    for (i = 0; i < words; i++) {
+        m = mask[i];
+
+        while (m & 0x80000000) {
+            m <<= 1;
+            len++;
+        }
+
+        if (len < (i + 1) * 32) {
+            break;
+        }
+    }
+
+    return len;
+}
+
+
+static ngx_prefix_node_t *
+ngx_prefix_alloc(ngx_prefix_tree_t *tree, uint32_t *key, ngx_uint_t len,
+    uintptr_t value)
+{
+    ngx_uint_t          i, n;
+    ngx_prefix_node_t  *node;
+    //有空闲的节点直接使用
+    if (tree->free) {
+        node = tree->free;
+        tree->free = node->child[0];
+
+    } else {
+        //节点从整页中连续分配
+        if (tree->size < tree->node_size) {
+            tree->start = ngx_pmemalign(tree->pool, ngx_pagesize,
+                                        ngx_pagesize);
+            if (tree->start == NULL) {
+                return NULL;
+            }
+
+            tree->size = ngx_pagesize;
+        }
+
+        node = (ngx_prefix_node_t *) tree->start;
+        tree->start += tree->node_size;
+        tree->size -= tree->node_size;
+    }
+
+    node->child[0] = NULL;
+    node->child[1] = NULL;
+    node->value = value;
+    node->len = (uint32_t) len;
+
+    /* the bits after the prefix are kept zero */
+
+    for (i = 0, n = len; i < tree->bits / 32; i++) {
+        if (n >= 32) {
+            node->key[i] = key[i];
+            n -= 32;
+
+        } else {
+            node->key[i] = n ? key[i] & (0xffffffff << (32 - n)) : 0;
+            n = 0;
+        }
+    }
+
+    return node;
+}
+
+
+static void
+ngx_prefix_free(ngx_prefix_tree_t *tree, ngx_prefix_node_t *node)
+{
+    node->child[0] = tree->free;
+    tree->free = node;
+}
@@ -0,0 +1,68 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_PREFIX_TREE_H_INCLUDED_
+#define _NGX_PREFIX_TREE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * 压缩路径的前缀树: 节点只出现在前缀或分叉处, 根部按 stride 位直接索引,
+ * 与 ngx_radix_tree_t 接口一致, 没有值时返回 NGX_RADIX_NO_VALUE
+ */
+
+typedef struct ngx_prefix_node_s  ngx_prefix_node_t;
+
+struct ngx_prefix_node_s {
+    ngx_prefix_node_t  *child[2];//子节点, 按前缀之后的一位选择
+    uintptr_t           value;//值
+    uint32_t            len;//前缀长度
+    uint32_t            key[1];//前缀, 32位树一个字, 128位树四个字
+};
+
+
+typedef ngx_int_t (*ngx_prefix_walk_pt)(void *data, uint32_t *key,
+    ngx_uint_t len, uintptr_t value);
+
+
+typedef struct {
+    ngx_prefix_node_t **slots;//长度不小于stride的前缀, 按高位索引
+    ngx_prefix_node_t  *root;//长度小于stride的前缀
+    ngx_uint_t          bits;//32或128
+    ngx_uint_t          stride;
+    size_t              node_size;
+    ngx_pool_t         *pool;//内存池
+    ngx_prefix_node_t  *free;//空闲节点
+    char               *start;
+    size_t              size;
+} ngx_prefix_tree_t;
+
+//创建, bits为32或128
+ngx_prefix_tree_t *ngx_prefix_tree_create(ngx_pool_t *pool, ngx_uint_t bits);
+//遍历所有有值的节点, 不保证顺序
+ngx_int_t ngx_prefix_tree_walk(ngx_prefix_tree_t *tree,
+    ngx_prefix_walk_pt handler, void *data);
+
+ngx_int_t ngx_prefix32tree_insert(ngx_prefix_tree_t *tree,
+    uint32_t key, uint32_t mask, uintptr_t value);
+ngx_int_t ngx_prefix32tree_delete(ngx_prefix_tree_t *tree,
+    uint32_t key, uint32_t mask);
+uintptr_t ngx_prefix32tree_find(ngx_prefix_tree_t *tree, uint32_t key);
+
+#if (NGX_HAVE_INET6)
+ngx_int_t ngx_prefix128tree_insert(ngx_prefix_tree_t *tree,
+    u_char *key, u_char *mask, uintptr_t value);
+ngx_int_t ngx_prefix128tree_delete(ngx_prefix_tree_t *tree,
+    u_char *key, u_char *mask);
+uintptr_t ngx_prefix128tree_find(ngx_prefix_tree_t *tree, u_char *key);
+#endif
+
+
+#endif /* _NGX_PREFIX_TREE_H_INCLUDED_ */
@@ -14,6 +14,7 @@ typedef struct {
 } ngx_regex_conf_t;
 
 
+static void ngx_regex_required(ngx_regex_t *re);
 static void * ngx_libc_cdecl ngx_regex_malloc(size_t size);
 static void ngx_libc_cdecl ngx_regex_free(void *p);
 #if (NGX_HAVE_PCRE_JIT)
@@ -131,6 +132,8 @@ ngx_regex_compile(ngx_regex_compile_t *rc)
 
     rc->regex->code = re;
 
+    ngx_regex_required(rc->regex);
+
     /* do not study at runtime */
 
     if (ngx_pcre_studies != NULL) {
@@ -196,14 +199,21 @@ nomem:
 ngx_int_t
 ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 {
-    ngx_int_t         n;
-    ngx_uint_t        i;
-    ngx_regex_elt_t  *re;
+    ngx_int_t           n;
+    ngx_uint_t          i;
+    ngx_regex_elt_t    *re;
+    ngx_regex_filter_t  filter;
 
     re = a->elts;
 
+    filter.tried = 0;
+
     for (i = 0; i < a->nelts; i++) {
 
+        if (!ngx_regex_filter(&filter, re[i].regex, s)) {
+            continue;
+        }
+
         n = ngx_regex_exec(re[i].regex, s, NULL, 0);
 
         if (n == NGX_REGEX_NO_MATCHED) {
@@ -226,6 +236,62 @@ ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 }
 
 
+void
+ngx_regex_filter_init(ngx_regex_filter_t *f, ngx_str_t *s)
+{
+    u_char    *p, *last;
+    uint64_t   bit, hi, bits0, bits1;
+
+    bits0 = 0;
+    bits1 = 0;
+
+    last = s->data + s->len;
+
+    /* bytes above 0x7f set extra bits, this only lets more regexes through */
+
+    for (p = s->data; p < last; p++) {
+        bit = (uint64_t) 1 << (*p & 63);
+        hi = 0 - (uint64_t) ((*p >> 6) & 1);
+
+        bits0 |= bit & ~hi;
+        bits1 |= bit & hi;
+    }
+
+    f->bits[0] = bits0;
+    f->bits[1] = bits1;
+}
+
+
+static void
+ngx_regex_required(ngx_regex_t *re)
+{
+    int  c, n, first;
+
+    n = pcre_fullinfo(re->code, NULL, PCRE_INFO_FIRSTBYTE, &first);
+    if (n < 0) {
+        first = -1;
+    }
+
+    n = pcre_fullinfo(re->code, NULL, PCRE_INFO_LASTLITERAL, &c);
+    if (n < 0) {
+        c = -1;
+    }
+
+    /*
+     * only ASCII bytes are used: the pattern may be caseless or UTF-8,
+     * and letters are then compared caselessly by ngx_regex_filter()
+     */
+
+    if (first >= 0 && first < 0x80) {
+        re->required[re->nrequired++] = (u_char) ngx_tolower(first);
+    }
+
+    if (c >= 0 && c < 0x80 && c != first) {
+        re->required[re->nrequired++] = (u_char) ngx_tolower(c);
+    }
+}
+
+
 static void * ngx_libc_cdecl ngx_regex_malloc(size_t size)
 {
     ngx_pool_t      *pool;
@@ -23,6 +23,10 @@
 typedef struct {
     pcre        *code;
     pcre_extra  *extra;
+
+    /* ASCII bytes that must be present in a matching subject */
+    ngx_uint_t   nrequired;
+    u_char       required[2];
 } ngx_regex_t;
 
 
@@ -49,11 +53,70 @@ typedef struct {
 void ngx_regex_init(void);
 ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
-#define ngx_regex_exec(re, s, captures, size)                                \
-    pcre_exec(re->code, re->extra, (const char *) (s)->data, (s)->len, 0, 0, \
-              captures, size)
+/*
+ * a byte set of the subject, built once when a list of regexes is tried:
+ * a regex whose first or required byte is not in the subject is skipped
+ */
+
+typedef struct {
+    uint64_t     bits[2];
+    ngx_uint_t   tried;
+} ngx_regex_filter_t;
+
+
+static ngx_inline ngx_int_t
+ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s, int *captures, ngx_uint_t size)
+{
+    return pcre_exec(re->code, re->extra, (const char *) s->data, s->len, 0, 0,
+                     captures, size);
+}
+
 #define ngx_regex_exec_n      "pcre_exec()"
 
+
+void ngx_regex_filter_init(ngx_regex_filter_t *f, ngx_str_t *s);
+
+
+static ngx_inline ngx_uint_t
+ngx_regex_filter(ngx_regex_filter_t *f, ngx_regex_t *re, ngx_str_t *s)
+{
+    u_char      c;
+    uint64_t    bit;
+    ngx_uint_t  i;
+
+    /*
+     * the first regex is tried as is, the set is not built
+     * if the subject matches it
+     */
+
+    if (f->tried++ == 0) {
+        return 1;
+    }
+
+    if (f->tried == 2) {
+        ngx_regex_filter_init(f, s);
+    }
+
+    for (i = 0; i < re->nrequired; i++) {
+        c = re->required[i];
+        bit = (uint64_t) 1 << (c & 63);
+
+        if (c >= 'a' && c <= 'z') {
+
+            /* letters are compared caselessly */
+
+            if ((f->bits[1] & (bit | (bit >> 32))) == 0) {
+                return 0;
+            }
+
+        } else if ((f->bits[c >> 6] & bit) == 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
 ngx_int_t ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log);
 
 
@@ -60,6 +60,8 @@ static ngx_slab_page_t *ngx_slab_alloc_pages(ngx_slab_pool_t *pool,
     ngx_uint_t pages);
 static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
     ngx_uint_t pages);
+static void ngx_slab_free_insert(ngx_slab_pool_t *pool, ngx_slab_page_t *page);
+static ngx_uint_t ngx_slab_free_list(ngx_uint_t pages);
 static void ngx_slab_error(ngx_slab_pool_t *pool, ngx_uint_t level,
     char *text);
 
@@ -106,18 +108,24 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 
     p += n * sizeof(ngx_slab_page_t);
 
+    pool->stats = (ngx_slab_stat_t *) p;
+    ngx_memzero(pool->stats, n * sizeof(ngx_slab_stat_t));
+
+    p += n * sizeof(ngx_slab_stat_t);
+
+    size -= n * (sizeof(ngx_slab_page_t) + sizeof(ngx_slab_stat_t));
+
     pages = (ngx_uint_t) (size / (ngx_pagesize + sizeof(ngx_slab_page_t)));
 
     ngx_memzero(p, pages * sizeof(ngx_slab_page_t));
 
     pool->pages = (ngx_slab_page_t *) p;
 
-    pool->free.prev = 0;
-    pool->free.next = (ngx_slab_page_t *) p;
-
-    pool->pages->slab = pages;
-    pool->pages->next = &pool->free;
-    pool->pages->prev = (uintptr_t) &pool->free;
+    for (i = 0; i < NGX_SLAB_FREE_LISTS; i++) {
+        pool->free[i].slab = 0;
+        pool->free[i].next = &pool->free[i];
+        pool->free[i].prev = 0;
+    }
 
     pool->start = (u_char *)
                   ngx_align_ptr((uintptr_t) p + pages * sizeof(ngx_slab_page_t),
@@ -126,10 +134,14 @@ ngx_slab_init(ngx_slab_pool_t *pool)
     m = pages - (pool->end - pool->start) / ngx_pagesize;
     if (m > 0) {
         pages -= m;
-        pool->pages->slab = pages;
     }
 
+    pool->pages->slab = pages;
     pool->last = pool->pages + pages;
+    pool->pfree = pages;
+    pool->pfails = 0;
+
+    ngx_slab_free_insert(pool, pool->pages);
 
     pool->log_nomem = 1;
     pool->log_ctx = &pool->zero;
@@ -173,6 +185,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
         } else {
             p = 0;
+            pool->pfails++;
         }
 
         goto done;
@@ -192,6 +205,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
     ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
                    "slab alloc: %uz slot: %ui", size, slot);
 
+    pool->stats[slot].reqs++;
+
     slots = (ngx_slab_page_t *) ((u_char *) pool + sizeof(ngx_slab_pool_t));
     page = slots[slot].next;
 
@@ -225,6 +240,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                                     if (bitmap[n] != NGX_SLAB_BUSY) {
                                         p = (uintptr_t) bitmap + i;
 
+                                        pool->stats[slot].used++;
+
                                         goto done;
                                     }
                                 }
@@ -240,6 +257,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
                             p = (uintptr_t) bitmap + i;
 
+                            pool->stats[slot].used++;
+
                             goto done;
                         }
                     }
@@ -275,6 +294,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                         p += i << shift;
                         p += (uintptr_t) pool->start;
 
+                        pool->stats[slot].used++;
+
                         goto done;
                     }
                 }
@@ -317,6 +338,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                         p += i << shift;
                         p += (uintptr_t) pool->start;
 
+                        pool->stats[slot].used++;
+
                         goto done;
                     }
                 }
@@ -355,9 +378,13 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
             slots[slot].next = page;
 
+            pool->stats[slot].total += (ngx_pagesize >> shift) - n;
+
             p = ((page - pool->pages) << ngx_pagesize_shift) + s * n;
             p += (uintptr_t) pool->start;
 
+            pool->stats[slot].used++;
+
             goto done;
 
         } else if (shift == ngx_slab_exact_shift) {
@@ -368,9 +395,13 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
             slots[slot].next = page;
 
+            pool->stats[slot].total += 8 * sizeof(uintptr_t);
+
             p = (page - pool->pages) << ngx_pagesize_shift;
             p += (uintptr_t) pool->start;
 
+            pool->stats[slot].used++;
+
             goto done;
 
         } else { /* shift > ngx_slab_exact_shift */
@@ -381,15 +412,21 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
             slots[slot].next = page;
 
+            pool->stats[slot].total += ngx_pagesize >> shift;
+
             p = (page - pool->pages) << ngx_pagesize_shift;
             p += (uintptr_t) pool->start;
 
+            pool->stats[slot].used++;
+
             goto done;
         }
     }
 
     p = 0;
 
+    pool->stats[slot].fails++;
+
 done:
 
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
@@ -444,7 +481,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 {
     size_t            size;
     uintptr_t         slab, m, *bitmap;
-    ngx_uint_t        n, type, slot, shift, map;
+    ngx_uint_t        i, n, type, slot, shift, map;
     ngx_slab_page_t  *slots, *page;
 
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0, "slab free: %p", p);
@@ -465,6 +502,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
         shift = slab & NGX_SLAB_SHIFT_MASK;
         size = 1 << shift;
+        slot = shift - pool->min_shift;
 
         if ((uintptr_t) p & (size - 1)) {
             goto wrong_chunk;
@@ -481,7 +519,6 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             if (page->next == NULL) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -492,6 +529,8 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             bitmap[n] &= ~m;
 
+            pool->stats[slot].used--;
+
             n = (1 << (ngx_pagesize_shift - shift)) / 8 / (1 << shift);
 
             if (n == 0) {
@@ -504,14 +543,16 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             map = (1 << (ngx_pagesize_shift - shift)) / (sizeof(uintptr_t) * 8);
 
-            for (n = 1; n < map; n++) {
-                if (bitmap[n]) {
+            for (i = 1; i < map; i++) {
+                if (bitmap[i]) {
                     goto done;
                 }
             }
 
             ngx_slab_free_pages(pool, page, 1);
 
+            pool->stats[slot].total -= (ngx_pagesize >> shift) - n;
+
             goto done;
         }
 
@@ -522,6 +563,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
         m = (uintptr_t) 1 <<
                 (((uintptr_t) p & (ngx_pagesize - 1)) >> ngx_slab_exact_shift);
         size = ngx_slab_exact_size;
+        slot = ngx_slab_exact_shift - pool->min_shift;
 
         if ((uintptr_t) p & (size - 1)) {
             goto wrong_chunk;
@@ -531,7 +573,6 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             if (slab == NGX_SLAB_BUSY) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = ngx_slab_exact_shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -542,12 +583,16 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             page->slab &= ~m;
 
+            pool->stats[slot].used--;
+
             if (page->slab) {
                 goto done;
             }
 
             ngx_slab_free_pages(pool, page, 1);
 
+            pool->stats[slot].total -= 8 * sizeof(uintptr_t);
+
             goto done;
         }
 
@@ -557,6 +602,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
         shift = slab & NGX_SLAB_SHIFT_MASK;
         size = 1 << shift;
+        slot = shift - pool->min_shift;
 
         if ((uintptr_t) p & (size - 1)) {
             goto wrong_chunk;
@@ -570,7 +616,6 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             if (page->next == NULL) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -581,12 +626,16 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             page->slab &= ~m;
 
+            pool->stats[slot].used--;
+
             if (page->slab & NGX_SLAB_MAP_MASK) {
                 goto done;
             }
 
             ngx_slab_free_pages(pool, page, 1);
 
+            pool->stats[slot].total -= ngx_pagesize >> shift;
+
             goto done;
         }
 
@@ -651,29 +700,37 @@ fail:
 static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
-    ngx_slab_page_t  *page, *p;
+    ngx_uint_t        i;
+    ngx_slab_page_t  *page, *p, *free;
+
+    /*
+     * only the first list may have runs shorter than requested,
+     * any run in the following lists is long enough
+     */
 
-    for (page = pool->free.next; page != &pool->free; page = page->next) {
+    for (i = ngx_slab_free_list(pages); i < NGX_SLAB_FREE_LISTS; i++) {
 
-        if (page->slab >= pages) {
+        free = &pool->free[i];
+
+        for (page = free->next; page != free; page = page->next) {
+
+            if (page->slab < pages) {
+                continue;
+            }
+
+            p = (ngx_slab_page_t *) page->prev;
+            p->next = page->next;
+            page->next->prev = page->prev;
 
             if (page->slab > pages) {
                 page[page->slab - 1].prev = (uintptr_t) &page[pages];
 
                 page[pages].slab = page->slab - pages;
-                page[pages].next = page->next;
-                page[pages].prev = page->prev;
-
-                p = (ngx_slab_page_t *) page->prev;
-                p->next = &page[pages];
-                page->next->prev = (uintptr_t) &page[pages];
-
-            } else {
-                p = (ngx_slab_page_t *) page->prev;
-                p->next = page->next;
-                page->next->prev = page->prev;
+                ngx_slab_free_insert(pool, &page[pages]);
             }
 
+            pool->pfree -= pages;
+
             page->slab = pages | NGX_SLAB_PAGE_START;
             page->next = NULL;
             page->prev = NGX_SLAB_PAGE;
@@ -709,6 +766,8 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
     ngx_uint_t        type;
     ngx_slab_page_t  *prev, *join;
 
+    pool->pfree += pages;
+
     page->slab = pages--;
 
     if (pages) {
@@ -774,12 +833,101 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
         page[pages].prev = (uintptr_t) page;
     }
 
-    page->prev = (uintptr_t) &pool->free;
-    page->next = pool->free.next;
+    ngx_slab_free_insert(pool, page);
+}
+
+
+static void
+ngx_slab_free_insert(ngx_slab_pool_t *pool, ngx_slab_page_t *page)
+{
+    ngx_slab_page_t  *free;
+
+    free = &pool->free[ngx_slab_free_list(page->slab)];
+
+    page->prev = (uintptr_t) free;
+    page->next = free->next;
 
     page->next->prev = (uintptr_t) page;
 
-    pool->free.next = page;
+    free->next = page;
+}
+
+
+static ngx_uint_t
+ngx_slab_free_list(ngx_uint_t pages)
+{
+    ngx_uint_t  n;
+
+    for (n = 0; pages >>= 1; n++) { /* void */ }
+
+    return ngx_min(n, NGX_SLAB_FREE_LISTS - 1);
+}
+
+
+void
+ngx_slab_stat(ngx_slab_pool_t *pool, ngx_str_t *name, ngx_log_t *log)
+{
+    size_t            size;
+    ngx_uint_t        i, n, runs, max;
+    ngx_slab_stat_t  *stat;
+    ngx_slab_page_t  *page, *free;
+
+    /*
+     * the master must not wait for a worker holding the mutex, so the
+     * counters are read without it and may be slightly inconsistent;
+     * the free lists are walked only if the mutex is free
+     */
+
+    if (ngx_shmtx_trylock(&pool->mutex)) {
+
+        runs = 0;
+        max = 0;
+
+        for (i = 0; i < NGX_SLAB_FREE_LISTS; i++) {
+            free = &pool->free[i];
+
+            for (page = free->next; page != free; page = page->next) {
+                runs++;
+
+                if (page->slab > max) {
+                    max = page->slab;
+                }
+            }
+        }
+
+        ngx_shmtx_unlock(&pool->mutex);
+
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "shared zone \"%V\": pages:%ui free:%ui fails:%ui "
+                      "free runs:%ui largest run:%ui",
+                      name, (ngx_uint_t) (pool->last - pool->pages),
+                      pool->pfree, pool->pfails, runs, max);
+
+    } else {
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "shared zone \"%V\": pages:%ui free:%ui fails:%ui, "
+                      "zone is locked, free runs are not counted",
+                      name, (ngx_uint_t) (pool->last - pool->pages),
+                      pool->pfree, pool->pfails);
+    }
+
+    n = ngx_pagesize_shift - pool->min_shift;
+
+    for (i = 0; i < n; i++) {
+        stat = &pool->stats[i];
+
+        if (stat->reqs == 0) {
+            continue;
+        }
+
+        size = (size_t) 1 << (i + pool->min_shift);
+
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "shared zone \"%V\" slot %uz: total:%ui used:%ui "
+                      "reqs:%ui fails:%ui",
+                      name, size, stat->total, stat->used,
+                      stat->reqs, stat->fails);
+    }
 }
 
 
@@ -22,6 +22,24 @@ struct ngx_slab_page_s {
 };
 
 
+/*
+ * free pages are kept in NGX_SLAB_FREE_LISTS lists by the length of
+ * a run: list n holds runs of 2^n to 2^(n+1) - 1 pages, the last list
+ * holds all longer runs
+ */
+
+#define NGX_SLAB_FREE_LISTS  16
+
+
+typedef struct {
+    ngx_uint_t        total;
+    ngx_uint_t        used;
+
+    ngx_uint_t        reqs;
+    ngx_uint_t        fails;
+} ngx_slab_stat_t;
+
+
 typedef struct {
     ngx_shmtx_sh_t    lock;
 
@@ -30,7 +48,11 @@ typedef struct {
 
     ngx_slab_page_t  *pages;
     ngx_slab_page_t  *last;
-    ngx_slab_page_t   free;
+    ngx_slab_page_t   free[NGX_SLAB_FREE_LISTS];
+
+    ngx_slab_stat_t  *stats;
+    ngx_uint_t        pfree;
+    ngx_uint_t        pfails;
 
     u_char           *start;
     u_char           *end;
@@ -42,11 +64,25 @@ typedef struct {
 
     unsigned          log_nomem:1;
 
+    ngx_atomic_t      generation;
+
     void             *data;
     void             *addr;
 } ngx_slab_pool_t;
 
 
+/*
+ * read-mostly data in a zone: a writer changes the data under the lock
+ * protecting it and then bumps the zone generation; a reader keeps
+ * a worker-local copy along with the generation read under the same lock,
+ * and uses the copy without locking while the generation is unchanged
+ */
+
+#define ngx_slab_generation(pool)  (pool)->generation
+#define ngx_slab_update_generation(pool)                                      \
+    (ngx_atomic_fetch_add(&(pool)->generation, 1) + 1)
+
+
 void ngx_slab_init(ngx_slab_pool_t *pool);
 void *ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size);
@@ -54,6 +90,7 @@ void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+void ngx_slab_stat(ngx_slab_pool_t *pool, ngx_str_t *name, ngx_log_t *log);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
@@ -576,6 +576,18 @@ ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name)
     return NULL;
 }
 
+//队列中等待的task数,不加锁,只用于统计
+ngx_int_t
+ngx_thread_pool_queue_size(ngx_thread_pool_t *tp)
+{
+    ngx_int_t  waiting;
+
+    waiting = *(volatile ngx_int_t *) &tp->waiting;
+
+    return (waiting > 0) ? waiting : 0;
+}
+
+
 //初始化worker
 static ngx_int_t
 ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
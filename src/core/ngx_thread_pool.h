@@ -22,9 +22,6 @@ struct ngx_thread_task_s {
     ngx_event_t          event;//事件
 };
 
-//线程池
-typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
-
 //添加线程
 ngx_thread_pool_t *ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name);
 //获取线程
@@ -33,6 +30,8 @@ ngx_thread_pool_t *ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name);
 ngx_thread_task_t *ngx_thread_task_alloc(ngx_pool_t *pool, size_t size);
 //添加task
 ngx_int_t ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task);
+//队列中等待的task数
+ngx_int_t ngx_thread_pool_queue_size(ngx_thread_pool_t *tp);
 
 
 #endif /* _NGX_THREAD_POOL_H_INCLUDED_ */
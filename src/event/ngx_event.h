@@ -500,6 +500,7 @@ extern ngx_module_t           ngx_event_core_module;
 void ngx_event_accept(ngx_event_t *ev);
 #if !(NGX_WIN32)
 void ngx_event_recvmsg(ngx_event_t *ev);
+void ngx_event_accept_passed(ngx_socket_t s, ngx_log_t *log);
 #endif
 //获取accept的锁
 ngx_int_t ngx_trylock_accept_mutex(ngx_cycle_t *cycle);
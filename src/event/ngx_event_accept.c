@@ -13,6 +13,10 @@
 static ngx_int_t ngx_enable_accept_events(ngx_cycle_t *cycle);
 static ngx_int_t ngx_disable_accept_events(ngx_cycle_t *cycle, ngx_uint_t all);
 static void ngx_close_accepted_connection(ngx_connection_t *c);
+#if !(NGX_WIN32)
+static ngx_listening_t *ngx_event_passed_listening(ngx_cycle_t *cycle,
+    struct sockaddr *sa, socklen_t socklen);
+#endif
 #if (NGX_DEBUG)
 static void ngx_debug_accepted_connection(ngx_event_conf_t *ecf,
     ngx_connection_t *c);
@@ -165,6 +169,8 @@ ngx_event_accept(ngx_event_t *ev)
             return;
         }
 
+        ngx_pool_set_type(c->pool, NGX_POOL_CONNECTION);
+
         c->sockaddr = ngx_palloc(c->pool, socklen);
         if (c->sockaddr == NULL) {
             ngx_close_accepted_connection(c);
@@ -453,6 +459,8 @@ ngx_event_recvmsg(ngx_event_t *ev)
             return;
         }
 
+        ngx_pool_set_type(c->pool, NGX_POOL_CONNECTION);
+
         c->sockaddr = ngx_palloc(c->pool, c->socklen);
         if (c->sockaddr == NULL) {
             ngx_close_accepted_connection(c);
@@ -634,6 +642,227 @@ ngx_event_recvmsg(ngx_event_t *ev)
     } while (ev->available);
 }
 
+
+void
+ngx_event_accept_passed(ngx_socket_t s, ngx_log_t *log)
+{
+    socklen_t          socklen, local_socklen;
+    ngx_log_t         *clog;
+    ngx_listening_t   *ls;
+    ngx_connection_t  *c;
+    u_char             sa[NGX_SOCKADDRLEN], local[NGX_SOCKADDRLEN];
+
+    socklen = NGX_SOCKADDRLEN;
+
+    if (getpeername(s, (struct sockaddr *) sa, &socklen) == -1) {
+        ngx_log_error(NGX_LOG_INFO, log, ngx_socket_errno,
+                      "getpeername() of passed connection failed");
+        goto failed;
+    }
+
+    local_socklen = NGX_SOCKADDRLEN;
+
+    if (getsockname(s, (struct sockaddr *) local, &local_socklen) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_socket_errno,
+                      "getsockname() of passed connection failed");
+        goto failed;
+    }
+
+    ls = ngx_event_passed_listening((ngx_cycle_t *) ngx_cycle,
+                                    (struct sockaddr *) local, local_socklen);
+
+    if (ls == NULL) {
+        ngx_log_error(NGX_LOG_INFO, log, 0,
+                      "no listening socket for passed connection");
+        goto failed;
+    }
+
+    c = ngx_get_connection(s, log);
+
+    if (c == NULL) {
+        goto failed;
+    }
+
+    c->type = SOCK_STREAM;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
+#endif
+
+    c->pool = ngx_create_pool(ls->pool_size, log);
+    if (c->pool == NULL) {
+        ngx_close_accepted_connection(c);
+        return;
+    }
+
+    ngx_pool_set_type(c->pool, NGX_POOL_CONNECTION);
+
+    c->sockaddr = ngx_palloc(c->pool, socklen);
+    if (c->sockaddr == NULL) {
+        ngx_close_accepted_connection(c);
+        return;
+    }
+
+    ngx_memcpy(c->sockaddr, sa, socklen);
+
+    clog = ngx_palloc(c->pool, sizeof(ngx_log_t));
+    if (clog == NULL) {
+        ngx_close_accepted_connection(c);
+        return;
+    }
+
+    /* the socket is already in non-blocking mode, it was set by old worker */
+
+    *clog = ls->log;
+
+    c->recv = ngx_recv;
+    c->send = ngx_send;
+    c->recv_chain = ngx_recv_chain;
+    c->send_chain = ngx_send_chain;
+
+    c->log = clog;
+    c->pool->log = clog;
+
+    c->socklen = socklen;
+    c->listening = ls;
+    c->local_sockaddr = ls->sockaddr;
+    c->local_socklen = ls->socklen;
+
+    c->unexpected_eof = 1;
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    if (c->sockaddr->sa_family == AF_UNIX) {
+        c->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+        c->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+#if (NGX_SOLARIS)
+        /* Solaris's sendfilev() supports AF_NCA, AF_INET, and AF_INET6 */
+        c->sendfile = 0;
+#endif
+    }
+#endif
+
+    c->write->ready = 1;
+
+    c->read->log = clog;
+    c->write->log = clog;
+
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+
+    if (ls->addr_ntop) {
+        c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
+        if (c->addr_text.data == NULL) {
+            ngx_close_accepted_connection(c);
+            return;
+        }
+
+        c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
+                                         c->addr_text.data,
+                                         ls->addr_text_max_len, 0);
+        if (c->addr_text.len == 0) {
+            ngx_close_accepted_connection(c);
+            return;
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "*%uA passed connection: %V fd:%d",
+                   c->number, &c->addr_text, s);
+
+    if (ngx_add_conn && (ngx_event_flags & NGX_USE_EPOLL_EVENT) == 0) {
+        if (ngx_add_conn(c) == NGX_ERROR) {
+            ngx_close_accepted_connection(c);
+            return;
+        }
+    }
+
+    clog->data = NULL;
+    clog->handler = NULL;
+
+    ls->handler(c);
+
+    return;
+
+failed:
+
+    if (ngx_close_socket(s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_socket_errno,
+                      ngx_close_socket_n " failed");
+    }
+}
+
+
+static ngx_listening_t *
+ngx_event_passed_listening(ngx_cycle_t *cycle, struct sockaddr *sa,
+    socklen_t socklen)
+{
+    ngx_uint_t            i;
+    ngx_listening_t      *ls, *wildcard;
+    struct sockaddr_in   *sin, *lsin;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin6, *lsin6;
+#endif
+
+    wildcard = NULL;
+
+    ls = cycle->listening.elts;
+    for (i = 0; i < cycle->listening.nelts; i++) {
+
+        if (ls[i].fd == (ngx_socket_t) -1
+            || ls[i].type != SOCK_STREAM
+            || ls[i].sockaddr->sa_family != sa->sa_family)
+        {
+            continue;
+        }
+
+#if (NGX_HAVE_REUSEPORT)
+        if (ls[i].reuseport && ls[i].worker != ngx_worker) {
+            continue;
+        }
+#endif
+
+        if (ngx_cmp_sockaddr(ls[i].sockaddr, ls[i].socklen, sa, socklen, 1)
+            == NGX_OK)
+        {
+            return &ls[i];
+        }
+
+        if (wildcard) {
+            continue;
+        }
+
+        switch (sa->sa_family) {
+
+#if (NGX_HAVE_INET6)
+        case AF_INET6:
+            sin6 = (struct sockaddr_in6 *) sa;
+            lsin6 = (struct sockaddr_in6 *) ls[i].sockaddr;
+
+            if (lsin6->sin6_port == sin6->sin6_port
+                && IN6_IS_ADDR_UNSPECIFIED(&lsin6->sin6_addr))
+            {
+                wildcard = &ls[i];
+            }
+
+            break;
+#endif
+
+        case AF_INET:
+            sin = (struct sockaddr_in *) sa;
+            lsin = (struct sockaddr_in *) ls[i].sockaddr;
+
+            if (lsin->sin_port == sin->sin_port
+                && lsin->sin_addr.s_addr == INADDR_ANY)
+            {
+                wildcard = &ls[i];
+            }
+
+            break;
+        }
+    }
+
+    return wildcard;
+}
+
 #endif
 
 
@@ -9,13 +9,27 @@
 #include <ngx_core.h>
 #include <ngx_event.h>
 
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
 
 #define NGX_SSL_PASSWORD_BUFFER_SIZE  4096
 
 
+#if (NGX_THREADS)
+
 typedef struct {
-    ngx_uint_t  engine;   /* unsigned  engine:1; */
-} ngx_openssl_conf_t;
+    ngx_connection_t  *connection;
+    ngx_int_t          rc;
+    int                sslerr;
+
+    unsigned           read_ready:1;
+    unsigned           write_ready:1;
+    unsigned           peer_closed:1;
+} ngx_ssl_handshake_ctx_t;
+
+#endif
 
 
 static int ngx_ssl_password_callback(char *buf, int size, int rwflag,
@@ -24,9 +38,19 @@ static int ngx_ssl_verify_callback(int ok, X509_STORE_CTX *x509_store);
 static void ngx_ssl_info_callback(const ngx_ssl_conn_t *ssl_conn, int where,
     int ret);
 static void ngx_ssl_passwords_cleanup(void *data);
+static ngx_int_t ngx_ssl_handshake_done(ngx_connection_t *c);
+static ngx_int_t ngx_ssl_handshake_again(ngx_connection_t *c, int sslerr);
 static void ngx_ssl_handshake_handler(ngx_event_t *ev);
+#if (NGX_THREADS)
+static ngx_int_t ngx_ssl_handshake_thread(ngx_connection_t *c);
+static void ngx_ssl_handshake_thread_handler(void *data, ngx_log_t *log);
+static void ngx_ssl_handshake_thread_event_handler(ngx_event_t *ev);
+static void ngx_ssl_handshake_busy_handler(ngx_event_t *ev);
+#endif
 static ngx_int_t ngx_ssl_handle_recv(ngx_connection_t *c, int n);
 static void ngx_ssl_write_handler(ngx_event_t *wev);
+static ssize_t ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file,
+    size_t size);
 static void ngx_ssl_read_handler(ngx_event_t *rev);
 static void ngx_ssl_shutdown_handler(ngx_event_t *ev);
 static void ngx_ssl_connection_error(ngx_connection_t *c, int sslerr,
@@ -44,12 +68,19 @@ static ngx_ssl_session_t *ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 #endif
     u_char *id, int len, int *copy);
 static void ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess);
-static void ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n);
+static ngx_int_t ngx_ssl_session_cache_shard(ngx_shm_zone_t *shm_zone,
+    ngx_ssl_session_shard_t *shard, u_char *addr, size_t size);
+static void ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard,
+    ngx_uint_t n);
 static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+static ngx_int_t ngx_ssl_generate_ticket_key(ngx_ssl_session_ticket_key_t *key,
+    ngx_log_t *log);
+static ngx_int_t ngx_ssl_rotate_ticket_keys(SSL_CTX *ssl_ctx, ngx_log_t *log);
+static void ngx_ssl_copy_ticket_keys(SSL_CTX *ssl_ctx,
+    ngx_ssl_session_ticket_key_t *keys);
 static int ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
     HMAC_CTX *hctx, int enc);
@@ -1055,6 +1086,30 @@ ngx_ssl_ecdh_curve(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *name)
 }
 
 
+ngx_int_t
+ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+
+    /*
+     * OpenSSL installs the record keys into the kernel with TCP_ULP "tls"
+     * after the handshake if both the kernel and the negotiated cipher
+     * support it, and transparently keeps encrypting in userspace otherwise
+     */
+
+    SSL_CTX_set_options(ssl->ctx, SSL_OP_ENABLE_KTLS);
+
+#else
+
+    ngx_log_error(NGX_LOG_WARN, cf->log, 0,
+                  "\"ssl_ktls\" is not supported on this platform, ignored");
+
+#endif
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c, ngx_uint_t flags)
 {
@@ -1069,6 +1124,13 @@ ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c, ngx_uint_t flags)
     sc->buffer_size = ssl->buffer_size;
 
     sc->session_ctx = ssl->ctx;
+    sc->handshake_start = ngx_current_msec;
+
+#if (NGX_THREADS)
+    if (!(flags & NGX_SSL_CLIENT)) {
+        sc->thread_pool = ssl->thread_pool;
+    }
+#endif
 
     sc->connection = SSL_new(ssl->ctx);
 
@@ -1120,6 +1182,20 @@ ngx_ssl_handshake(ngx_connection_t *c)
     int        n, sslerr;
     ngx_err_t  err;
 
+#if (NGX_THREADS)
+    ngx_int_t  rc;
+
+    if (c->ssl->thread_pool && (ngx_event_flags & NGX_USE_CLEAR_EVENT)) {
+        rc = ngx_ssl_handshake_thread(c);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+
+        /* the thread pool queue is full, fall back to inline handshake */
+    }
+#endif
+
     ngx_ssl_clear_error(c->log);
 
     n = SSL_do_handshake(c->ssl->connection);
@@ -1127,163 +1203,392 @@ ngx_ssl_handshake(ngx_connection_t *c)
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_do_handshake: %d", n);
 
     if (n == 1) {
+        return ngx_ssl_handshake_done(c);
+    }
 
-        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    sslerr = SSL_get_error(c->ssl->connection, n);
 
-        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
+
+    if (sslerr == SSL_ERROR_WANT_READ || sslerr == SSL_ERROR_WANT_WRITE) {
+        return ngx_ssl_handshake_again(c, sslerr);
+    }
+
+    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+
+    c->ssl->no_wait_shutdown = 1;
+    c->ssl->no_send_shutdown = 1;
+    c->read->eof = 1;
+
+    if (sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
+        ngx_connection_error(c, err,
+                             "peer closed connection in SSL handshake");
+
+        return NGX_ERROR;
+    }
+
+    c->read->error = 1;
+
+    ngx_ssl_connection_error(c, sslerr, err, "SSL_do_handshake() failed");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_ssl_handshake_done(ngx_connection_t *c)
+{
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
 #if (NGX_DEBUG)
-        {
-        char         buf[129], *s, *d;
+    {
+    char         buf[129], *s, *d;
 #if OPENSSL_VERSION_NUMBER >= 0x10000000L
-        const
+    const
 #endif
-        SSL_CIPHER  *cipher;
+    SSL_CIPHER  *cipher;
 
-        cipher = SSL_get_current_cipher(c->ssl->connection);
+    cipher = SSL_get_current_cipher(c->ssl->connection);
 
-        if (cipher) {
-            SSL_CIPHER_description(cipher, &buf[1], 128);
+    if (cipher) {
+        SSL_CIPHER_description(cipher, &buf[1], 128);
 
-            for (s = &buf[1], d = buf; *s; s++) {
-                if (*s == ' ' && *d == ' ') {
-                    continue;
-                }
-
-                if (*s == LF || *s == CR) {
-                    continue;
-                }
-
-                *++d = *s;
+        for (s = &buf[1], d = buf; *s; s++) {
+            if (*s == ' ' && *d == ' ') {
+                continue;
             }
 
-            if (*d != ' ') {
-                d++;
+            if (*s == LF || *s == CR) {
+                continue;
             }
 
-            *d = '\0';
+            *++d = *s;
+        }
 
-            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                           "SSL: %s, cipher: \"%s\"",
-                           SSL_get_version(c->ssl->connection), &buf[1]);
+        if (*d != ' ') {
+            d++;
+        }
 
-            if (SSL_session_reused(c->ssl->connection)) {
-                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                               "SSL reused session");
-            }
+        *d = '\0';
 
-        } else {
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL: %s, cipher: \"%s\"",
+                       SSL_get_version(c->ssl->connection), &buf[1]);
+
+        if (SSL_session_reused(c->ssl->connection)) {
             ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                           "SSL no shared ciphers");
-        }
+                           "SSL reused session");
         }
+
+    } else {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL no shared ciphers");
+    }
+    }
 #endif
 
-        c->ssl->handshaked = 1;
+    c->ssl->handshaked = 1;
+    c->ssl->handshake_time = ngx_current_msec - c->ssl->handshake_start;
+
+#ifdef BIO_get_ktls_send
+
+    if (BIO_get_ktls_send(SSL_get_wbio(c->ssl->connection)) == 1) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "BIO_get_ktls_send(): 1");
+        c->ssl->sendfile = 1;
+    }
+
+#endif
 
-        c->recv = ngx_ssl_recv;
-        c->send = ngx_ssl_write;
-        c->recv_chain = ngx_ssl_recv_chain;
-        c->send_chain = ngx_ssl_send_chain;
+    c->recv = ngx_ssl_recv;
+    c->send = ngx_ssl_write;
+    c->recv_chain = ngx_ssl_recv_chain;
+    c->send_chain = ngx_ssl_send_chain;
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 #ifdef SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS
 
-        /* initial handshake done, disable renegotiation (CVE-2009-3555) */
-        if (c->ssl->connection->s3) {
-            c->ssl->connection->s3->flags |= SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS;
-        }
+    /* initial handshake done, disable renegotiation (CVE-2009-3555) */
+    if (c->ssl->connection->s3) {
+        c->ssl->connection->s3->flags |= SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS;
+    }
 
 #endif
 #endif
 
-        return NGX_OK;
-    }
-
-    sslerr = SSL_get_error(c->ssl->connection, n);
+    return NGX_OK;
+}
 
-    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
 
+static ngx_int_t
+ngx_ssl_handshake_again(ngx_connection_t *c, int sslerr)
+{
     if (sslerr == SSL_ERROR_WANT_READ) {
         c->read->ready = 0;
-        c->read->handler = ngx_ssl_handshake_handler;
-        c->write->handler = ngx_ssl_handshake_handler;
 
-        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    } else {
+        c->write->ready = 0;
+    }
 
-        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    c->read->handler = ngx_ssl_handshake_handler;
+    c->write->handler = ngx_ssl_handshake_handler;
 
-        return NGX_AGAIN;
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        return NGX_ERROR;
     }
 
-    if (sslerr == SSL_ERROR_WANT_WRITE) {
-        c->write->ready = 0;
-        c->read->handler = ngx_ssl_handshake_handler;
-        c->write->handler = ngx_ssl_handshake_handler;
+    if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    return NGX_AGAIN;
+}
 
-        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+
+static void
+ngx_ssl_handshake_handler(ngx_event_t *ev)
+{
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL handshake handler: %d", ev->write);
+
+    if (ev->timedout) {
+        c->ssl->handler(c);
+        return;
+    }
+
+    if (ngx_ssl_handshake(c) == NGX_AGAIN) {
+        return;
+    }
+
+    c->ssl->handler(c);
+}
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_ssl_handshake_thread(ngx_connection_t *c)
+{
+    ngx_int_t                 waiting;
+    ngx_thread_task_t        *task;
+    ngx_ssl_handshake_ctx_t  *ctx;
+
+    /*
+     * SSL_do_handshake() is run in a thread pool, so private key
+     * operations do not block the event loop; the connection is parked
+     * until the task is done, events arriving meanwhile are only recorded
+     */
+
+    task = c->ssl->handshake_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(c->pool, sizeof(ngx_ssl_handshake_ctx_t));
+        if (task == NULL) {
             return NGX_ERROR;
         }
 
-        return NGX_AGAIN;
+        task->handler = ngx_ssl_handshake_thread_handler;
+
+        task->event.data = c;
+        task->event.handler = ngx_ssl_handshake_thread_event_handler;
+
+        c->ssl->handshake_task = task;
+    }
+
+    ctx = task->ctx;
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+    /* ticket keys are only rotated in the worker thread */
+    (void) ngx_ssl_rotate_ticket_keys(c->ssl->session_ctx, c->log);
+#endif
+
+    ctx->connection = c;
+    ctx->read_ready = c->read->ready;
+    ctx->write_ready = c->write->ready;
+
+    waiting = ngx_thread_pool_queue_size(c->ssl->thread_pool);
+
+    if (ngx_thread_task_post(c->ssl->thread_pool, task) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    if (waiting > c->ssl->handshake_queue) {
+        c->ssl->handshake_queue = waiting;
+    }
+
+    c->ssl->in_thread = 1;
+
+    c->read->ready = 0;
+    c->write->ready = 0;
+
+    c->read->handler = ngx_ssl_handshake_busy_handler;
+    c->write->handler = ngx_ssl_handshake_busy_handler;
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_ssl_handshake_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_ssl_handshake_ctx_t *ctx = data;
+
+    int                n, sslerr;
+    ngx_err_t          err;
+    ngx_connection_t  *c;
+
+    c = ctx->connection;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "SSL handshake thread handler");
+
+    ngx_ssl_clear_error(c->log);
+
+    n = SSL_do_handshake(c->ssl->connection);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_do_handshake: %d", n);
+
+    if (n == 1) {
+        ctx->rc = NGX_OK;
+        return;
+    }
+
+    sslerr = SSL_get_error(c->ssl->connection, n);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
+
+    ctx->sslerr = sslerr;
+
+    if (sslerr == SSL_ERROR_WANT_READ || sslerr == SSL_ERROR_WANT_WRITE) {
+        ctx->rc = NGX_AGAIN;
+        return;
     }
 
+    /*
+     * errno and the OpenSSL error queue are thread-local, so the error
+     * is logged here, while the connection flags are set by the event
+     * handler in the worker thread
+     */
+
     err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
 
-    c->ssl->no_wait_shutdown = 1;
-    c->ssl->no_send_shutdown = 1;
-    c->read->eof = 1;
+    ctx->rc = NGX_ERROR;
 
     if (sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
+        ctx->peer_closed = 1;
         ngx_connection_error(c, err,
                              "peer closed connection in SSL handshake");
-
-        return NGX_ERROR;
+        return;
     }
 
-    c->read->error = 1;
+    ctx->peer_closed = 0;
 
     ngx_ssl_connection_error(c, sslerr, err, "SSL_do_handshake() failed");
-
-    return NGX_ERROR;
 }
 
 
 static void
-ngx_ssl_handshake_handler(ngx_event_t *ev)
+ngx_ssl_handshake_thread_event_handler(ngx_event_t *ev)
 {
-    ngx_connection_t  *c;
+    ngx_int_t                 rc;
+    ngx_uint_t                read_event, write_event;
+    ngx_connection_t         *c;
+    ngx_ssl_handshake_ctx_t  *ctx;
 
     c = ev->data;
+    ctx = c->ssl->handshake_task->ctx;
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                   "SSL handshake handler: %d", ev->write);
+                   "SSL handshake thread done: %i", ctx->rc);
 
-    if (ev->timedout) {
+    c->ssl->in_thread = 0;
+
+    c->read->handler = ngx_ssl_handshake_handler;
+    c->write->handler = ngx_ssl_handshake_handler;
+
+    if (c->read->timedout || c->write->timedout) {
         c->ssl->handler(c);
         return;
     }
 
-    if (ngx_ssl_handshake(c) == NGX_AGAIN) {
-        return;
+    /* events reported while the handshake was running in a thread */
+
+    read_event = c->read->ready;
+    write_event = c->write->ready;
+
+    c->read->ready |= ctx->read_ready;
+    c->write->ready |= ctx->write_ready;
+
+    switch (ctx->rc) {
+
+    case NGX_OK:
+
+        ngx_ssl_stapling_refresh(c);
+
+        if (ngx_ssl_handshake_done(c) != NGX_OK) {
+            c->ssl->handshaked = 0;
+            c->error = 1;
+        }
+
+        break;
+
+    case NGX_AGAIN:
+
+        if ((ctx->sslerr == SSL_ERROR_WANT_READ && read_event)
+            || (ctx->sslerr == SSL_ERROR_WANT_WRITE && write_event))
+        {
+            rc = ngx_ssl_handshake(c);
+
+        } else {
+            rc = ngx_ssl_handshake_again(c, ctx->sslerr);
+        }
+
+        if (rc == NGX_AGAIN) {
+            return;
+        }
+
+        break;
+
+    default: /* NGX_ERROR */
+
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+        c->read->eof = 1;
+
+        if (!ctx->peer_closed) {
+            c->read->error = 1;
+        }
+
+        break;
     }
 
     c->ssl->handler(c);
 }
 
 
+static void
+ngx_ssl_handshake_busy_handler(ngx_event_t *ev)
+{
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL handshake busy handler: %d", ev->write);
+}
+
+#endif
+
+
 ssize_t
 ngx_ssl_recv_chain(ngx_connection_t *c, ngx_chain_t *cl, off_t limit)
 {
@@ -1538,10 +1843,12 @@ ngx_ssl_write_handler(ngx_event_t *wev)
 ngx_chain_t *
 ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 {
-    int          n;
-    ngx_uint_t   flush;
-    ssize_t      send, size;
-    ngx_buf_t   *buf;
+    int            n;
+    off_t          fsize;
+    ngx_uint_t     flush;
+    ssize_t        send, size;
+    ngx_buf_t     *buf;
+    ngx_chain_t   *cl;
 
     if (!c->ssl->buffer) {
 
@@ -1615,6 +1922,11 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 continue;
             }
 
+            if (in->buf->in_file && c->ssl->sendfile) {
+                flush = 1;
+                break;
+            }
+
             size = in->buf->last - in->buf->pos;
 
             if (size > buf->end - buf->last) {
@@ -1646,6 +1958,32 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
         size = buf->last - buf->pos;
 
         if (size == 0) {
+
+            if (in && in->buf->in_file && send < limit) {
+
+                /* coalesce the neighbouring file bufs */
+
+                cl = in;
+                fsize = ngx_chain_coalesce_file(&cl, limit - send);
+
+                n = ngx_ssl_sendfile(c, in->buf, (size_t) fsize);
+
+                if (n == NGX_ERROR) {
+                    return NGX_CHAIN_ERROR;
+                }
+
+                if (n == NGX_AGAIN) {
+                    break;
+                }
+
+                in = ngx_chain_update_sent(in, n);
+
+                send += n;
+                flush = 0;
+
+                continue;
+            }
+
             buf->flush = 0;
             c->buffered &= ~NGX_SSL_BUFFERED;
             return in;
@@ -1716,16 +2054,129 @@ ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
                 return NGX_ERROR;
             }
 
-            ngx_post_event(c->read, &ngx_posted_events);
-        }
+            ngx_post_event(c->read, &ngx_posted_events);
+        }
+
+        c->sent += n;
+
+        return n;
+    }
+
+    sslerr = SSL_get_error(c->ssl->connection, n);
+
+    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
+
+    if (sslerr == SSL_ERROR_WANT_WRITE) {
+        c->write->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    if (sslerr == SSL_ERROR_WANT_READ) {
+
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "peer started SSL renegotiation");
+
+        c->read->ready = 0;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        /*
+         * we do not set the timer because there is already
+         * the write event timer
+         */
+
+        if (c->ssl->saved_read_handler == NULL) {
+            c->ssl->saved_read_handler = c->read->handler;
+            c->read->handler = ngx_ssl_read_handler;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    c->ssl->no_wait_shutdown = 1;
+    c->ssl->no_send_shutdown = 1;
+    c->write->error = 1;
+
+    ngx_ssl_connection_error(c, sslerr, err, "SSL_write() failed");
+
+    return NGX_ERROR;
+}
+
+
+static ssize_t
+ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file, size_t size)
+{
+#ifdef BIO_get_ktls_send
+
+    int        sslerr;
+    ssize_t    n;
+    ngx_err_t  err;
+
+    ngx_ssl_clear_error(c->log);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL to sendfile: @%O %uz", file->file_pos, size);
+
+    ngx_set_errno(0);
+
+    n = SSL_sendfile(c->ssl->connection, file->file->fd, file->file_pos,
+                     size, 0);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_sendfile: %z", n);
+
+    if (n > 0) {
+
+        if (c->ssl->saved_read_handler) {
+
+            c->read->handler = c->ssl->saved_read_handler;
+            c->ssl->saved_read_handler = NULL;
+            c->read->ready = 1;
+
+            if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ngx_post_event(c->read, &ngx_posted_events);
+        }
+
+        c->sent += n;
+
+        return n;
+    }
+
+    if (n == 0) {
+
+        /*
+         * if sendfile returns zero, then someone has truncated the file,
+         * so the offset became beyond the end of the file
+         */
 
-        c->sent += n;
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "SSL_sendfile() reported that \"%s\" was truncated at %O",
+                      file->file->name.data, file->file_pos);
 
-        return n;
+        return NGX_ERROR;
     }
 
     sslerr = SSL_get_error(c->ssl->connection, n);
 
+    if (sslerr == SSL_ERROR_SSL
+        && ERR_GET_REASON(ERR_peek_error()) == SSL_R_UNINITIALIZED
+        && ngx_errno != 0)
+    {
+        /*
+         * OpenSSL fails to return SSL_ERROR_SYSCALL if an error
+         * happens in sendfile(), and returns SSL_ERROR_SSL with
+         * SSL_R_UNINITIALIZED reason instead
+         */
+
+        sslerr = SSL_ERROR_SYSCALL;
+    }
+
     err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
@@ -1763,7 +2214,11 @@ ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
     c->ssl->no_send_shutdown = 1;
     c->write->error = 1;
 
-    ngx_ssl_connection_error(c, sslerr, err, "SSL_write() failed");
+    ngx_ssl_connection_error(c, sslerr, err, "SSL_sendfile() failed");
+
+#else
+    ngx_log_error(NGX_LOG_ALERT, c->log, 0, "SSL_sendfile() not available");
+#endif
 
     return NGX_ERROR;
 }
@@ -2268,7 +2723,9 @@ failed:
 ngx_int_t
 ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
-    size_t                    len;
+    u_char                   *p;
+    size_t                    len, size;
+    ngx_uint_t                i, n;
     ngx_slab_pool_t          *shpool;
     ngx_ssl_session_cache_t  *cache;
 
@@ -2284,7 +2741,7 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
         return NGX_OK;
     }
 
-    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_session_cache_t));
+    cache = ngx_slab_calloc(shpool, sizeof(ngx_ssl_session_cache_t));
     if (cache == NULL) {
         return NGX_ERROR;
     }
@@ -2292,10 +2749,125 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
     shpool->data = cache;
     shm_zone->data = cache;
 
-    ngx_rbtree_init(&cache->session_rbtree, &cache->sentinel,
-                    ngx_ssl_session_rbtree_insert_value);
+    len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in SSL session shared cache \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shpool->log_nomem = 0;
+
+    /*
+     * sessions are spread by id over independent sub-zones, each with
+     * its own slab pool and mutex, so workers rarely wait for each other
+     */
+
+    n = 1;
+
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    n = shm_zone->shm.size / NGX_SSL_SCACHE_SHARD_SIZE;
+
+    if (n > NGX_SSL_SCACHE_SHARDS) {
+        n = NGX_SSL_SCACHE_SHARDS;
+    }
+
+#endif
+
+    if (n > 1) {
+
+        /* leave room for the pages array and for the data above */
+
+        size = shm_zone->shm.size / n;
+        size -= size / 64 + ngx_pagesize;
+        size &= ~(ngx_pagesize - 1);
+
+        for (i = 0; i < n; i++) {
+            p = ngx_slab_alloc(shpool, size);
+            if (p == NULL) {
+                break;
+            }
+
+            if (ngx_ssl_session_cache_shard(shm_zone, &cache->shards[i], p,
+                                            size)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+
+        n = i;
+    }
+
+    if (n <= 1) {
+        n = 1;
+
+        if (cache->shards[0].shpool == NULL) {
+            if (ngx_ssl_session_cache_shard(shm_zone, &cache->shards[0], NULL,
+                                            0)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    cache->nshards = n;
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
 
-    ngx_queue_init(&cache->expire_queue);
+    /*
+     * the initial ticket keys are created here, in the master process;
+     * the keys are rotated by workers, see ngx_ssl_rotate_ticket_keys()
+     */
+
+    for (i = 0; i < 3; i++) {
+        if (ngx_ssl_generate_ticket_key(&cache->ticket_keys[i],
+                                        shm_zone->shm.log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_ssl_session_cache_shard(ngx_shm_zone_t *shm_zone,
+    ngx_ssl_session_shard_t *shard, u_char *addr, size_t size)
+{
+    size_t            len;
+    ngx_slab_pool_t  *shpool;
+
+    if (addr == NULL) {
+
+        /* the only shard uses the zone pool itself */
+
+        shard->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+        goto done;
+    }
+
+    shpool = (ngx_slab_pool_t *) addr;
+
+    ngx_memzero(shpool, sizeof(ngx_slab_pool_t));
+
+    shpool->end = addr + size;
+    shpool->min_shift = 3;
+    shpool->addr = addr;
+
+    if (ngx_shmtx_create(&shpool->mutex, &shpool->lock, NULL) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_slab_init(shpool);
 
     len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
 
@@ -2309,6 +2881,15 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     shpool->log_nomem = 0;
 
+    shard->shpool = shpool;
+
+done:
+
+    ngx_rbtree_init(&shard->session_rbtree, &shard->sentinel,
+                    ngx_ssl_session_rbtree_insert_value);
+
+    ngx_queue_init(&shard->expire_queue);
+
     return NGX_OK;
 }
 
@@ -2343,6 +2924,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     ngx_slab_pool_t          *shpool;
     ngx_ssl_sess_id_t        *sess_id;
     ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
 
     len = i2d_SSL_SESSION(sess, NULL);
@@ -2362,12 +2944,27 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
 
     cache = shm_zone->data;
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+#if OPENSSL_VERSION_NUMBER >= 0x0090800fL
+
+    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
+
+#else
+
+    session_id = sess->session_id;
+    session_id_length = sess->session_id_length;
+
+#endif
+
+    hash = ngx_crc32_short(session_id, session_id_length);
+
+    shard = &cache->shards[hash % cache->nshards];
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
     /* drop one or two expired sessions */
-    ngx_ssl_expire_sessions(cache, shpool, 1);
+    ngx_ssl_expire_sessions(shard, 1);
 
     cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -2375,7 +2972,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -2391,7 +2988,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         sess_id = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_sess_id_t));
 
@@ -2400,17 +2997,6 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
         }
     }
 
-#if OPENSSL_VERSION_NUMBER >= 0x0090800fL
-
-    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
-
-#else
-
-    session_id = sess->session_id;
-    session_id_length = sess->session_id_length;
-
-#endif
-
 #if (NGX_PTR_SIZE == 8)
 
     id = sess_id->sess_id;
@@ -2423,7 +3009,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         id = ngx_slab_alloc_locked(shpool, session_id_length);
 
@@ -2438,11 +3024,9 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     ngx_memcpy(id, session_id, session_id_length);
 
-    hash = ngx_crc32_short(session_id, session_id_length);
-
-    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                   "ssl new session: %08XD:%ud:%d",
-                   hash, session_id_length, len);
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "ssl new session: %08XD:%ud:%d, shard %ui",
+                   hash, session_id_length, len, shard - cache->shards);
 
     sess_id->node.key = hash;
     sess_id->node.data = (u_char) session_id_length;
@@ -2452,9 +3036,9 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     sess_id->expire = ngx_time() + SSL_CTX_get_timeout(ssl_ctx);
 
-    ngx_queue_insert_head(&cache->expire_queue, &sess_id->queue);
+    ngx_queue_insert_head(&shard->expire_queue, &sess_id->queue);
 
-    ngx_rbtree_insert(&cache->session_rbtree, &sess_id->node);
+    ngx_rbtree_insert(&shard->session_rbtree, &sess_id->node);
 
     ngx_shmtx_unlock(&shpool->mutex);
 
@@ -2498,6 +3082,7 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
     ngx_ssl_session_t        *sess;
     ngx_ssl_sess_id_t        *sess_id;
     ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
     ngx_connection_t         *c;
 
@@ -2516,12 +3101,13 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 
     sess = NULL;
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shard = &cache->shards[hash % cache->nshards];
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -2557,7 +3143,7 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -2602,6 +3188,7 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     ngx_rbtree_node_t        *node, *sentinel;
     ngx_ssl_sess_id_t        *sess_id;
     ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
 
     shm_zone = SSL_CTX_get_ex_data(ssl, ngx_ssl_session_cache_index);
 
@@ -2627,12 +3214,13 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                    "ssl remove session: %08XD:%ud", hash, len);
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shard = &cache->shards[hash % cache->nshards];
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -2656,7 +3244,7 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -2677,22 +3265,23 @@ done:
 
 
 static void
-ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n)
+ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard, ngx_uint_t n)
 {
     time_t              now;
     ngx_queue_t        *q;
+    ngx_slab_pool_t    *shpool;
     ngx_ssl_sess_id_t  *sess_id;
 
     now = ngx_time();
+    shpool = shard->shpool;
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&cache->expire_queue)) {
+        if (ngx_queue_empty(&shard->expire_queue)) {
             return;
         }
 
-        q = ngx_queue_last(&cache->expire_queue);
+        q = ngx_queue_last(&shard->expire_queue);
 
         sess_id = ngx_queue_data(q, ngx_ssl_sess_id_t, queue);
 
@@ -2705,7 +3294,7 @@ ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
         ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                        "expire session: %08Xi", sess_id->node.key);
 
-        ngx_rbtree_delete(&cache->session_rbtree, &sess_id->node);
+        ngx_rbtree_delete(&shard->session_rbtree, &sess_id->node);
 
         ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -2772,16 +3361,34 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
     ngx_file_info_t                fi;
     ngx_ssl_session_ticket_key_t  *key;
 
-    if (paths == NULL) {
+    if (paths == NULL
+        && SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_session_cache_index) == NULL)
+    {
         return NGX_OK;
     }
 
-    keys = ngx_array_create(cf->pool, paths->nelts,
+    keys = ngx_array_create(cf->pool, paths ? paths->nelts : 3,
                             sizeof(ngx_ssl_session_ticket_key_t));
     if (keys == NULL) {
         return NGX_ERROR;
     }
 
+    if (paths == NULL) {
+
+        /* a local copy of the keys kept in the shared session cache */
+
+        key = ngx_array_push_n(keys, 3);
+        if (key == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(key, 3 * sizeof(ngx_ssl_session_ticket_key_t));
+
+        key[0].shared = 1;
+
+        goto done;
+    }
+
     path = paths->elts;
     for (i = 0; i < paths->nelts; i++) {
 
@@ -2835,6 +3442,8 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
         ngx_memcpy(key->name, buf, 16);
         ngx_memcpy(key->aes_key, buf + 16, 16);
         ngx_memcpy(key->hmac_key, buf + 32, 16);
+        key->expire = 0;
+        key->shared = 0;
 
         if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
             ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
@@ -2842,6 +3451,8 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
         }
     }
 
+done:
+
     if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_session_ticket_keys_index, keys)
         == 0)
     {
@@ -2874,6 +3485,116 @@ failed:
 }
 
 
+static ngx_int_t
+ngx_ssl_generate_ticket_key(ngx_ssl_session_ticket_key_t *key, ngx_log_t *log)
+{
+    u_char  buf[48];
+
+    if (RAND_bytes(buf, 48) != 1) {
+        ngx_ssl_error(NGX_LOG_ALERT, log, 0, "RAND_bytes() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(key->name, buf, 16);
+    ngx_memcpy(key->aes_key, buf + 16, 16);
+    ngx_memcpy(key->hmac_key, buf + 32, 16);
+    key->expire = 0;
+    key->shared = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_ssl_rotate_ticket_keys(SSL_CTX *ssl_ctx, ngx_log_t *log)
+{
+    time_t                         now;
+    ngx_int_t                      rc;
+    ngx_array_t                   *keys;
+    ngx_shm_zone_t                *shm_zone;
+    ngx_slab_pool_t               *shpool;
+    ngx_ssl_session_cache_t       *cache;
+    ngx_ssl_session_ticket_key_t  *key;
+
+    keys = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_ticket_keys_index);
+    if (keys == NULL) {
+        return NGX_OK;
+    }
+
+    key = keys->elts;
+
+    if (!key[0].shared) {
+        return NGX_OK;
+    }
+
+    now = ngx_time();
+
+    if (key[0].expire > now) {
+        return NGX_OK;
+    }
+
+    /*
+     * the local copy is out of date: the current key is used for
+     * encryption, while the previous and the next keys are accepted
+     * for decryption, so workers need not switch keys simultaneously
+     */
+
+    shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
+
+    cache = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    rc = NGX_OK;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    key = cache->ticket_keys;
+
+    if (key[0].expire <= now) {
+
+        if (key[0].expire != 0) {
+            key[1] = key[0];
+            key[0] = key[2];
+
+            rc = ngx_ssl_generate_ticket_key(&key[2], log);
+        }
+
+        key[0].expire = now + SSL_CTX_get_timeout(ssl_ctx);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "ssl session ticket keys rotated, expire: %T",
+                       key[0].expire);
+    }
+
+    ngx_memcpy(keys->elts, key, 3 * sizeof(ngx_ssl_session_ticket_key_t));
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    return rc;
+}
+
+
+static void
+ngx_ssl_copy_ticket_keys(SSL_CTX *ssl_ctx, ngx_ssl_session_ticket_key_t *keys)
+{
+    ngx_shm_zone_t           *shm_zone;
+    ngx_slab_pool_t          *shpool;
+    ngx_ssl_session_cache_t  *cache;
+
+    shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
+
+    cache = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    ngx_memcpy(keys, cache->ticket_keys,
+               3 * sizeof(ngx_ssl_session_ticket_key_t));
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
 #ifdef OPENSSL_NO_SHA256
 #define ngx_ssl_session_ticket_md  EVP_sha1
 #else
@@ -2890,7 +3611,7 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     ngx_uint_t                     i;
     ngx_array_t                   *keys;
     ngx_connection_t              *c;
-    ngx_ssl_session_ticket_key_t  *key;
+    ngx_ssl_session_ticket_key_t  *key, shared[3];
 #if (NGX_DEBUG)
     u_char                         buf[32];
 #endif
@@ -2905,6 +3626,23 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
 
     key = keys->elts;
 
+    if (key[0].shared) {
+
+        if (c->ssl->in_thread) {
+
+            /*
+             * a handshake thread does not touch the local copy,
+             * it is only updated in the worker thread
+             */
+
+            ngx_ssl_copy_ticket_keys(ssl_ctx, shared);
+            key = shared;
+
+        } else if (ngx_ssl_rotate_ticket_keys(ssl_ctx, c->log) != NGX_OK) {
+            return -1;
+        }
+    }
+
     if (enc == 1) {
         /* encrypt session ticket */
 
@@ -3509,6 +4247,50 @@ ngx_ssl_get_client_verify(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
 }
 
 
+ngx_int_t
+ngx_ssl_get_handshake_time(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s)
+{
+    u_char  *p;
+
+    if (!c->ssl->handshaked) {
+        s->len = 0;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(pool, NGX_TIME_T_LEN + 4);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->len = ngx_sprintf(p, "%T.%03M",
+                         (time_t) c->ssl->handshake_time / 1000,
+                         c->ssl->handshake_time % 1000)
+             - p;
+    s->data = p;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_handshake_queue(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s)
+{
+    u_char  *p;
+
+    p = ngx_pnalloc(pool, NGX_INT_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->len = ngx_sprintf(p, "%i", c->ssl->handshake_queue) - p;
+    s->data = p;
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_openssl_create_conf(ngx_cycle_t *cycle)
 {
@@ -3525,6 +4307,13 @@ ngx_openssl_create_conf(ngx_cycle_t *cycle)
      *     oscf->engine = 0;
      */
 
+    if (ngx_array_init(&oscf->staplings, cycle->pool, 4,
+                       sizeof(void *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
     return oscf;
 }
 
@@ -58,6 +58,9 @@ typedef struct {
     SSL_CTX                    *ctx;
     ngx_log_t                  *log;
     size_t                      buffer_size;
+#if (NGX_THREADS)
+    ngx_thread_pool_t          *thread_pool;
+#endif
 } ngx_ssl_t;
 
 
@@ -74,12 +77,23 @@ typedef struct {
     ngx_event_handler_pt        saved_read_handler;
     ngx_event_handler_pt        saved_write_handler;
 
+#if (NGX_THREADS)
+    ngx_thread_pool_t          *thread_pool;
+    ngx_thread_task_t          *handshake_task;
+#endif
+
+    ngx_msec_t                  handshake_start;
+    ngx_msec_t                  handshake_time;
+    ngx_int_t                   handshake_queue;
+
     unsigned                    handshaked:1;
     unsigned                    renegotiation:1;
     unsigned                    buffer:1;
     unsigned                    no_wait_shutdown:1;
     unsigned                    no_send_shutdown:1;
     unsigned                    handshake_buffer_set:1;
+    unsigned                    sendfile:1;
+    unsigned                    in_thread:1;
 } ngx_ssl_connection_t;
 
 
@@ -107,11 +121,16 @@ struct ngx_ssl_sess_id_s {
 };
 
 
+#define NGX_SSL_SCACHE_SHARDS       8
+#define NGX_SSL_SCACHE_SHARD_SIZE   (128 * 1024)
+
+
 typedef struct {
     ngx_rbtree_t                session_rbtree;
     ngx_rbtree_node_t           sentinel;
     ngx_queue_t                 expire_queue;
-} ngx_ssl_session_cache_t;
+    ngx_slab_pool_t            *shpool;
+} ngx_ssl_session_shard_t;
 
 
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
@@ -120,11 +139,28 @@ typedef struct {
     u_char                      name[16];
     u_char                      aes_key[16];
     u_char                      hmac_key[16];
+    time_t                      expire;
+    unsigned                    shared:1;
 } ngx_ssl_session_ticket_key_t;
 
 #endif
 
 
+typedef struct {
+    ngx_uint_t                  nshards;
+    ngx_ssl_session_shard_t     shards[NGX_SSL_SCACHE_SHARDS];
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+    ngx_ssl_session_ticket_key_t  ticket_keys[3];
+#endif
+} ngx_ssl_session_cache_t;
+
+
+typedef struct {
+    ngx_uint_t                  engine;   /* unsigned  engine:1; */
+    ngx_array_t                 staplings;
+} ngx_openssl_conf_t;
+
+
 #define NGX_SSL_SSLv2    0x0002
 #define NGX_SSL_SSLv3    0x0004
 #define NGX_SSL_TLSv1    0x0008
@@ -151,11 +187,16 @@ ngx_int_t ngx_ssl_stapling(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *file, ngx_str_t *responder, ngx_uint_t verify);
 ngx_int_t ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_resolver_t *resolver, ngx_msec_t resolver_timeout);
+ngx_int_t ngx_ssl_stapling_store(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_str_t *path);
+ngx_int_t ngx_ssl_stapling_init_worker(ngx_cycle_t *cycle);
+void ngx_ssl_stapling_refresh(ngx_connection_t *c);
 RSA *ngx_ssl_rsa512_key_callback(ngx_ssl_conn_t *ssl_conn, int is_export,
     int key_length);
 ngx_array_t *ngx_ssl_read_password_file(ngx_conf_t *cf, ngx_str_t *file);
 ngx_int_t ngx_ssl_dhparam(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file);
 ngx_int_t ngx_ssl_ecdh_curve(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *name);
+ngx_int_t ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl);
 ngx_int_t ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
     ssize_t builtin_session_cache, ngx_shm_zone_t *shm_zone, time_t timeout);
 ngx_int_t ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl,
@@ -207,6 +248,10 @@ ngx_int_t ngx_ssl_get_fingerprint(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
 ngx_int_t ngx_ssl_get_client_verify(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
+ngx_int_t ngx_ssl_get_handshake_time(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s);
+ngx_int_t ngx_ssl_get_handshake_queue(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s);
 
 
 ngx_int_t ngx_ssl_handshake(ngx_connection_t *c);
@@ -230,4 +275,7 @@ extern int  ngx_ssl_certificate_index;
 extern int  ngx_ssl_stapling_index;
 
 
+extern ngx_module_t  ngx_openssl_module;
+
+
 #endif /* _NGX_EVENT_OPENSSL_H_INCLUDED_ */
@@ -16,6 +16,7 @@
 
 typedef struct {
     ngx_str_t                    staple;
+    ngx_atomic_t                 lock;
     ngx_msec_t                   timeout;
 
     ngx_resolver_t              *resolver;
@@ -34,11 +35,20 @@ typedef struct {
     time_t                       valid;
     time_t                       refresh;
 
+    ngx_str_t                    store;
+    time_t                       mtime;
+    ngx_event_t                  event;
+
     unsigned                     verify:1;
     unsigned                     loading:1;
+    unsigned                     fetcher:1;
 } ngx_ssl_stapling_t;
 
 
+#define NGX_SSL_STAPLING_INTERVAL  60
+#define NGX_SSL_STAPLING_MAX_SIZE  65536
+
+
 typedef struct ngx_ssl_ocsp_ctx_s  ngx_ssl_ocsp_ctx_t;
 
 struct ngx_ssl_ocsp_ctx_s {
@@ -93,6 +103,14 @@ static int ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn,
     void *data);
 static void ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple);
 static void ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx);
+static ngx_int_t ngx_ssl_stapling_check(ngx_ssl_stapling_t *staple,
+    ngx_str_t *response, time_t *valid, ngx_log_t *log);
+static void ngx_ssl_stapling_set(ngx_ssl_stapling_t *staple,
+    ngx_str_t *response, time_t valid);
+static ngx_int_t ngx_ssl_stapling_load(ngx_ssl_stapling_t *staple,
+    ngx_log_t *log);
+static void ngx_ssl_stapling_save(ngx_ssl_stapling_t *staple, ngx_log_t *log);
+static void ngx_ssl_stapling_timer_handler(ngx_event_t *ev);
 
 static time_t ngx_ssl_stapling_time(ASN1_GENERALIZEDTIME *asn1time);
 
@@ -123,7 +141,8 @@ ngx_ssl_stapling(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file,
 {
     ngx_int_t                  rc;
     ngx_pool_cleanup_t        *cln;
-    ngx_ssl_stapling_t        *staple;
+    ngx_openssl_conf_t        *oscf;
+    ngx_ssl_stapling_t        *staple, **stp;
 
     staple = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_stapling_t));
     if (staple == NULL) {
@@ -180,6 +199,16 @@ ngx_ssl_stapling(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file,
         return NGX_ERROR;
     }
 
+    oscf = (ngx_openssl_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                               ngx_openssl_module);
+
+    stp = ngx_array_push(&oscf->staplings);
+    if (stp == NULL) {
+        return NGX_ERROR;
+    }
+
+    *stp = staple;
+
 done:
 
     SSL_CTX_set_tlsext_status_cb(ssl->ctx, ngx_ssl_certificate_status_callback);
@@ -470,6 +499,13 @@ ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn, void *data)
     staple = data;
     rc = SSL_TLSEXT_ERR_NOACK;
 
+    /*
+     * the callback may be called from a handshake thread,
+     * so the response is copied under the lock
+     */
+
+    ngx_spinlock(&staple->lock, 1, 2048);
+
     if (staple->staple.len
         && staple->valid >= ngx_time())
     {
@@ -477,6 +513,7 @@ ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn, void *data)
 
         p = OPENSSL_malloc(staple->staple.len);
         if (p == NULL) {
+            ngx_unlock(&staple->lock);
             ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "OPENSSL_malloc() failed");
             return SSL_TLSEXT_ERR_NOACK;
         }
@@ -488,12 +525,132 @@ ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn, void *data)
         rc = SSL_TLSEXT_ERR_OK;
     }
 
-    ngx_ssl_stapling_update(staple);
+    ngx_unlock(&staple->lock);
+
+    /* an update is started by ngx_ssl_stapling_refresh() instead */
+
+    if (!c->ssl->in_thread) {
+        ngx_ssl_stapling_update(staple);
+    }
 
     return rc;
 }
 
 
+ngx_int_t
+ngx_ssl_stapling_store(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *path)
+{
+    ngx_ssl_stapling_t  *staple;
+
+    staple = SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_stapling_index);
+
+    if (staple == NULL || staple->host.len == 0) {
+        return NGX_OK;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, path, 1) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    staple->store = *path;
+
+    /*
+     * a response saved by a previous run is used right away,
+     * so the first handshakes after start are stapled as well
+     */
+
+    if (ngx_ssl_stapling_load(staple, cf->log) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_uint_t           i;
+    ngx_event_t         *ev;
+    ngx_openssl_conf_t  *oscf;
+    ngx_ssl_stapling_t  **stp, *staple;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    oscf = (ngx_openssl_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                               ngx_openssl_module);
+
+    stp = oscf->staplings.elts;
+
+    for (i = 0; i < oscf->staplings.nelts; i++) {
+        staple = stp[i];
+
+        /*
+         * with a store, only the first worker queries the responder,
+         * others pick up the saved response
+         */
+
+        staple->fetcher = (staple->store.len == 0 || ngx_worker == 0);
+
+        ev = &staple->event;
+
+        ev->handler = ngx_ssl_stapling_timer_handler;
+        ev->data = staple;
+        ev->log = cycle->log;
+        ev->cancelable = 1;
+
+        ngx_add_timer(ev, 1);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_ssl_stapling_timer_handler(ngx_event_t *ev)
+{
+    ngx_ssl_stapling_t  *staple;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    staple = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "ssl stapling timer, fetcher: %d", staple->fetcher);
+
+    if (staple->fetcher) {
+        ngx_ssl_stapling_update(staple);
+
+    } else {
+        (void) ngx_ssl_stapling_load(staple, ev->log);
+    }
+
+    ngx_add_timer(ev, NGX_SSL_STAPLING_INTERVAL * 1000);
+}
+
+
+void
+ngx_ssl_stapling_refresh(ngx_connection_t *c)
+{
+    ngx_ssl_stapling_t  *staple;
+
+    staple = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(c->ssl->connection),
+                                 ngx_ssl_stapling_index);
+
+    if (staple == NULL) {
+        return;
+    }
+
+    ngx_ssl_stapling_update(staple);
+}
+
+
 static void
 ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple)
 {
@@ -505,6 +662,12 @@ ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple)
         return;
     }
 
+    /* the store is refreshed by the fetcher, unless it is late */
+
+    if (!staple->fetcher && staple->valid > ngx_time() + 60) {
+        return;
+    }
+
     staple->loading = 1;
 
     ctx = ngx_ssl_ocsp_start();
@@ -535,66 +698,109 @@ ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple)
 
 static void
 ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
+{
+    time_t               now, valid;
+    ngx_str_t            response;
+    ngx_ssl_stapling_t  *staple;
+
+    staple = ctx->data;
+    now = ngx_time();
+
+    if (ctx->code != 200) {
+        goto error;
+    }
+
+    /* check the response */
+
+    response.len = ctx->response->last - ctx->response->pos;
+    response.data = ctx->response->pos;
+
+    if (ngx_ssl_stapling_check(staple, &response, &valid, ctx->log) != NGX_OK) {
+        goto error;
+    }
+
+    /* copy the response to memory not in ctx->pool */
+
+    response.data = ngx_alloc(response.len, ctx->log);
+
+    if (response.data == NULL) {
+        goto error;
+    }
+
+    ngx_memcpy(response.data, ctx->response->pos, response.len);
+
+    ngx_ssl_stapling_set(staple, &response, valid);
+
+    if (staple->store.len) {
+        ngx_ssl_stapling_save(staple, ctx->log);
+    }
+
+    staple->loading = 0;
+
+    ngx_ssl_ocsp_done(ctx);
+    return;
+
+error:
+
+    staple->loading = 0;
+    staple->refresh = now + 300;
+
+    ngx_ssl_ocsp_done(ctx);
+}
+
+
+static ngx_int_t
+ngx_ssl_stapling_check(ngx_ssl_stapling_t *staple, ngx_str_t *response,
+    time_t *valid, ngx_log_t *log)
 {
 #if OPENSSL_VERSION_NUMBER >= 0x0090707fL
     const
 #endif
     u_char                *p;
     int                    n;
-    size_t                 len;
-    time_t                 now, valid;
-    ngx_str_t              response;
+    ngx_int_t              rc;
     X509_STORE            *store;
     STACK_OF(X509)        *chain;
     OCSP_CERTID           *id;
     OCSP_RESPONSE         *ocsp;
     OCSP_BASICRESP        *basic;
-    ngx_ssl_stapling_t    *staple;
     ASN1_GENERALIZEDTIME  *thisupdate, *nextupdate;
 
-    staple = ctx->data;
-    now = ngx_time();
+    rc = NGX_ERROR;
     ocsp = NULL;
     basic = NULL;
     id = NULL;
 
-    if (ctx->code != 200) {
-        goto error;
-    }
-
-    /* check the response */
+    p = response->data;
 
-    len = ctx->response->last - ctx->response->pos;
-    p = ctx->response->pos;
-
-    ocsp = d2i_OCSP_RESPONSE(NULL, &p, len);
+    ocsp = d2i_OCSP_RESPONSE(NULL, &p, response->len);
     if (ocsp == NULL) {
-        ngx_ssl_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
                       "d2i_OCSP_RESPONSE() failed");
-        goto error;
+        goto done;
     }
 
     n = OCSP_response_status(ocsp);
 
     if (n != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
-        ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_log_error(NGX_LOG_ERR, log, 0,
                       "OCSP response not successful (%d: %s)",
                       n, OCSP_response_status_str(n));
-        goto error;
+        goto done;
     }
 
     basic = OCSP_response_get1_basic(ocsp);
     if (basic == NULL) {
-        ngx_ssl_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
                       "OCSP_response_get1_basic() failed");
-        goto error;
+        goto done;
     }
 
     store = SSL_CTX_get_cert_store(staple->ssl_ctx);
     if (store == NULL) {
-        ngx_ssl_error(NGX_LOG_CRIT, ctx->log, 0,
+        ngx_ssl_error(NGX_LOG_CRIT, log, 0,
                       "SSL_CTX_get_cert_store() failed");
-        goto error;
+        goto done;
     }
 
 #if OPENSSL_VERSION_NUMBER >= 0x10001000L
@@ -607,111 +813,266 @@ ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
                           staple->verify ? OCSP_TRUSTOTHER : OCSP_NOVERIFY)
         != 1)
     {
-        ngx_ssl_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
                       "OCSP_basic_verify() failed");
-        goto error;
+        goto done;
     }
 
-    id = OCSP_cert_to_id(NULL, ctx->cert, ctx->issuer);
+    id = OCSP_cert_to_id(NULL, staple->cert, staple->issuer);
     if (id == NULL) {
-        ngx_ssl_error(NGX_LOG_CRIT, ctx->log, 0,
+        ngx_ssl_error(NGX_LOG_CRIT, log, 0,
                       "OCSP_cert_to_id() failed");
-        goto error;
+        goto done;
     }
 
     if (OCSP_resp_find_status(basic, id, &n, NULL, NULL,
                               &thisupdate, &nextupdate)
         != 1)
     {
-        ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_log_error(NGX_LOG_ERR, log, 0,
                       "certificate status not found in the OCSP response");
-        goto error;
+        goto done;
     }
 
     if (n != V_OCSP_CERTSTATUS_GOOD) {
-        ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_log_error(NGX_LOG_ERR, log, 0,
                       "certificate status \"%s\" in the OCSP response",
                       OCSP_cert_status_str(n));
-        goto error;
+        goto done;
     }
 
     if (OCSP_check_validity(thisupdate, nextupdate, 300, -1) != 1) {
-        ngx_ssl_error(NGX_LOG_ERR, ctx->log, 0,
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
                       "OCSP_check_validity() failed");
-        goto error;
+        goto done;
     }
 
     if (nextupdate) {
-        valid = ngx_ssl_stapling_time(nextupdate);
-        if (valid == (time_t) NGX_ERROR) {
-            ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
+        *valid = ngx_ssl_stapling_time(nextupdate);
+        if (*valid == (time_t) NGX_ERROR) {
+            ngx_log_error(NGX_LOG_ERR, log, 0,
                           "invalid nextUpdate time in certificate status");
-            goto error;
+            goto done;
         }
 
     } else {
-        valid = NGX_MAX_TIME_T_VALUE;
+        *valid = NGX_MAX_TIME_T_VALUE;
     }
 
-    OCSP_CERTID_free(id);
-    OCSP_BASICRESP_free(basic);
-    OCSP_RESPONSE_free(ocsp);
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "ssl ocsp response, %s, %uz",
+                   OCSP_cert_status_str(n), response->len);
 
-    id = NULL;
-    basic = NULL;
-    ocsp = NULL;
+    rc = NGX_OK;
 
-    /* copy the response to memory not in ctx->pool */
+done:
 
-    response.len = len;
-    response.data = ngx_alloc(response.len, ctx->log);
+    if (id) {
+        OCSP_CERTID_free(id);
+    }
 
-    if (response.data == NULL) {
-        goto error;
+    if (basic) {
+        OCSP_BASICRESP_free(basic);
     }
 
-    ngx_memcpy(response.data, ctx->response->pos, response.len);
+    if (ocsp) {
+        OCSP_RESPONSE_free(ocsp);
+    }
 
-    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ctx->log, 0,
-                   "ssl ocsp response, %s, %uz",
-                   OCSP_cert_status_str(n), response.len);
+    return rc;
+}
+
+
+static void
+ngx_ssl_stapling_set(ngx_ssl_stapling_t *staple, ngx_str_t *response,
+    time_t valid)
+{
+    time_t  now;
+
+    ngx_spinlock(&staple->lock, 1, 2048);
 
     if (staple->staple.data) {
         ngx_free(staple->staple.data);
     }
 
-    staple->staple = response;
+    staple->staple = *response;
     staple->valid = valid;
 
+    ngx_unlock(&staple->lock);
+
     /*
      * refresh before the response expires,
      * but not earlier than in 5 minutes, and at least in an hour
      */
 
-    staple->loading = 0;
+    now = ngx_time();
+
     staple->refresh = ngx_max(ngx_min(valid - 300, now + 3600), now + 300);
+}
 
-    ngx_ssl_ocsp_done(ctx);
-    return;
 
-error:
+static ngx_int_t
+ngx_ssl_stapling_load(ngx_ssl_stapling_t *staple, ngx_log_t *log)
+{
+    time_t            valid;
+    size_t            size;
+    ssize_t           n;
+    ngx_str_t         response;
+    ngx_file_t        file;
+    ngx_file_info_t   fi;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = staple->store;
+    file.log = log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDONLY, 0, 0);
+    if (file.fd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                          ngx_open_file_n " \"%V\" failed", &file.name);
+        }
 
-    staple->loading = 0;
-    staple->refresh = now + 300;
+        return NGX_DECLINED;
+    }
 
-    if (id) {
-        OCSP_CERTID_free(id);
+    response.data = NULL;
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%V\" failed", &file.name);
+        goto failed;
     }
 
-    if (basic) {
-        OCSP_BASICRESP_free(basic);
+    if (ngx_file_mtime(&fi) == staple->mtime) {
+        goto failed;
     }
 
-    if (ocsp) {
-        OCSP_RESPONSE_free(ocsp);
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size == 0 || size > NGX_SSL_STAPLING_MAX_SIZE) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "invalid OCSP response size in \"%V\"", &file.name);
+        goto failed;
     }
 
-    ngx_ssl_ocsp_done(ctx);
+    response.data = ngx_alloc(size, log);
+    if (response.data == NULL) {
+        goto failed;
+    }
+
+    n = ngx_read_file(&file, response.data, size, 0);
+
+    if (n == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_read_file_n " \"%V\" failed", &file.name);
+        goto failed;
+    }
+
+    if ((size_t) n != size) {
+        ngx_log_error(NGX_LOG_CRIT, log, 0,
+                      ngx_read_file_n " \"%V\" returned only "
+                      "%z bytes instead of %uz", &file.name, n, size);
+        goto failed;
+    }
+
+    response.len = size;
+
+    staple->mtime = ngx_file_mtime(&fi);
+
+    if (ngx_ssl_stapling_check(staple, &response, &valid, log) != NGX_OK) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "OCSP response in \"%V\" ignored", &file.name);
+        goto failed;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "ssl ocsp response loaded from \"%V\"", &file.name);
+
+    ngx_ssl_stapling_set(staple, &response, valid);
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &file.name);
+    }
+
+    return NGX_OK;
+
+failed:
+
+    if (response.data) {
+        ngx_free(response.data);
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &file.name);
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_ssl_stapling_save(ngx_ssl_stapling_t *staple, ngx_log_t *log)
+{
+    u_char      *temp;
+    ssize_t      n;
+    ngx_fd_t     fd;
+    ngx_str_t   *name;
+
+    /* the response is written to a temporary file and renamed atomically */
+
+    name = &staple->store;
+
+    temp = ngx_alloc(name->len + 1 + NGX_INT64_LEN + 1, log);
+    if (temp == NULL) {
+        return;
+    }
+
+    (void) ngx_sprintf(temp, "%V.%P%Z", name, ngx_pid);
+
+    fd = ngx_open_file(temp, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                       NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", temp);
+        goto done;
+    }
+
+    n = ngx_write_fd(fd, staple->staple.data, staple->staple.len);
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp);
+    }
+
+    if (n != (ssize_t) staple->staple.len) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_write_fd_n " to \"%s\" failed", temp);
+
+        if (ngx_delete_file(temp) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", temp);
+        }
+
+        goto done;
+    }
+
+    if (ngx_rename_file(temp, name->data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%V\" failed",
+                      temp, name);
+
+        if (ngx_delete_file(temp) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", temp);
+        }
+    }
+
+done:
+
+    ngx_free(temp);
 }
 
 
@@ -1827,4 +2188,24 @@ ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
 }
 
 
+ngx_int_t
+ngx_ssl_stapling_store(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *path)
+{
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_init_worker(ngx_cycle_t *cycle)
+{
+    return NGX_OK;
+}
+
+
+void
+ngx_ssl_stapling_refresh(ngx_connection_t *c)
+{
+}
+
+
 #endif
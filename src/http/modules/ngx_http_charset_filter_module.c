@@ -22,6 +22,7 @@
 
 typedef struct {
     u_char                    **tables;
+    u_char                     *ascii;
     ngx_str_t                   name;
 
     unsigned                    length:16;
@@ -75,6 +76,7 @@ typedef struct {
     unsigned                    length:16;
     unsigned                    from_utf8:1;
     unsigned                    to_utf8:1;
+    unsigned                    ascii:1;
 } ngx_http_charset_ctx_t;
 
 
@@ -96,12 +98,15 @@ static ngx_inline void ngx_http_set_charset(ngx_http_request_t *r,
     ngx_str_t *charset);
 static ngx_int_t ngx_http_charset_ctx(ngx_http_request_t *r,
     ngx_http_charset_t *charsets, ngx_int_t charset, ngx_int_t source_charset);
-static ngx_uint_t ngx_http_charset_recode(ngx_buf_t *b, u_char *table);
+static ngx_uint_t ngx_http_charset_recode(ngx_buf_t *b, u_char *table,
+    ngx_uint_t ascii);
 static ngx_chain_t *ngx_http_charset_recode_from_utf8(ngx_pool_t *pool,
     ngx_buf_t *buf, ngx_http_charset_ctx_t *ctx);
 static ngx_chain_t *ngx_http_charset_recode_to_utf8(ngx_pool_t *pool,
     ngx_buf_t *buf, ngx_http_charset_ctx_t *ctx);
 
+static ngx_uint_t ngx_http_charset_ascii_table(u_char *table, ngx_uint_t utf8,
+    ngx_uint_t from_utf8);
 static ngx_chain_t *ngx_http_charset_get_buf(ngx_pool_t *pool,
     ngx_http_charset_ctx_t *ctx);
 static ngx_chain_t *ngx_http_charset_get_buffer(ngx_pool_t *pool,
@@ -529,6 +534,7 @@ ngx_http_charset_ctx(ngx_http_request_t *r, ngx_http_charset_t *charsets,
     ctx->length = charsets[charset].length;
     ctx->from_utf8 = charsets[source_charset].utf8;
     ctx->to_utf8 = charsets[charset].utf8;
+    ctx->ascii = charsets[source_charset].ascii[charset];
 
     r->filter_need_in_memory = 1;
 
@@ -641,15 +647,43 @@ ngx_http_charset_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     }
 
     for (cl = in; cl; cl = cl->next) {
-        (void) ngx_http_charset_recode(cl->buf, ctx->table);
+        (void) ngx_http_charset_recode(cl->buf, ctx->table, ctx->ascii);
     }
 
     return ngx_http_next_body_filter(r, in);
 }
 
 
+/*
+ * returns the first byte that is not ASCII, testing 8 bytes at once;
+ * most of the legacy encoded pages are markup and spaces
+ */
+
+static ngx_inline u_char *
+ngx_http_charset_skip_ascii(u_char *p, u_char *last)
+{
+    uint32_t  w[2];
+
+    while (last - p >= 8) {
+        ngx_memcpy(w, p, 8);
+
+        if ((w[0] | w[1]) & 0x80808080) {
+            break;
+        }
+
+        p += 8;
+    }
+
+    while (p < last && *p < 0x80) {
+        p++;
+    }
+
+    return p;
+}
+
+
 static ngx_uint_t
-ngx_http_charset_recode(ngx_buf_t *b, u_char *table)
+ngx_http_charset_recode(ngx_buf_t *b, u_char *table, ngx_uint_t ascii)
 {
     u_char  *p, *last;
 
@@ -657,6 +691,14 @@ ngx_http_charset_recode(ngx_buf_t *b, u_char *table)
 
     for (p = b->pos; p < last; p++) {
 
+        if (ascii) {
+            p = ngx_http_charset_skip_ascii(p, last);
+
+            if (p == last) {
+                break;
+            }
+        }
+
         if (*p != table[*p]) {
             goto recode;
         }
@@ -667,6 +709,11 @@ ngx_http_charset_recode(ngx_buf_t *b, u_char *table)
 recode:
 
     do {
+        if (ascii && *p < 0x80) {
+            p = ngx_http_charset_skip_ascii(p, last);
+            continue;
+        }
+
         if (*p != table[*p]) {
             *p = table[*p];
         }
@@ -698,8 +745,10 @@ ngx_http_charset_recode_from_utf8(ngx_pool_t *pool, ngx_buf_t *buf,
 
         for ( /* void */ ; src < buf->last; src++) {
 
-            if (*src < 0x80) {
-                continue;
+            src = ngx_http_charset_skip_ascii(src, buf->last);
+
+            if (src == buf->last) {
+                break;
             }
 
             len = src - buf->pos;
@@ -896,13 +945,29 @@ recode:
         }
 
         if (*src < 0x80) {
-            *dst++ = *src++;
+            len = ngx_min(buf->last - src, b->end - dst);
+
+            p = ngx_http_charset_skip_ascii(src, src + len);
+
+            dst = ngx_cpymem(dst, src, p - src);
+            src = p;
+
             continue;
         }
 
         len = buf->last - src;
 
-        n = ngx_utf8_decode(&src, len);
+        /* two byte sequences are the most frequent ones, Cyrillic et al. */
+
+        if (src[0] >= 0xc2 && src[0] < 0xe0
+            && len > 1 && (src[1] & 0xc0) == 0x80)
+        {
+            n = ((src[0] & 0x1f) << 6) | (src[1] & 0x3f);
+            src += 2;
+
+        } else {
+            n = ngx_utf8_decode(&src, len);
+        }
 
         if (n < 0x10000) {
 
@@ -974,6 +1039,15 @@ ngx_http_charset_recode_to_utf8(ngx_pool_t *pool, ngx_buf_t *buf,
     table = ctx->table;
 
     for (src = buf->pos; src < buf->last; src++) {
+
+        if (ctx->ascii) {
+            src = ngx_http_charset_skip_ascii(src, buf->last);
+
+            if (src == buf->last) {
+                break;
+            }
+        }
+
         if (table[*src * NGX_UTF_LEN] == '\1') {
             continue;
         }
@@ -1050,6 +1124,19 @@ recode:
 
     while (src < buf->last) {
 
+        if (ctx->ascii && *src < 0x80) {
+            len = ngx_min(buf->last - src, b->end - dst);
+
+            if (len) {
+                p = ngx_http_charset_skip_ascii(src, src + len);
+
+                dst = ngx_cpymem(dst, src, p - src);
+                src = p;
+
+                continue;
+            }
+        }
+
         p = &table[*src++ * NGX_UTF_LEN];
         len = *p++;
 
@@ -1089,6 +1176,45 @@ recode:
 }
 
 
+static ngx_uint_t
+ngx_http_charset_ascii_table(u_char *table, ngx_uint_t utf8,
+    ngx_uint_t from_utf8)
+{
+    u_char      *p;
+    ngx_uint_t   i;
+
+    /* whether the table keeps ASCII as is, it may be remapped by charset_map */
+
+    if (utf8 && from_utf8) {
+        p = ((u_char **) table)[0];
+
+        for (i = 0; i < 0x80; i++) {
+            if (p == NULL || p[i] != i) {
+                return 0;
+            }
+        }
+
+        return 1;
+    }
+
+    for (i = 0; i < 0x80; i++) {
+
+        if (utf8) {
+            p = &table[i * NGX_UTF_LEN];
+
+            if (p[0] != '\1' || p[1] != i) {
+                return 0;
+            }
+
+        } else if (table[i] != i) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
 static ngx_chain_t *
 ngx_http_charset_get_buf(ngx_pool_t *pool, ngx_http_charset_ctx_t *ctx)
 {
@@ -1472,6 +1598,7 @@ ngx_http_add_charset(ngx_array_t *charsets, ngx_str_t *name)
     }
 
     c->tables = NULL;
+    c->ascii = NULL;
     c->name = *name;
     c->length = 0;
 
@@ -1609,7 +1736,7 @@ ngx_http_charset_postconfiguration(ngx_conf_t *cf)
 {
     u_char                       **src, **dst;
     ngx_int_t                      c;
-    ngx_uint_t                     i, t;
+    ngx_uint_t                     i, t, utf8;
     ngx_http_charset_t            *charset;
     ngx_http_charset_recode_t     *recode;
     ngx_http_charset_tables_t     *tables;
@@ -1658,6 +1785,12 @@ ngx_http_charset_postconfiguration(ngx_conf_t *cf)
             }
 
             charset[tables[t].src].tables = src;
+
+            charset[tables[t].src].ascii = ngx_pcalloc(cf->pool,
+                                                       mcf->charsets.nelts);
+            if (charset[tables[t].src].ascii == NULL) {
+                return NGX_ERROR;
+            }
         }
 
         dst = charset[tables[t].dst].tables;
@@ -1669,10 +1802,23 @@ ngx_http_charset_postconfiguration(ngx_conf_t *cf)
             }
 
             charset[tables[t].dst].tables = dst;
+
+            charset[tables[t].dst].ascii = ngx_pcalloc(cf->pool,
+                                                       mcf->charsets.nelts);
+            if (charset[tables[t].dst].ascii == NULL) {
+                return NGX_ERROR;
+            }
         }
 
         src[tables[t].dst] = tables[t].src2dst;
         dst[tables[t].src] = tables[t].dst2src;
+
+        utf8 = charset[tables[t].dst].utf8;
+
+        charset[tables[t].src].ascii[tables[t].dst] =
+                ngx_http_charset_ascii_table(tables[t].src2dst, utf8, 0);
+        charset[tables[t].dst].ascii[tables[t].src] =
+                ngx_http_charset_ascii_table(tables[t].dst2src, utf8, 1);
     }
 
     ngx_http_next_header_filter = ngx_http_top_header_filter;
@@ -18,9 +18,9 @@ typedef struct {
 
 
 typedef struct {
-    ngx_radix_tree_t                *tree;
+    ngx_prefix_tree_t                *tree;
 #if (NGX_HAVE_INET6)
-    ngx_radix_tree_t                *tree6;
+    ngx_prefix_tree_t                *tree6;
 #endif
 } ngx_http_geo_trees_t;
 
@@ -31,6 +31,32 @@ typedef struct {
 } ngx_http_geo_high_ranges_t;
 
 
+/*
+ * the compiled CIDR base: a multibit trie with a 16-bit first level and
+ * 4-bit levels below it, so a node of the next level fits in a cache line;
+ * an entry is either a value index or, with the high bit set, an index
+ * of a node of the next level
+ */
+
+#define NGX_HTTP_GEO_TRIE_NODE       0x80000000
+#define NGX_HTTP_GEO_TRIE_STRIDE     4
+#define NGX_HTTP_GEO_TRIE_SIZE       (1 << NGX_HTTP_GEO_TRIE_STRIDE)
+
+typedef struct {
+    u_char                          *strings;
+    uint32_t                        *values;
+    uint32_t                        *trie;
+    uint32_t                        *trie6;
+} ngx_http_geo_trie_t;
+
+
+typedef struct {
+    uint32_t                        *key;
+    ngx_uint_t                       len;
+    uintptr_t                        value;
+} ngx_http_geo_trie_entry_t;
+
+
 typedef struct {
     ngx_str_node_t                   sn;
     ngx_http_variable_value_t       *value;
@@ -38,14 +64,24 @@ typedef struct {
 } ngx_http_geo_variable_value_node_t;
 
 
+typedef struct {
+    ngx_array_t                      refresh;
+} ngx_http_geo_main_conf_t;
+
+
 typedef struct {
     ngx_http_variable_value_t       *value;
     ngx_str_t                       *net;
     ngx_http_geo_high_ranges_t       high;
-    ngx_radix_tree_t                *tree;
+    ngx_prefix_tree_t                *tree;
 #if (NGX_HAVE_INET6)
-    ngx_radix_tree_t                *tree6;
+    ngx_prefix_tree_t                *tree6;
 #endif
+    ngx_http_geo_trie_t              trie;
+    ngx_file_mapping_t              *base;
+    ngx_file_uniq_t                  uniq;
+    time_t                           mtime;
+    ngx_msec_t                       refresh;
     ngx_rbtree_t                     rbtree;
     ngx_rbtree_node_t                sentinel;
     ngx_array_t                     *proxies;
@@ -70,12 +106,18 @@ typedef struct {
     union {
         ngx_http_geo_trees_t         trees;
         ngx_http_geo_high_ranges_t   high;
+        ngx_http_geo_trie_t          trie;
     } u;
 
     ngx_array_t                     *proxies;
     unsigned                         proxy_recursive:1;
 
     ngx_int_t                        index;
+
+    ngx_file_mapping_t              *base;
+    ngx_file_uniq_t                  uniq;
+    time_t                           mtime;
+    ngx_msec_t                       refresh;
 } ngx_http_geo_ctx_t;
 
 
@@ -108,6 +150,28 @@ static ngx_int_t ngx_http_geo_include_binary_base(ngx_conf_t *cf,
 static void ngx_http_geo_create_binary_base(ngx_http_geo_conf_ctx_t *ctx);
 static u_char *ngx_http_geo_copy_values(u_char *base, u_char *p,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_geo_include_trie_base(ngx_conf_t *cf,
+    ngx_http_geo_conf_ctx_t *ctx, ngx_str_t *name);
+static ngx_int_t ngx_http_geo_trie_open(ngx_file_mapping_t *fm,
+    ngx_http_geo_trie_t *trie);
+static ngx_int_t ngx_http_geo_trie_valid(uint32_t *trie, uint32_t nodes,
+    uint32_t nvalues);
+static void ngx_http_geo_trie_cleanup(void *data);
+static void *ngx_http_geo_create_main_conf(ngx_conf_t *cf);
+static ngx_int_t ngx_http_geo_init_process(ngx_cycle_t *cycle);
+static void ngx_http_geo_refresh_handler(ngx_event_t *ev);
+static void ngx_http_geo_create_trie_base(ngx_http_geo_conf_ctx_t *ctx);
+static ngx_int_t ngx_http_geo_trie_build(ngx_http_geo_conf_ctx_t *ctx,
+    ngx_array_t *trie, ngx_prefix_tree_t *tree);
+static ngx_int_t ngx_http_geo_trie_collect(void *data, uint32_t *key,
+    ngx_uint_t len, uintptr_t value);
+static ngx_int_t ngx_http_geo_trie_add(ngx_array_t *trie, uint32_t *key,
+    ngx_uint_t len, uint32_t value);
+static void ngx_http_geo_trie_index_values(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel, uint32_t *n, size_t *size);
+static void ngx_http_geo_trie_copy_values(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel, uint32_t *values, u_char *strings,
+    uint32_t *offset);
 
 
 static ngx_command_t  ngx_http_geo_commands[] = {
@@ -127,7 +191,7 @@ static ngx_http_module_t  ngx_http_geo_module_ctx = {
     NULL,                                  /* preconfiguration */
     NULL,                                  /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
+    ngx_http_geo_create_main_conf,         /* create main configuration */
     NULL,                                  /* init main configuration */
 
     NULL,                                  /* create server configuration */
@@ -145,7 +209,7 @@ ngx_module_t  ngx_http_geo_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_geo_init_process,             /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -168,6 +232,20 @@ static ngx_http_geo_header_t  ngx_http_geo_header = {
 };
 
 
+typedef struct {
+    ngx_http_geo_header_t            header;
+    uint32_t                         values;
+    uint32_t                         nodes;
+    uint32_t                         nodes6;
+    uint32_t                         size;
+} ngx_http_geo_trie_header_t;
+
+
+static ngx_http_geo_header_t  ngx_http_geo_trie_header = {
+    { 'G', 'E', 'O', 'T', 'R', 'I' }, 0, 0, 0x12345678, 0
+};
+
+
 /* geo range is AF_INET only */
 
 static ngx_int_t
@@ -187,7 +265,7 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 
     if (ngx_http_geo_addr(r, ctx, &addr) != NGX_OK) {
         vv = (ngx_http_variable_value_t *)
-                  ngx_radix32tree_find(ctx->u.trees.tree, INADDR_NONE);
+                  ngx_prefix32tree_find(ctx->u.trees.tree, INADDR_NONE);
         goto done;
     }
 
@@ -205,11 +283,11 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
             inaddr += p[15];
 
             vv = (ngx_http_variable_value_t *)
-                      ngx_radix32tree_find(ctx->u.trees.tree, inaddr);
+                      ngx_prefix32tree_find(ctx->u.trees.tree, inaddr);
 
         } else {
             vv = (ngx_http_variable_value_t *)
-                      ngx_radix128tree_find(ctx->u.trees.tree6, p);
+                      ngx_prefix128tree_find(ctx->u.trees.tree6, p);
         }
 
         break;
@@ -220,7 +298,7 @@ ngx_http_geo_cidr_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
         inaddr = ntohl(sin->sin_addr.s_addr);
 
         vv = (ngx_http_variable_value_t *)
-                  ngx_radix32tree_find(ctx->u.trees.tree, inaddr);
+                  ngx_prefix32tree_find(ctx->u.trees.tree, inaddr);
 
         break;
     }
@@ -236,6 +314,100 @@ done:
 }
 
 
+static ngx_inline uint32_t
+ngx_http_geo_trie_find(uint32_t *trie, u_char *key, ngx_uint_t len)
+{
+    uint32_t    n;
+    ngx_uint_t  i;
+
+    n = trie[(key[0] << 8) + key[1]];
+
+    /* len is in nibbles, the first level takes four of them */
+
+    for (i = 4; i < len && (n & NGX_HTTP_GEO_TRIE_NODE); i++) {
+        n = trie[0x10000
+                 + (n & ~NGX_HTTP_GEO_TRIE_NODE) * NGX_HTTP_GEO_TRIE_SIZE
+                 + ((key[i >> 1] >> ((i & 1) ? 0 : 4)) & 0x0f)];
+    }
+
+    return (n & NGX_HTTP_GEO_TRIE_NODE) ? 0 : n;
+}
+
+
+static ngx_int_t
+ngx_http_geo_trie_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
+    uintptr_t data)
+{
+    ngx_http_geo_ctx_t *ctx = (ngx_http_geo_ctx_t *) data;
+
+    u_char               *p;
+    uint32_t              n;
+    ngx_addr_t            addr;
+    struct sockaddr_in   *sin;
+    ngx_http_geo_trie_t  *trie;
+#if (NGX_HAVE_INET6)
+    struct in6_addr      *inaddr6;
+#endif
+    static u_char         none[] = { 0xff, 0xff, 0xff, 0xff };
+
+    trie = &ctx->u.trie;
+
+    if (ngx_http_geo_addr(r, ctx, &addr) != NGX_OK) {
+        n = ngx_http_geo_trie_find(trie->trie, none, 8);
+        goto done;
+    }
+
+    switch (addr.sockaddr->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        inaddr6 = &((struct sockaddr_in6 *) addr.sockaddr)->sin6_addr;
+        p = inaddr6->s6_addr;
+
+        if (IN6_IS_ADDR_V4MAPPED(inaddr6)) {
+            n = ngx_http_geo_trie_find(trie->trie, &p[12], 8);
+
+        } else {
+            n = ngx_http_geo_trie_find(trie->trie6, p, 32);
+        }
+
+        break;
+#endif
+
+    default: /* AF_INET */
+        sin = (struct sockaddr_in *) addr.sockaddr;
+        p = (u_char *) &sin->sin_addr.s_addr;
+
+        n = ngx_http_geo_trie_find(trie->trie, p, 8);
+
+        break;
+    }
+
+done:
+
+    v->len = trie->values[n * 2 + 1];
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = trie->strings + trie->values[n * 2];
+
+    if (ctx->refresh) {
+        p = ngx_pnalloc(r->pool, v->len);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(p, v->data, v->len);
+        v->data = p;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http geo: %v", v);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_geo_range_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
     uintptr_t data)
@@ -368,9 +540,32 @@ ngx_http_geo_real_addr(ngx_http_request_t *r, ngx_http_geo_ctx_t *ctx,
 }
 
 
+static void *
+ngx_http_geo_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_geo_main_conf_t  *gmcf;
+
+    gmcf = ngx_palloc(cf->pool, sizeof(ngx_http_geo_main_conf_t));
+    if (gmcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&gmcf->refresh, cf->pool, 1,
+                       sizeof(ngx_http_geo_ctx_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return gmcf;
+}
+
+
 static char *
 ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
+    ngx_http_geo_main_conf_t *gmcf = conf;
+
     char                     *rv;
     size_t                    len;
     ngx_str_t                *value, name;
@@ -379,7 +574,7 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_pool_t               *pool;
     ngx_array_t              *a;
     ngx_http_variable_t      *var;
-    ngx_http_geo_ctx_t       *geo;
+    ngx_http_geo_ctx_t       *geo, **g;
     ngx_http_geo_conf_ctx_t   ctx;
 #if (NGX_HAVE_INET6)
     static struct in6_addr    zero;
@@ -462,6 +657,55 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     geo->proxies = ctx.proxies;
     geo->proxy_recursive = ctx.proxy_recursive;
+    geo->refresh = 0;
+
+    if (ctx.refresh && rv == NGX_CONF_OK) {
+
+        if (ctx.ranges) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"refresh\" cannot be used with \"ranges\"");
+            return NGX_CONF_ERROR;
+        }
+
+        if (!ctx.binary_include) {
+
+            if (!ctx.allow_binary_include
+                || ctx.outside_entries
+                || ctx.includes != 1)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"refresh\" requires the only \"include\" "
+                                   "without other entries");
+                return NGX_CONF_ERROR;
+            }
+
+            ngx_http_geo_create_trie_base(&ctx);
+
+            name.len = ctx.include_name.len + 4;
+            name.data = ngx_pnalloc(ctx.temp_pool, name.len + 1);
+            if (name.data == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            ngx_sprintf(name.data, "%V.bin%Z", &ctx.include_name);
+
+            if (ngx_http_geo_include_trie_base(cf, &ctx, &name) != NGX_OK) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "cannot use binary geo base \"%s\"",
+                                   name.data);
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        geo->refresh = ctx.refresh;
+
+        g = ngx_array_push(&gmcf->refresh);
+        if (g == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *g = geo;
+    }
 
     if (ctx.ranges) {
 
@@ -506,9 +750,22 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         ngx_destroy_pool(ctx.temp_pool);
         ngx_destroy_pool(pool);
 
+    } else if (ctx.binary_include) {
+
+        geo->u.trie = ctx.trie;
+        geo->base = ctx.base;
+        geo->uniq = ctx.uniq;
+        geo->mtime = ctx.mtime;
+
+        var->get_handler = ngx_http_geo_trie_variable;
+        var->data = (uintptr_t) geo;
+
+        ngx_destroy_pool(ctx.temp_pool);
+        ngx_destroy_pool(pool);
+
     } else {
         if (ctx.tree == NULL) {
-            ctx.tree = ngx_radix_tree_create(cf->pool, -1);
+            ctx.tree = ngx_prefix_tree_create(cf->pool, 32);
             if (ctx.tree == NULL) {
                 return NGX_CONF_ERROR;
             }
@@ -518,7 +775,7 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
 #if (NGX_HAVE_INET6)
         if (ctx.tree6 == NULL) {
-            ctx.tree6 = ngx_radix_tree_create(cf->pool, -1);
+            ctx.tree6 = ngx_prefix_tree_create(cf->pool, 128);
             if (ctx.tree6 == NULL) {
                 return NGX_CONF_ERROR;
             }
@@ -530,10 +787,18 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         var->get_handler = ngx_http_geo_cidr_variable;
         var->data = (uintptr_t) geo;
 
+        if (ctx.allow_binary_include
+            && !ctx.outside_entries
+            && ctx.entries > 100000
+            && ctx.includes == 1)
+        {
+            ngx_http_geo_create_trie_base(&ctx);
+        }
+
         ngx_destroy_pool(ctx.temp_pool);
         ngx_destroy_pool(pool);
 
-        if (ngx_radix32tree_insert(ctx.tree, 0, 0,
+        if (ngx_prefix32tree_insert(ctx.tree, 0, 0,
                                    (uintptr_t) &ngx_http_variable_null_value)
             == NGX_ERROR)
         {
@@ -543,7 +808,7 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         /* NGX_BUSY is okay (default was set explicitly) */
 
 #if (NGX_HAVE_INET6)
-        if (ngx_radix128tree_insert(ctx.tree6, zero.s6_addr, zero.s6_addr,
+        if (ngx_prefix128tree_insert(ctx.tree6, zero.s6_addr, zero.s6_addr,
                                     (uintptr_t) &ngx_http_variable_null_value)
             == NGX_ERROR)
         {
@@ -618,6 +883,20 @@ ngx_http_geo(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
 
         rv = ngx_http_geo_add_proxy(cf, ctx, &cidr);
 
+        goto done;
+
+    } else if (ngx_strcmp(value[0].data, "refresh") == 0) {
+
+        ctx->refresh = ngx_parse_time(&value[1], 0);
+
+        if (ctx->refresh == (ngx_msec_t) NGX_ERROR || ctx->refresh == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid refresh time \"%V\"", &value[1]);
+            goto failed;
+        }
+
+        rv = NGX_CONF_OK;
+
         goto done;
     }
 
@@ -1020,8 +1299,15 @@ ngx_http_geo_cidr(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_str_t   *net;
     ngx_cidr_t   cidr;
 
+    if (ctx->binary_include) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+            "binary geo base \"%s\" cannot be mixed with usual entries",
+            ctx->include_name.data);
+        return NGX_CONF_ERROR;
+    }
+
     if (ctx->tree == NULL) {
-        ctx->tree = ngx_radix_tree_create(ctx->pool, -1);
+        ctx->tree = ngx_prefix_tree_create(ctx->pool, 32);
         if (ctx->tree == NULL) {
             return NGX_CONF_ERROR;
         }
@@ -1029,13 +1315,16 @@ ngx_http_geo_cidr(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
 
 #if (NGX_HAVE_INET6)
     if (ctx->tree6 == NULL) {
-        ctx->tree6 = ngx_radix_tree_create(ctx->pool, -1);
+        ctx->tree6 = ngx_prefix_tree_create(ctx->pool, 128);
         if (ctx->tree6 == NULL) {
             return NGX_CONF_ERROR;
         }
     }
 #endif
 
+    ctx->entries++;
+    ctx->outside_entries = 1;
+
     if (ngx_strcmp(value[0].data, "default") == 0) {
         cidr.family = AF_INET;
         cidr.u.in.addr = 0;
@@ -1084,14 +1373,14 @@ ngx_http_geo_cidr(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
 
 #if (NGX_HAVE_INET6)
         case AF_INET6:
-            rc = ngx_radix128tree_delete(ctx->tree6,
+            rc = ngx_prefix128tree_delete(ctx->tree6,
                                          cidr.u.in6.addr.s6_addr,
                                          cidr.u.in6.mask.s6_addr);
             break;
 #endif
 
         default: /* AF_INET */
-            rc = ngx_radix32tree_delete(ctx->tree, cidr.u.in.addr,
+            rc = ngx_prefix32tree_delete(ctx->tree, cidr.u.in.addr,
                                         cidr.u.in.mask);
             break;
         }
@@ -1125,7 +1414,7 @@ ngx_http_geo_cidr_add(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
 
 #if (NGX_HAVE_INET6)
     case AF_INET6:
-        rc = ngx_radix128tree_insert(ctx->tree6, cidr->u.in6.addr.s6_addr,
+        rc = ngx_prefix128tree_insert(ctx->tree6, cidr->u.in6.addr.s6_addr,
                                      cidr->u.in6.mask.s6_addr,
                                      (uintptr_t) val);
 
@@ -1140,23 +1429,23 @@ ngx_http_geo_cidr_add(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
         /* rc == NGX_BUSY */
 
         old = (ngx_http_variable_value_t *)
-                   ngx_radix128tree_find(ctx->tree6,
+                   ngx_prefix128tree_find(ctx->tree6,
                                          cidr->u.in6.addr.s6_addr);
 
         ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
               "duplicate network \"%V\", value: \"%v\", old value: \"%v\"",
               net, val, old);
 
-        rc = ngx_radix128tree_delete(ctx->tree6,
+        rc = ngx_prefix128tree_delete(ctx->tree6,
                                      cidr->u.in6.addr.s6_addr,
                                      cidr->u.in6.mask.s6_addr);
 
         if (rc == NGX_ERROR) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid radix tree");
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid prefix tree");
             return NGX_CONF_ERROR;
         }
 
-        rc = ngx_radix128tree_insert(ctx->tree6, cidr->u.in6.addr.s6_addr,
+        rc = ngx_prefix128tree_insert(ctx->tree6, cidr->u.in6.addr.s6_addr,
                                      cidr->u.in6.mask.s6_addr,
                                      (uintptr_t) val);
 
@@ -1164,7 +1453,7 @@ ngx_http_geo_cidr_add(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
 #endif
 
     default: /* AF_INET */
-        rc = ngx_radix32tree_insert(ctx->tree, cidr->u.in.addr,
+        rc = ngx_prefix32tree_insert(ctx->tree, cidr->u.in.addr,
                                     cidr->u.in.mask, (uintptr_t) val);
 
         if (rc == NGX_OK) {
@@ -1178,21 +1467,21 @@ ngx_http_geo_cidr_add(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
         /* rc == NGX_BUSY */
 
         old = (ngx_http_variable_value_t *)
-                   ngx_radix32tree_find(ctx->tree, cidr->u.in.addr);
+                   ngx_prefix32tree_find(ctx->tree, cidr->u.in.addr);
 
         ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
               "duplicate network \"%V\", value: \"%v\", old value: \"%v\"",
               net, val, old);
 
-        rc = ngx_radix32tree_delete(ctx->tree,
+        rc = ngx_prefix32tree_delete(ctx->tree,
                                     cidr->u.in.addr, cidr->u.in.mask);
 
         if (rc == NGX_ERROR) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid radix tree");
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid prefix tree");
             return NGX_CONF_ERROR;
         }
 
-        rc = ngx_radix32tree_insert(ctx->tree, cidr->u.in.addr,
+        rc = ngx_prefix32tree_insert(ctx->tree, cidr->u.in.addr,
                                     cidr->u.in.mask, (uintptr_t) val);
 
         break;
@@ -1317,6 +1606,7 @@ ngx_http_geo_include(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
     ngx_str_t *name)
 {
     char       *rv;
+    ngx_int_t   rc;
     ngx_str_t   file;
 
     file.len = name->len + 4;
@@ -1331,17 +1621,22 @@ ngx_http_geo_include(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
         return NGX_CONF_ERROR;
     }
 
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, cf->log, 0, "include %s", file.data);
+
     if (ctx->ranges) {
-        ngx_log_debug1(NGX_LOG_DEBUG_CORE, cf->log, 0, "include %s", file.data);
+        rc = ngx_http_geo_include_binary_base(cf, ctx, &file);
 
-        switch (ngx_http_geo_include_binary_base(cf, ctx, &file)) {
-        case NGX_OK:
-            return NGX_CONF_OK;
-        case NGX_ERROR:
-            return NGX_CONF_ERROR;
-        default:
-            break;
-        }
+    } else {
+        rc = ngx_http_geo_include_trie_base(cf, ctx, &file);
+    }
+
+    switch (rc) {
+    case NGX_OK:
+        return NGX_CONF_OK;
+    case NGX_ERROR:
+        return NGX_CONF_ERROR;
+    default:
+        break;
     }
 
     file.len -= 4;
@@ -1642,3 +1937,635 @@ ngx_http_geo_copy_values(u_char *base, u_char *p, ngx_rbtree_node_t *node,
 
     return ngx_http_geo_copy_values(base, p, node->right, sentinel);
 }
+
+
+static ngx_int_t
+ngx_http_geo_include_trie_base(ngx_conf_t *cf, ngx_http_geo_conf_ctx_t *ctx,
+    ngx_str_t *name)
+{
+    u_char               ch;
+    time_t               mtime;
+    ngx_int_t            rc;
+    ngx_file_info_t      fi;
+    ngx_file_uniq_t      uniq;
+    ngx_pool_cleanup_t  *cln;
+    ngx_file_mapping_t  *fm;
+    ngx_http_geo_trie_t  trie;
+
+    fm = ngx_palloc(ctx->pool, sizeof(ngx_file_mapping_t));
+    if (fm == NULL) {
+        return NGX_ERROR;
+    }
+
+    fm->name = ngx_pnalloc(ctx->pool, name->len + 1);
+    if (fm->name == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_cpystrn(fm->name, name->data, name->len + 1);
+    fm->log = cf->log;
+
+    if (ngx_open_file_mapping(fm) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    if (ctx->outside_entries) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+            "binary geo base \"%s\" cannot be mixed with usual entries",
+            name->data);
+        rc = NGX_ERROR;
+        goto failed;
+    }
+
+    if (ctx->binary_include) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+            "second binary geo base \"%s\" cannot be mixed with \"%s\"",
+            name->data, ctx->include_name.data);
+        rc = NGX_ERROR;
+        goto failed;
+    }
+
+    rc = NGX_DECLINED;
+
+    if (ngx_fd_info(fm->fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
+                           ngx_fd_info_n " \"%s\" failed", name->data);
+        goto failed;
+    }
+
+    mtime = ngx_file_mtime(&fi);
+    uniq = ngx_file_uniq(&fi);
+
+    ch = name->data[name->len - 4];
+    name->data[name->len - 4] = '\0';
+
+    if (ngx_file_info(name->data, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
+                           ngx_file_info_n " \"%s\" failed", name->data);
+        name->data[name->len - 4] = ch;
+        goto failed;
+    }
+
+    name->data[name->len - 4] = ch;
+
+    if (mtime < ngx_file_mtime(&fi)) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "stale binary geo base \"%s\"", name->data);
+        goto failed;
+    }
+
+    if (ngx_http_geo_trie_open(fm, &trie) != NGX_OK) {
+        goto failed;
+    }
+
+    cln = ngx_pool_cleanup_add(ctx->pool, 0);
+    if (cln == NULL) {
+        rc = NGX_ERROR;
+        goto failed;
+    }
+
+    cln->handler = ngx_http_geo_trie_cleanup;
+    cln->data = fm;
+
+    ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                       "using binary geo base \"%s\"", name->data);
+
+    ctx->include_name = *name;
+    ctx->binary_include = 1;
+    ctx->trie = trie;
+    ctx->base = fm;
+    ctx->uniq = uniq;
+    ctx->mtime = mtime;
+
+    return NGX_OK;
+
+failed:
+
+    ngx_close_file_mapping(fm);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_geo_trie_open(ngx_file_mapping_t *fm, ngx_http_geo_trie_t *trie)
+{
+    uint32_t                    *values, crc32;
+    uint64_t                     size;
+    ngx_uint_t                   i;
+    ngx_http_geo_trie_header_t  *header;
+
+    header = fm->addr;
+
+    if (fm->size < sizeof(ngx_http_geo_trie_header_t)
+        || ngx_memcmp(&ngx_http_geo_trie_header, &header->header, 12) != 0)
+    {
+        goto incompatible;
+    }
+
+    size = sizeof(ngx_http_geo_trie_header_t)
+           + (uint64_t) header->values * 2 * sizeof(uint32_t)
+           + (((uint64_t) header->nodes + header->nodes6)
+              * NGX_HTTP_GEO_TRIE_SIZE + 0x20000) * sizeof(uint32_t)
+           + header->size;
+
+    if (header->values == 0 || size != (uint64_t) fm->size) {
+        goto incompatible;
+    }
+
+    crc32 = ngx_crc32_long((u_char *) fm->addr + sizeof(ngx_http_geo_header_t),
+                           fm->size - sizeof(ngx_http_geo_header_t));
+
+    if (crc32 != header->header.crc32) {
+        ngx_log_error(NGX_LOG_WARN, fm->log, 0,
+                      "CRC32 mismatch in binary geo base \"%s\"", fm->name);
+        return NGX_DECLINED;
+    }
+
+    values = (uint32_t *) (header + 1);
+
+    for (i = 0; i < header->values; i++) {
+        if ((uint64_t) values[i * 2] + values[i * 2 + 1] > header->size) {
+            goto incompatible;
+        }
+    }
+
+    trie->values = values;
+    trie->trie = values + header->values * 2;
+    trie->trie6 = trie->trie + 0x10000
+                  + (size_t) header->nodes * NGX_HTTP_GEO_TRIE_SIZE;
+    trie->strings = (u_char *) (trie->trie6 + 0x10000
+                          + (size_t) header->nodes6 * NGX_HTTP_GEO_TRIE_SIZE);
+
+    if (ngx_http_geo_trie_valid(trie->trie, header->nodes, header->values)
+        == NGX_OK
+        && ngx_http_geo_trie_valid(trie->trie6, header->nodes6, header->values)
+           == NGX_OK)
+    {
+        return NGX_OK;
+    }
+
+incompatible:
+
+    ngx_log_error(NGX_LOG_WARN, fm->log, 0,
+                  "incompatible binary geo base \"%s\"", fm->name);
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_geo_trie_valid(uint32_t *trie, uint32_t nodes, uint32_t nvalues)
+{
+    uint32_t    n;
+    ngx_uint_t  i, len;
+
+    len = 0x10000 + (ngx_uint_t) nodes * NGX_HTTP_GEO_TRIE_SIZE;
+
+    for (i = 0; i < len; i++) {
+        n = trie[i];
+
+        if (n & NGX_HTTP_GEO_TRIE_NODE) {
+            if ((n & ~NGX_HTTP_GEO_TRIE_NODE) >= nodes) {
+                return NGX_ERROR;
+            }
+
+        } else if (n >= nvalues) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_geo_trie_cleanup(void *data)
+{
+    ngx_file_mapping_t  *fm = data;
+
+    ngx_close_file_mapping(fm);
+}
+
+
+static ngx_int_t
+ngx_http_geo_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                  i;
+    ngx_event_t                *ev;
+    ngx_http_geo_ctx_t        **geo;
+    ngx_http_geo_main_conf_t   *gmcf;
+
+    gmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_geo_module);
+
+    if (gmcf == NULL) {
+        return NGX_OK;
+    }
+
+    geo = gmcf->refresh.elts;
+
+    for (i = 0; i < gmcf->refresh.nelts; i++) {
+        ev = ngx_pcalloc(cycle->pool, sizeof(ngx_event_t));
+        if (ev == NULL) {
+            return NGX_ERROR;
+        }
+
+        ev->handler = ngx_http_geo_refresh_handler;
+        ev->data = geo[i];
+        ev->log = cycle->log;
+        ev->cancelable = 1;
+
+        ngx_add_timer(ev, geo[i]->refresh);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_geo_refresh_handler(ngx_event_t *ev)
+{
+    ngx_http_geo_ctx_t  *geo = ev->data;
+
+    ngx_file_info_t      fi;
+    ngx_file_mapping_t   fm;
+    ngx_http_geo_trie_t  trie;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    ngx_add_timer(ev, geo->refresh);
+
+    if (ngx_file_info(geo->base->name, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, ev->log, ngx_errno,
+                      ngx_file_info_n " \"%s\" failed", geo->base->name);
+        return;
+    }
+
+    if (ngx_file_uniq(&fi) == geo->uniq && ngx_file_mtime(&fi) == geo->mtime) {
+        return;
+    }
+
+    fm.name = geo->base->name;
+    fm.log = ev->log;
+
+    if (ngx_open_file_mapping(&fm) != NGX_OK) {
+        return;
+    }
+
+    if (ngx_fd_info(fm.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ev->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", fm.name);
+        goto failed;
+    }
+
+    /* the base is remembered even if it is broken, not to check it again */
+
+    geo->uniq = ngx_file_uniq(&fi);
+    geo->mtime = ngx_file_mtime(&fi);
+
+    if (ngx_http_geo_trie_open(&fm, &trie) != NGX_OK) {
+        goto failed;
+    }
+
+    /*
+     * values are copied to requests when the base can be refreshed,
+     * so the previous mapping is not referenced anymore
+     */
+
+    ngx_close_file_mapping(geo->base);
+
+    *geo->base = fm;
+    geo->u.trie = trie;
+
+    ngx_log_error(NGX_LOG_NOTICE, ev->log, 0,
+                  "binary geo base \"%s\" refreshed", fm.name);
+
+    return;
+
+failed:
+
+    ngx_close_file_mapping(&fm);
+}
+
+
+static void
+ngx_http_geo_create_trie_base(ngx_http_geo_conf_ctx_t *ctx)
+{
+    u_char                      *p, *name;
+    size_t                       size;
+    uint32_t                     n, offset, *values;
+    ngx_array_t                  trie, trie6;
+    ngx_file_mapping_t           fm;
+    ngx_http_geo_trie_header_t  *header;
+
+    n = 0;
+    size = 0;
+
+    ngx_http_geo_trie_index_values(ctx->rbtree.root, ctx->rbtree.sentinel,
+                                   &n, &size);
+
+    /* value 0 is the empty one, it is used where nothing matches */
+
+    n++;
+
+    if (ngx_array_init(&trie, ctx->temp_pool, 0x20000, sizeof(uint32_t))
+        != NGX_OK
+        || ngx_array_init(&trie6, ctx->temp_pool, 0x20000, sizeof(uint32_t))
+           != NGX_OK
+        || ngx_array_push_n(&trie, 0x10000) == NULL
+        || ngx_array_push_n(&trie6, 0x10000) == NULL)
+    {
+        return;
+    }
+
+    if (ngx_http_geo_trie_build(ctx, &trie, ctx->tree) != NGX_OK) {
+        return;
+    }
+
+#if (NGX_HAVE_INET6)
+    if (ngx_http_geo_trie_build(ctx, &trie6, ctx->tree6) != NGX_OK) {
+        return;
+    }
+#else
+    ngx_memzero(trie6.elts, 0x10000 * sizeof(uint32_t));
+#endif
+
+    name = ngx_pnalloc(ctx->temp_pool, ctx->include_name.len + 5);
+    if (name == NULL) {
+        return;
+    }
+
+    ngx_sprintf(name, "%V.bin%Z", &ctx->include_name);
+
+    /*
+     * the base is written to a temporary file and renamed, as the old
+     * one may still be mapped by the running worker processes
+     */
+
+    fm.name = ngx_pnalloc(ctx->temp_pool,
+                          ctx->include_name.len + 5 + NGX_INT64_LEN + 1);
+    if (fm.name == NULL) {
+        return;
+    }
+
+    ngx_sprintf(fm.name, "%V.bin.%P%Z", &ctx->include_name, ngx_pid);
+
+    fm.size = sizeof(ngx_http_geo_trie_header_t)
+              + n * 2 * sizeof(uint32_t)
+              + (trie.nelts + trie6.nelts) * sizeof(uint32_t)
+              + size;
+    fm.log = ctx->pool->log;
+
+    ngx_log_error(NGX_LOG_NOTICE, fm.log, 0,
+                  "creating binary geo base \"%s\"", name);
+
+    if (ngx_create_file_mapping(&fm) != NGX_OK) {
+        return;
+    }
+
+    header = fm.addr;
+
+    header->header = ngx_http_geo_trie_header;
+    header->values = n;
+    header->nodes = (trie.nelts - 0x10000) / NGX_HTTP_GEO_TRIE_SIZE;
+    header->nodes6 = (trie6.nelts - 0x10000) / NGX_HTTP_GEO_TRIE_SIZE;
+    header->size = size;
+
+    values = (uint32_t *) (header + 1);
+    values[0] = 0;
+    values[1] = 0;
+
+    p = (u_char *) (values + n * 2);
+    p = ngx_cpymem(p, trie.elts, trie.nelts * sizeof(uint32_t));
+    p = ngx_cpymem(p, trie6.elts, trie6.nelts * sizeof(uint32_t));
+
+    offset = 0;
+
+    ngx_http_geo_trie_copy_values(ctx->rbtree.root, ctx->rbtree.sentinel,
+                                  values, p, &offset);
+
+    header->header.crc32 = ngx_crc32_long((u_char *) fm.addr
+                                              + sizeof(ngx_http_geo_header_t),
+                                          fm.size
+                                              - sizeof(ngx_http_geo_header_t));
+
+    ngx_close_file_mapping(&fm);
+
+    if (ngx_rename_file(fm.name, name) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, fm.log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      fm.name, name);
+
+        if (ngx_delete_file(fm.name) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, fm.log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", fm.name);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_geo_trie_build(ngx_http_geo_conf_ctx_t *ctx, ngx_array_t *trie,
+    ngx_prefix_tree_t *tree)
+{
+    ngx_str_t                            s;
+    ngx_uint_t                           i, n, len, count[129];
+    ngx_array_t                          entries;
+    ngx_http_variable_value_t           *vv;
+    ngx_http_geo_trie_entry_t           *e, **sorted;
+    ngx_http_geo_variable_value_node_t  *gvvn;
+
+    ngx_memzero(trie->elts, 0x10000 * sizeof(uint32_t));
+
+    if (tree == NULL) {
+        return NGX_OK;
+    }
+
+    if (ngx_array_init(&entries, ctx->temp_pool, 1024,
+                       sizeof(ngx_http_geo_trie_entry_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_prefix_tree_walk(tree, ngx_http_geo_trie_collect, &entries)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (entries.nelts == 0) {
+        return NGX_OK;
+    }
+
+    /* shorter networks go first, so that longer ones override them */
+
+    sorted = ngx_palloc(ctx->temp_pool,
+                        entries.nelts * sizeof(ngx_http_geo_trie_entry_t *));
+    if (sorted == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(count, sizeof(count));
+
+    e = entries.elts;
+
+    for (i = 0; i < entries.nelts; i++) {
+        count[e[i].len]++;
+    }
+
+    for (len = 0, n = 0; len <= 128; len++) {
+        i = count[len];
+        count[len] = n;
+        n += i;
+    }
+
+    for (i = 0; i < entries.nelts; i++) {
+        sorted[count[e[i].len]++] = &e[i];
+    }
+
+    for (i = 0; i < entries.nelts; i++) {
+        vv = (ngx_http_variable_value_t *) sorted[i]->value;
+
+        s.len = vv->len;
+        s.data = vv->data;
+
+        gvvn = (ngx_http_geo_variable_value_node_t *)
+                   ngx_str_rbtree_lookup(&ctx->rbtree, &s,
+                                         ngx_crc32_long(s.data, s.len));
+        if (gvvn == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_geo_trie_add(trie, sorted[i]->key, sorted[i]->len,
+                                  (uint32_t) gvvn->offset)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_geo_trie_collect(void *data, uint32_t *key, ngx_uint_t len,
+    uintptr_t value)
+{
+    ngx_array_t  *entries = data;
+
+    ngx_http_geo_trie_entry_t  *e;
+
+    e = ngx_array_push(entries);
+    if (e == NULL) {
+        return NGX_ERROR;
+    }
+
+    e->key = key;
+    e->len = len;
+    e->value = value;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_geo_trie_add(ngx_array_t *trie, uint32_t *key, ngx_uint_t len,
+    uint32_t value)
+{
+    uint32_t    *p, n;
+    ngx_uint_t   i, base, start, bits, index, shift;
+
+    base = 0;
+    start = 0;
+    bits = 16;
+
+    for ( ;; ) {
+        index = (key[start >> 5] >> (32 - (start & 31) - bits))
+                & (((ngx_uint_t) 1 << bits) - 1);
+
+        if (len <= start + bits) {
+            shift = start + bits - len;
+            p = (uint32_t *) trie->elts + base + (index >> shift << shift);
+
+            for (i = 0; i < ((ngx_uint_t) 1 << shift); i++) {
+                p[i] = value;
+            }
+
+            return NGX_OK;
+        }
+
+        n = ((uint32_t *) trie->elts)[base + index];
+
+        if ((n & NGX_HTTP_GEO_TRIE_NODE) == 0) {
+
+            /* the network continues below the level */
+
+            p = ngx_array_push_n(trie, NGX_HTTP_GEO_TRIE_SIZE);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            for (i = 0; i < NGX_HTTP_GEO_TRIE_SIZE; i++) {
+                p[i] = n;
+            }
+
+            n = NGX_HTTP_GEO_TRIE_NODE
+                | ((trie->nelts - 0x10000) / NGX_HTTP_GEO_TRIE_SIZE - 1);
+
+            ((uint32_t *) trie->elts)[base + index] = n;
+        }
+
+        base = 0x10000 + (n & ~NGX_HTTP_GEO_TRIE_NODE) * NGX_HTTP_GEO_TRIE_SIZE;
+        start += bits;
+        bits = NGX_HTTP_GEO_TRIE_STRIDE;
+    }
+}
+
+
+static void
+ngx_http_geo_trie_index_values(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel, uint32_t *n, size_t *size)
+{
+    ngx_http_geo_variable_value_node_t  *gvvn;
+
+    if (node == sentinel) {
+        return;
+    }
+
+    gvvn = (ngx_http_geo_variable_value_node_t *) node;
+    gvvn->offset = ++(*n);
+    *size += gvvn->sn.str.len;
+
+    ngx_http_geo_trie_index_values(node->left, sentinel, n, size);
+    ngx_http_geo_trie_index_values(node->right, sentinel, n, size);
+}
+
+
+static void
+ngx_http_geo_trie_copy_values(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel, uint32_t *values, u_char *strings,
+    uint32_t *offset)
+{
+    ngx_http_geo_variable_value_node_t  *gvvn;
+
+    if (node == sentinel) {
+        return;
+    }
+
+    gvvn = (ngx_http_geo_variable_value_node_t *) node;
+
+    values[gvvn->offset * 2] = *offset;
+    values[gvvn->offset * 2 + 1] = (uint32_t) gvvn->sn.str.len;
+
+    ngx_memcpy(strings + *offset, gvvn->sn.str.data, gvvn->sn.str.len);
+    *offset += gvvn->sn.str.len;
+
+    ngx_http_geo_trie_copy_values(node->left, sentinel, values, strings,
+                                  offset);
+    ngx_http_geo_trie_copy_values(node->right, sentinel, values, strings,
+                                  offset);
+}
@@ -30,6 +30,30 @@ typedef struct {
 } ngx_http_gzip_conf_t;
 
 
+typedef struct {
+    ngx_uint_t           streams;
+} ngx_http_gzip_main_conf_t;
+
+
+/*
+ * an idle deflate stream kept by a worker for the next response with
+ * the same level, window and hash sizes; the stream memory follows
+ * the structure
+ */
+
+typedef struct {
+    ngx_queue_t          queue;
+    z_stream             zstream;
+
+    ngx_int_t            level;
+    int                  wbits;
+    int                  memlevel;
+
+    ngx_uint_t           nextra;
+    void                *extra[8];
+} ngx_http_gzip_stream_t;
+
+
 typedef struct {
     ngx_chain_t         *in;
     ngx_chain_t         *free;
@@ -48,6 +72,8 @@ typedef struct {
     char                *free_mem;
     ngx_uint_t           allocated;
 
+    ngx_http_gzip_stream_t  *stream;
+
     int                  wbits;
     int                  memlevel;
 
@@ -62,7 +88,8 @@ typedef struct {
     size_t               zout;
 
     uint32_t             crc32;
-    z_stream             zstream;
+    z_stream            *zstream;
+    z_stream             zs;
     ngx_http_request_t  *request;
 } ngx_http_gzip_ctx_t;
 
@@ -100,6 +127,13 @@ static ngx_int_t ngx_http_gzip_filter_deflate(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
 static ngx_int_t ngx_http_gzip_filter_deflate_end(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
+static ngx_int_t ngx_http_gzip_filter_deflate_free(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx);
+
+static ngx_http_gzip_stream_t *ngx_http_gzip_stream_get(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx);
+static void ngx_http_gzip_stream_free(ngx_http_gzip_stream_t *s);
+static void ngx_http_gzip_stream_cleanup(void *data);
 
 static void *ngx_http_gzip_filter_alloc(void *opaque, u_int items,
     u_int size);
@@ -112,6 +146,8 @@ static ngx_int_t ngx_http_gzip_ratio_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 
 static ngx_int_t ngx_http_gzip_filter_init(ngx_conf_t *cf);
+static void *ngx_http_gzip_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_gzip_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_gzip_create_conf(ngx_conf_t *cf);
 static char *ngx_http_gzip_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
@@ -193,6 +229,13 @@ static ngx_command_t  ngx_http_gzip_filter_commands[] = {
       offsetof(ngx_http_gzip_conf_t, min_length),
       NULL },
 
+    { ngx_string("gzip_stream_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_gzip_main_conf_t, streams),
+      NULL },
+
       ngx_null_command
 };
 
@@ -201,8 +244,8 @@ static ngx_http_module_t  ngx_http_gzip_filter_module_ctx = {
     ngx_http_gzip_add_variables,           /* preconfiguration */
     ngx_http_gzip_filter_init,             /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
-    NULL,                                  /* init main configuration */
+    ngx_http_gzip_create_main_conf,        /* create main configuration */
+    ngx_http_gzip_init_main_conf,          /* init main configuration */
 
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
@@ -230,6 +273,9 @@ ngx_module_t  ngx_http_gzip_filter_module = {
 
 static ngx_str_t  ngx_http_gzip_ratio = ngx_string("gzip_ratio");
 
+static ngx_queue_t  ngx_http_gzip_streams;
+static ngx_uint_t   ngx_http_gzip_nstreams;
+
 static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
 static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
 
@@ -359,7 +405,7 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         }
     }
 
-    if (ctx->preallocated == NULL) {
+    if (ctx->zstream == NULL) {
         if (ngx_http_gzip_filter_deflate_start(r, ctx) != NGX_OK) {
             goto failed;
         }
@@ -449,6 +495,14 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             }
         }
 
+#if (NGX_HTTP_CACHE)
+
+        if (r->cache && r->cache->encoded) {
+            (void) ngx_http_file_cache_write_encoded(r, ctx->out);
+        }
+
+#endif
+
         rc = ngx_http_next_body_filter(r, ctx->out);
 
         if (rc == NGX_ERROR) {
@@ -475,10 +529,8 @@ failed:
 
     ctx->done = 1;
 
-    if (ctx->preallocated) {
-        deflateEnd(&ctx->zstream);
-
-        ngx_pfree(r->pool, ctx->preallocated);
+    if (ctx->zstream) {
+        (void) ngx_http_gzip_filter_deflate_free(r, ctx);
     }
 
     ngx_http_gzip_filter_free_copy_buf(r, ctx);
@@ -603,29 +655,43 @@ static ngx_int_t
 ngx_http_gzip_filter_deflate_start(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx)
 {
-    int                    rc;
-    ngx_http_gzip_conf_t  *conf;
+    int                         rc;
+    ngx_http_gzip_conf_t       *conf;
+    ngx_http_gzip_main_conf_t  *gmcf;
 
     conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+    gmcf = ngx_http_get_module_main_conf(r, ngx_http_gzip_filter_module);
 
-    ctx->preallocated = ngx_palloc(r->pool, ctx->allocated);
-    if (ctx->preallocated == NULL) {
-        return NGX_ERROR;
-    }
+    if (gmcf->streams) {
+        ctx->stream = ngx_http_gzip_stream_get(r, ctx);
+        if (ctx->stream == NULL) {
+            return NGX_ERROR;
+        }
 
-    ctx->free_mem = ctx->preallocated;
+        ctx->zstream = &ctx->stream->zstream;
 
-    ctx->zstream.zalloc = ngx_http_gzip_filter_alloc;
-    ctx->zstream.zfree = ngx_http_gzip_filter_free;
-    ctx->zstream.opaque = ctx;
+    } else {
+        ctx->preallocated = ngx_palloc(r->pool, ctx->allocated);
+        if (ctx->preallocated == NULL) {
+            return NGX_ERROR;
+        }
 
-    rc = deflateInit2(&ctx->zstream, (int) conf->level, Z_DEFLATED,
-                      - ctx->wbits, ctx->memlevel, Z_DEFAULT_STRATEGY);
+        ctx->free_mem = ctx->preallocated;
 
-    if (rc != Z_OK) {
-        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
-                      "deflateInit2() failed: %d", rc);
-        return NGX_ERROR;
+        ctx->zstream = &ctx->zs;
+
+        ctx->zstream->zalloc = ngx_http_gzip_filter_alloc;
+        ctx->zstream->zfree = ngx_http_gzip_filter_free;
+        ctx->zstream->opaque = ctx;
+
+        rc = deflateInit2(ctx->zstream, (int) conf->level, Z_DEFLATED,
+                          - ctx->wbits, ctx->memlevel, Z_DEFAULT_STRATEGY);
+
+        if (rc != Z_OK) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "deflateInit2() failed: %d", rc);
+            return NGX_ERROR;
+        }
     }
 
     ctx->last_out = &ctx->out;
@@ -671,7 +737,7 @@ ngx_http_gzip_filter_gzheader(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
 static ngx_int_t
 ngx_http_gzip_filter_add_data(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
 {
-    if (ctx->zstream.avail_in || ctx->flush != Z_NO_FLUSH || ctx->redo) {
+    if (ctx->zstream->avail_in || ctx->flush != Z_NO_FLUSH || ctx->redo) {
         return NGX_OK;
     }
 
@@ -702,13 +768,13 @@ ngx_http_gzip_filter_add_data(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
 
     ctx->in = ctx->in->next;
 
-    ctx->zstream.next_in = ctx->in_buf->pos;
-    ctx->zstream.avail_in = ctx->in_buf->last - ctx->in_buf->pos;
+    ctx->zstream->next_in = ctx->in_buf->pos;
+    ctx->zstream->avail_in = ctx->in_buf->last - ctx->in_buf->pos;
 
     ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "gzip in_buf:%p ni:%p ai:%ud",
                    ctx->in_buf,
-                   ctx->zstream.next_in, ctx->zstream.avail_in);
+                   ctx->zstream->next_in, ctx->zstream->avail_in);
 
     if (ctx->in_buf->last_buf) {
         ctx->flush = Z_FINISH;
@@ -717,10 +783,10 @@ ngx_http_gzip_filter_add_data(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
         ctx->flush = Z_SYNC_FLUSH;
     }
 
-    if (ctx->zstream.avail_in) {
+    if (ctx->zstream->avail_in) {
 
-        ctx->crc32 = crc32(ctx->crc32, ctx->zstream.next_in,
-                           ctx->zstream.avail_in);
+        ctx->crc32 = crc32(ctx->crc32, ctx->zstream->next_in,
+                           ctx->zstream->avail_in);
 
     } else if (ctx->flush == Z_NO_FLUSH) {
         return NGX_AGAIN;
@@ -735,7 +801,7 @@ ngx_http_gzip_filter_get_buf(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
 {
     ngx_http_gzip_conf_t  *conf;
 
-    if (ctx->zstream.avail_out) {
+    if (ctx->zstream->avail_out) {
         return NGX_OK;
     }
 
@@ -761,8 +827,8 @@ ngx_http_gzip_filter_get_buf(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
         return NGX_DECLINED;
     }
 
-    ctx->zstream.next_out = ctx->out_buf->pos;
-    ctx->zstream.avail_out = conf->bufs.size;
+    ctx->zstream->next_out = ctx->out_buf->pos;
+    ctx->zstream->avail_out = conf->bufs.size;
 
     return NGX_OK;
 }
@@ -778,11 +844,11 @@ ngx_http_gzip_filter_deflate(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
 
     ngx_log_debug6(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                  "deflate in: ni:%p no:%p ai:%ud ao:%ud fl:%d redo:%d",
-                 ctx->zstream.next_in, ctx->zstream.next_out,
-                 ctx->zstream.avail_in, ctx->zstream.avail_out,
+                 ctx->zstream->next_in, ctx->zstream->next_out,
+                 ctx->zstream->avail_in, ctx->zstream->avail_out,
                  ctx->flush, ctx->redo);
 
-    rc = deflate(&ctx->zstream, ctx->flush);
+    rc = deflate(ctx->zstream, ctx->flush);
 
     if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
         ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
@@ -792,25 +858,25 @@ ngx_http_gzip_filter_deflate(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
 
     ngx_log_debug5(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "deflate out: ni:%p no:%p ai:%ud ao:%ud rc:%d",
-                   ctx->zstream.next_in, ctx->zstream.next_out,
-                   ctx->zstream.avail_in, ctx->zstream.avail_out,
+                   ctx->zstream->next_in, ctx->zstream->next_out,
+                   ctx->zstream->avail_in, ctx->zstream->avail_out,
                    rc);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "gzip in_buf:%p pos:%p",
                    ctx->in_buf, ctx->in_buf->pos);
 
-    if (ctx->zstream.next_in) {
-        ctx->in_buf->pos = ctx->zstream.next_in;
+    if (ctx->zstream->next_in) {
+        ctx->in_buf->pos = ctx->zstream->next_in;
 
-        if (ctx->zstream.avail_in == 0) {
-            ctx->zstream.next_in = NULL;
+        if (ctx->zstream->avail_in == 0) {
+            ctx->zstream->next_in = NULL;
         }
     }
 
-    ctx->out_buf->last = ctx->zstream.next_out;
+    ctx->out_buf->last = ctx->zstream->next_out;
 
-    if (ctx->zstream.avail_out == 0) {
+    if (ctx->zstream->avail_out == 0) {
 
         /* zlib wants to output some more gzipped data */
 
@@ -850,7 +916,7 @@ ngx_http_gzip_filter_deflate(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
             }
 
         } else {
-            ctx->zstream.avail_out = 0;
+            ctx->zstream->avail_out = 0;
         }
 
         b->flush = 1;
@@ -904,18 +970,8 @@ ngx_http_gzip_filter_deflate_end(ngx_http_request_t *r,
     ngx_chain_t       *cl;
     struct gztrailer  *trailer;
 
-    ctx->zin = ctx->zstream.total_in;
-    ctx->zout = 10 + ctx->zstream.total_out + 8;
-
-    rc = deflateEnd(&ctx->zstream);
-
-    if (rc != Z_OK) {
-        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
-                      "deflateEnd() failed: %d", rc);
-        return NGX_ERROR;
-    }
-
-    ngx_pfree(r->pool, ctx->preallocated);
+    ctx->zin = ctx->zstream->total_in;
+    ctx->zout = 10 + ctx->zstream->total_out + 8;
 
     cl = ngx_alloc_chain_link(r->pool);
     if (cl == NULL) {
@@ -927,7 +983,7 @@ ngx_http_gzip_filter_deflate_end(ngx_http_request_t *r,
     *ctx->last_out = cl;
     ctx->last_out = &cl->next;
 
-    if (ctx->zstream.avail_out >= 8) {
+    if (ctx->zstream->avail_out >= 8) {
         trailer = (struct gztrailer *) ctx->out_buf->last;
         ctx->out_buf->last += 8;
         ctx->out_buf->last_buf = 1;
@@ -972,8 +1028,14 @@ ngx_http_gzip_filter_deflate_end(ngx_http_request_t *r,
 
 #endif
 
-    ctx->zstream.avail_in = 0;
-    ctx->zstream.avail_out = 0;
+    ctx->zstream->avail_in = 0;
+    ctx->zstream->avail_out = 0;
+
+    rc = ngx_http_gzip_filter_deflate_free(r, ctx);
+
+    if (rc != NGX_OK) {
+        return NGX_ERROR;
+    }
 
     ctx->done = 1;
 
@@ -983,6 +1045,183 @@ ngx_http_gzip_filter_deflate_end(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_gzip_filter_deflate_free(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx)
+{
+    int                         rc;
+    ngx_http_gzip_stream_t     *s;
+    ngx_http_gzip_main_conf_t  *gmcf;
+
+    if (ctx->stream) {
+
+        /* return the stream to the worker cache */
+
+        s = ctx->stream;
+        ctx->stream = NULL;
+        ctx->zstream = NULL;
+
+        if (deflateReset(&s->zstream) != Z_OK) {
+            ngx_http_gzip_stream_free(s);
+            return NGX_OK;
+        }
+
+        gmcf = ngx_http_get_module_main_conf(r, ngx_http_gzip_filter_module);
+
+        ngx_queue_insert_head(&ngx_http_gzip_streams, &s->queue);
+        ngx_http_gzip_nstreams++;
+
+        while (ngx_http_gzip_nstreams > gmcf->streams) {
+            s = ngx_queue_data(ngx_queue_last(&ngx_http_gzip_streams),
+                               ngx_http_gzip_stream_t, queue);
+            ngx_queue_remove(&s->queue);
+            ngx_http_gzip_nstreams--;
+
+            ngx_http_gzip_stream_free(s);
+        }
+
+        return NGX_OK;
+    }
+
+    rc = deflateEnd(ctx->zstream);
+
+    ctx->zstream = NULL;
+
+    ngx_pfree(r->pool, ctx->preallocated);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "deflateEnd() failed: %d", rc);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_http_gzip_stream_t *
+ngx_http_gzip_stream_get(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
+{
+    int                      rc;
+    ngx_queue_t             *q;
+    ngx_pool_cleanup_t      *cln;
+    ngx_http_gzip_conf_t    *conf;
+    ngx_http_gzip_stream_t  *s;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    if (ngx_http_gzip_streams.next == NULL) {
+        ngx_queue_init(&ngx_http_gzip_streams);
+    }
+
+    for (q = ngx_queue_head(&ngx_http_gzip_streams);
+         q != ngx_queue_sentinel(&ngx_http_gzip_streams);
+         q = ngx_queue_next(q))
+    {
+        s = ngx_queue_data(q, ngx_http_gzip_stream_t, queue);
+
+        if (s->level == conf->level
+            && s->wbits == ctx->wbits
+            && s->memlevel == ctx->memlevel)
+        {
+            ngx_queue_remove(q);
+            ngx_http_gzip_nstreams--;
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "gzip stream reused: %p", s);
+
+            goto found;
+        }
+    }
+
+    /* the memory is preallocated as for a request, see above */
+
+    s = ngx_alloc(sizeof(ngx_http_gzip_stream_t) + ctx->allocated,
+                  r->connection->log);
+    if (s == NULL) {
+        return NULL;
+    }
+
+    s->level = conf->level;
+    s->wbits = ctx->wbits;
+    s->memlevel = ctx->memlevel;
+    s->nextra = 0;
+
+    ctx->stream = s;
+    ctx->preallocated = (u_char *) s + sizeof(ngx_http_gzip_stream_t);
+    ctx->free_mem = ctx->preallocated;
+
+    ngx_memzero(&s->zstream, sizeof(z_stream));
+
+    s->zstream.zalloc = ngx_http_gzip_filter_alloc;
+    s->zstream.zfree = ngx_http_gzip_filter_free;
+    s->zstream.opaque = ctx;
+
+    rc = deflateInit2(&s->zstream, (int) conf->level, Z_DEFLATED,
+                      - ctx->wbits, ctx->memlevel, Z_DEFAULT_STRATEGY);
+
+    /* zlib calls the allocator only from deflateInit2() */
+
+    s->zstream.opaque = NULL;
+    ctx->preallocated = NULL;
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "deflateInit2() failed: %d", rc);
+        ngx_http_gzip_stream_free(s);
+        return NULL;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "gzip stream new: %p", s);
+
+found:
+
+    /* deflateReset() keeps the buffer pointers of the previous response */
+
+    s->zstream.next_in = NULL;
+    s->zstream.avail_in = 0;
+    s->zstream.next_out = NULL;
+    s->zstream.avail_out = 0;
+
+    cln->handler = ngx_http_gzip_stream_cleanup;
+    cln->data = ctx;
+
+    return s;
+}
+
+
+static void
+ngx_http_gzip_stream_free(ngx_http_gzip_stream_t *s)
+{
+    ngx_uint_t  i;
+
+    (void) deflateEnd(&s->zstream);
+
+    for (i = 0; i < s->nextra; i++) {
+        ngx_free(s->extra[i]);
+    }
+
+    ngx_free(s);
+}
+
+
+static void
+ngx_http_gzip_stream_cleanup(void *data)
+{
+    ngx_http_gzip_ctx_t *ctx = data;
+
+    if (ctx->stream) {
+        (void) ngx_http_gzip_filter_deflate_free(ctx->request, ctx);
+    }
+}
+
+
 static void *
 ngx_http_gzip_filter_alloc(void *opaque, u_int items, u_int size)
 {
@@ -1019,6 +1258,23 @@ ngx_http_gzip_filter_alloc(void *opaque, u_int items, u_int size)
                   "gzip filter failed to use preallocated memory: %ud of %ui",
                   items * size, ctx->allocated);
 
+    if (ctx->stream) {
+
+        /* a cached stream outlives the request pool */
+
+        if (ctx->stream->nextra == 8) {
+            return NULL;
+        }
+
+        p = ngx_alloc(items * size, ctx->request->connection->log);
+
+        if (p) {
+            ctx->stream->extra[ctx->stream->nextra++] = p;
+        }
+
+        return p;
+    }
+
     p = ngx_palloc(ctx->request->pool, items * size);
 
     return p;
@@ -1111,6 +1367,33 @@ ngx_http_gzip_ratio_variable(ngx_http_request_t *r,
 }
 
 
+static void *
+ngx_http_gzip_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_gzip_main_conf_t  *gmcf;
+
+    gmcf = ngx_palloc(cf->pool, sizeof(ngx_http_gzip_main_conf_t));
+    if (gmcf == NULL) {
+        return NULL;
+    }
+
+    gmcf->streams = NGX_CONF_UNSET_UINT;
+
+    return gmcf;
+}
+
+
+static char *
+ngx_http_gzip_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_gzip_main_conf_t *gmcf = conf;
+
+    ngx_conf_init_uint_value(gmcf->streams, 0);
+
+    return NGX_CONF_OK;
+}
+
+
 static void *
 ngx_http_gzip_create_conf(ngx_conf_t *cf)
 {
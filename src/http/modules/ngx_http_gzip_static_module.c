@@ -17,10 +17,21 @@
 
 typedef struct {
     ngx_uint_t  enable;
+    ngx_uint_t  brotli;
+    ngx_uint_t  zstd;
 } ngx_http_gzip_static_conf_t;
 
 
+typedef struct {
+    ngx_str_t   encoding;
+    ngx_str_t   ext;
+    ngx_uint_t  offset;
+} ngx_http_gzip_static_encoding_t;
+
+
 static ngx_int_t ngx_http_gzip_static_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_gzip_static_send(ngx_http_request_t *r,
+    ngx_http_gzip_static_encoding_t *enc, ngx_uint_t enable);
 static void *ngx_http_gzip_static_create_conf(ngx_conf_t *cf);
 static char *ngx_http_gzip_static_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
@@ -44,10 +55,37 @@ static ngx_command_t  ngx_http_gzip_static_commands[] = {
       offsetof(ngx_http_gzip_static_conf_t, enable),
       &ngx_http_gzip_static },
 
+    { ngx_string("brotli_static"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gzip_static_conf_t, brotli),
+      &ngx_http_gzip_static },
+
+    { ngx_string("zstd_static"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gzip_static_conf_t, zstd),
+      &ngx_http_gzip_static },
+
       ngx_null_command
 };
 
 
+/* in the order of preference */
+
+static ngx_http_gzip_static_encoding_t  ngx_http_gzip_static_encodings[] = {
+    { ngx_string("br"), ngx_string(".br"),
+      offsetof(ngx_http_gzip_static_conf_t, brotli) },
+    { ngx_string("zstd"), ngx_string(".zst"),
+      offsetof(ngx_http_gzip_static_conf_t, zstd) },
+    { ngx_string("gzip"), ngx_string(".gz"),
+      offsetof(ngx_http_gzip_static_conf_t, enable) },
+    { ngx_null_string, ngx_null_string, 0 }
+};
+
+
 ngx_http_module_t  ngx_http_gzip_static_module_ctx = {
     NULL,                                  /* preconfiguration */
     ngx_http_gzip_static_init,             /* postconfiguration */
@@ -82,18 +120,10 @@ ngx_module_t  ngx_http_gzip_static_module = {
 static ngx_int_t
 ngx_http_gzip_static_handler(ngx_http_request_t *r)
 {
-    u_char                       *p;
-    size_t                        root;
-    ngx_str_t                     path;
-    ngx_int_t                     rc;
-    ngx_uint_t                    level;
-    ngx_log_t                    *log;
-    ngx_buf_t                    *b;
-    ngx_chain_t                   out;
-    ngx_table_elt_t              *h;
-    ngx_open_file_info_t          of;
-    ngx_http_core_loc_conf_t     *clcf;
-    ngx_http_gzip_static_conf_t  *gzcf;
+    ngx_int_t                         rc;
+    ngx_uint_t                        enable;
+    ngx_http_gzip_static_conf_t      *gzcf;
+    ngx_http_gzip_static_encoding_t  *enc;
 
     if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
         return NGX_DECLINED;
@@ -105,12 +135,49 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
 
     gzcf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_static_module);
 
-    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_OFF) {
-        return NGX_DECLINED;
+    for (enc = ngx_http_gzip_static_encodings; enc->encoding.len; enc++) {
+
+        enable = *(ngx_uint_t *) ((char *) gzcf + enc->offset);
+
+        if (enable == NGX_HTTP_GZIP_STATIC_OFF) {
+            continue;
+        }
+
+        rc = ngx_http_gzip_static_send(r, enc, enable);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
     }
 
-    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_ON) {
-        rc = ngx_http_gzip_ok(r);
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_static_send(ngx_http_request_t *r,
+    ngx_http_gzip_static_encoding_t *enc, ngx_uint_t enable)
+{
+    u_char                    *p;
+    size_t                     root;
+    ngx_str_t                  path;
+    ngx_int_t                  rc;
+    ngx_uint_t                 level;
+    ngx_log_t                 *log;
+    ngx_buf_t                 *b;
+    ngx_chain_t                out;
+    ngx_table_elt_t           *h;
+    ngx_open_file_info_t       of;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    if (enable == NGX_HTTP_GZIP_STATIC_ON) {
+
+        if (enc->offset == offsetof(ngx_http_gzip_static_conf_t, enable)) {
+            rc = ngx_http_gzip_ok(r);
+
+        } else {
+            rc = ngx_http_gzip_encoding_ok(r, &enc->encoding);
+        }
 
     } else {
         /* always */
@@ -125,14 +192,12 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
 
     log = r->connection->log;
 
-    p = ngx_http_map_uri_to_path(r, &path, &root, sizeof(".gz") - 1);
+    p = ngx_http_map_uri_to_path(r, &path, &root, enc->ext.len);
     if (p == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    *p++ = '.';
-    *p++ = 'g';
-    *p++ = 'z';
+    p = ngx_cpymem(p, enc->ext.data, enc->ext.len);
     *p = '\0';
 
     path.len = p - path.data;
@@ -188,7 +253,7 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
         return NGX_DECLINED;
     }
 
-    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_ON) {
+    if (enable == NGX_HTTP_GZIP_STATIC_ON) {
         r->gzip_vary = 1;
 
         if (rc != NGX_OK) {
@@ -243,7 +308,7 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
 
     h->hash = 1;
     ngx_str_set(&h->key, "Content-Encoding");
-    ngx_str_set(&h->value, "gzip");
+    h->value = enc->encoding;
     r->headers_out.content_encoding = h;
 
     /* we need to allocate all before the header would be sent */
@@ -294,6 +359,8 @@ ngx_http_gzip_static_create_conf(ngx_conf_t *cf)
     }
 
     conf->enable = NGX_CONF_UNSET_UINT;
+    conf->brotli = NGX_CONF_UNSET_UINT;
+    conf->zstd = NGX_CONF_UNSET_UINT;
 
     return conf;
 }
@@ -307,6 +374,10 @@ ngx_http_gzip_static_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_uint_value(conf->enable, prev->enable,
                               NGX_HTTP_GZIP_STATIC_OFF);
+    ngx_conf_merge_uint_value(conf->brotli, prev->brotli,
+                              NGX_HTTP_GZIP_STATIC_OFF);
+    ngx_conf_merge_uint_value(conf->zstd, prev->zstd,
+                              NGX_HTTP_GZIP_STATIC_OFF);
 
     return NGX_CONF_OK;
 }
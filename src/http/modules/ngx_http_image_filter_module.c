@@ -8,9 +8,15 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_md5.h>
 
 #include <gd.h>
 
+#if (NGX_HAVE_LIBJPEG)
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+
 
 #define NGX_HTTP_IMAGE_OFF       0
 #define NGX_HTTP_IMAGE_TEST      1
@@ -25,6 +31,8 @@
 #define NGX_HTTP_IMAGE_PROCESS   2
 #define NGX_HTTP_IMAGE_PASS      3
 #define NGX_HTTP_IMAGE_DONE      4
+#define NGX_HTTP_IMAGE_THREAD    5
+#define NGX_HTTP_IMAGE_SKIP      6
 
 
 #define NGX_HTTP_IMAGE_NONE      0
@@ -36,6 +44,9 @@
 #define NGX_HTTP_IMAGE_BUFFERED  0x08
 
 
+#define NGX_HTTP_IMAGE_KEY_LEN   16
+
+
 typedef struct {
     ngx_uint_t                   filter;
     ngx_uint_t                   width;
@@ -54,6 +65,12 @@ typedef struct {
     ngx_http_complex_value_t    *shcv;
 
     size_t                       buffer_size;
+
+    ngx_shm_zone_t              *cache;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t           *thread_pool;
+#endif
 } ngx_http_image_filter_conf_t;
 
 
@@ -68,13 +85,72 @@ typedef struct {
     ngx_uint_t                   max_width;
     ngx_uint_t                   max_height;
     ngx_uint_t                   angle;
+    ngx_uint_t                   jpeg_quality;
+    ngx_uint_t                   sharpen;
+    ngx_uint_t                   scale;
 
     ngx_uint_t                   phase;
     ngx_uint_t                   type;
     ngx_uint_t                   force;
+
+    /* the result of ngx_http_image_transform() */
+
+    ngx_int_t                    status;
+    u_char                      *out;
+    int                          size;
+    char                        *failed;
+
+    ngx_uint_t                   cacheable;
+    u_char                       key[NGX_HTTP_IMAGE_KEY_LEN];
 } ngx_http_image_filter_ctx_t;
 
 
+typedef struct {
+    ngx_rbtree_t                 rbtree;
+    ngx_rbtree_node_t            sentinel;
+    ngx_queue_t                  queue;
+} ngx_http_image_cache_sh_t;
+
+
+typedef struct {
+    ngx_http_image_cache_sh_t   *sh;
+    ngx_slab_pool_t             *shpool;
+} ngx_http_image_cache_t;
+
+
+typedef struct {
+    ngx_rbtree_node_t            node;
+    ngx_queue_t                  queue;
+
+    u_char                       key[NGX_HTTP_IMAGE_KEY_LEN
+                                     - sizeof(ngx_rbtree_key_t)];
+
+    ngx_uint_t                   type;
+    size_t                       len;
+    u_char                       data[1];
+} ngx_http_image_cache_node_t;
+
+
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_http_image_filter_ctx_t   *ctx;
+    ngx_http_image_filter_conf_t  *conf;
+} ngx_http_image_thread_ctx_t;
+
+#endif
+
+
+#if (NGX_HAVE_LIBJPEG)
+
+typedef struct {
+    struct jpeg_error_mgr        pub;
+    jmp_buf                      jmp;
+} ngx_http_image_jpeg_error_t;
+
+#endif
+
+
 static ngx_int_t ngx_http_image_send(ngx_http_request_t *r,
     ngx_http_image_filter_ctx_t *ctx, ngx_chain_t *in);
 static ngx_uint_t ngx_http_image_test(ngx_http_request_t *r, ngx_chain_t *in);
@@ -88,15 +164,52 @@ static void ngx_http_image_length(ngx_http_request_t *r, ngx_buf_t *b);
 static ngx_int_t ngx_http_image_size(ngx_http_request_t *r,
     ngx_http_image_filter_ctx_t *ctx);
 
+static ngx_int_t ngx_http_image_params(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx);
 static ngx_buf_t *ngx_http_image_resize(ngx_http_request_t *r,
     ngx_http_image_filter_ctx_t *ctx);
-static gdImagePtr ngx_http_image_source(ngx_http_request_t *r,
+static ngx_buf_t *ngx_http_image_result(ngx_http_request_t *r,
     ngx_http_image_filter_ctx_t *ctx);
-static gdImagePtr ngx_http_image_new(ngx_http_request_t *r, int w, int h,
-    int colors);
-static u_char *ngx_http_image_out(ngx_http_request_t *r, ngx_uint_t type,
-    gdImagePtr img, int *size);
+static ngx_int_t ngx_http_image_transform(ngx_http_image_filter_ctx_t *ctx,
+    ngx_http_image_filter_conf_t *conf, ngx_log_t *log);
+static gdImagePtr ngx_http_image_source(ngx_http_image_filter_ctx_t *ctx,
+    ngx_log_t *log);
+static gdImagePtr ngx_http_image_new(ngx_http_image_filter_ctx_t *ctx, int w,
+    int h, int colors);
+static ngx_int_t ngx_http_image_out(ngx_http_image_filter_ctx_t *ctx,
+    gdImagePtr img);
 static void ngx_http_image_cleanup(void *data);
+
+#if (NGX_HAVE_LIBJPEG)
+static ngx_uint_t ngx_http_image_jpeg_scale(ngx_http_image_filter_ctx_t *ctx,
+    ngx_http_image_filter_conf_t *conf);
+static gdImagePtr ngx_http_image_jpeg_source(ngx_http_image_filter_ctx_t *ctx,
+    ngx_log_t *log);
+static void ngx_http_image_jpeg_error_exit(j_common_ptr cinfo);
+static void ngx_http_image_jpeg_output_message(j_common_ptr cinfo);
+#endif
+
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_image_thread(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx, ngx_http_image_filter_conf_t *conf);
+static void ngx_http_image_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_image_thread_event_handler(ngx_event_t *ev);
+#endif
+
+static void ngx_http_image_skip(ngx_chain_t *in);
+static ngx_int_t ngx_http_image_cache_key(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx);
+static ngx_buf_t *ngx_http_image_cache_get(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx);
+static void ngx_http_image_cache_put(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx, ngx_buf_t *b);
+static ngx_http_image_cache_node_t *ngx_http_image_cache_lookup(
+    ngx_http_image_cache_t *cache, u_char *key);
+static void ngx_http_image_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_image_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+
 static ngx_uint_t ngx_http_image_filter_get_value(ngx_http_request_t *r,
     ngx_http_complex_value_t *cv, ngx_uint_t v);
 static ngx_uint_t ngx_http_image_filter_value(ngx_str_t *value);
@@ -111,6 +224,12 @@ static char *ngx_http_image_filter_jpeg_quality(ngx_conf_t *cf,
     ngx_command_t *cmd, void *conf);
 static char *ngx_http_image_filter_sharpen(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_image_filter_cache_zone(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_image_filter_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_image_filter_thread_pool(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 static ngx_int_t ngx_http_image_filter_init(ngx_conf_t *cf);
 
 
@@ -158,6 +277,27 @@ static ngx_command_t  ngx_http_image_filter_commands[] = {
       offsetof(ngx_http_image_filter_conf_t, buffer_size),
       NULL },
 
+    { ngx_string("image_filter_cache_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_image_filter_cache_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("image_filter_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_image_filter_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("image_filter_thread_pool"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_image_filter_thread_pool,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -286,16 +426,16 @@ ngx_http_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "image filter");
 
-    if (in == NULL) {
-        return ngx_http_next_body_filter(r, in);
-    }
-
     ctx = ngx_http_get_module_ctx(r, ngx_http_image_filter_module);
 
     if (ctx == NULL) {
         return ngx_http_next_body_filter(r, in);
     }
 
+    if (in == NULL && ctx->phase != NGX_HTTP_IMAGE_THREAD) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
     switch (ctx->phase) {
 
     case NGX_HTTP_IMAGE_START:
@@ -335,6 +475,22 @@ ngx_http_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             return ngx_http_image_send(r, ctx, in);
         }
 
+        if (conf->cache
+            && conf->filter != NGX_HTTP_IMAGE_SIZE
+            && ngx_http_image_cache_key(r, ctx) == NGX_OK)
+        {
+            out.buf = ngx_http_image_cache_get(r, ctx);
+
+            if (out.buf) {
+                ngx_http_image_skip(in);
+
+                out.next = NULL;
+                ctx->phase = NGX_HTTP_IMAGE_SKIP;
+
+                return ngx_http_image_send(r, ctx, &out);
+            }
+        }
+
         ctx->phase = NGX_HTTP_IMAGE_READ;
 
         /* fall through */
@@ -360,6 +516,35 @@ ngx_http_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         out.buf = ngx_http_image_process(r);
 
         if (out.buf == NULL) {
+
+#if (NGX_THREADS)
+            if (ctx->phase == NGX_HTTP_IMAGE_THREAD) {
+                return NGX_OK;
+            }
+#endif
+
+            return ngx_http_filter_finalize_request(r,
+                                              &ngx_http_image_filter_module,
+                                              NGX_HTTP_UNSUPPORTED_MEDIA_TYPE);
+        }
+
+        out.next = NULL;
+        ctx->phase = NGX_HTTP_IMAGE_PASS;
+
+        return ngx_http_image_send(r, ctx, &out);
+
+#if (NGX_THREADS)
+    case NGX_HTTP_IMAGE_THREAD:
+
+        if (r->aio) {
+            return NGX_OK;
+        }
+
+        r->connection->buffered &= ~NGX_HTTP_IMAGE_BUFFERED;
+
+        out.buf = ngx_http_image_result(r, ctx);
+
+        if (out.buf == NULL) {
             return ngx_http_filter_finalize_request(r,
                                               &ngx_http_image_filter_module,
                                               NGX_HTTP_UNSUPPORTED_MEDIA_TYPE);
@@ -369,11 +554,20 @@ ngx_http_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         ctx->phase = NGX_HTTP_IMAGE_PASS;
 
         return ngx_http_image_send(r, ctx, &out);
+#endif
 
     case NGX_HTTP_IMAGE_PASS:
 
         return ngx_http_next_body_filter(r, in);
 
+    case NGX_HTTP_IMAGE_SKIP:
+
+        /* the variant was sent from the cache, the source is discarded */
+
+        ngx_http_image_skip(in);
+
+        return ngx_http_next_body_filter(r, NULL);
+
     default: /* NGX_HTTP_IMAGE_DONE */
 
         rc = ngx_http_next_body_filter(r, NULL);
@@ -520,26 +714,12 @@ ngx_http_image_process(ngx_http_request_t *r)
         return ngx_http_image_json(r, rc == NGX_OK ? ctx : NULL);
     }
 
-    ctx->angle = ngx_http_image_filter_get_value(r, conf->acv, conf->angle);
-
-    if (conf->filter == NGX_HTTP_IMAGE_ROTATE) {
-
-        if (ctx->angle != 90 && ctx->angle != 180 && ctx->angle != 270) {
-            return NULL;
-        }
-
-        return ngx_http_image_resize(r, ctx);
-    }
-
-    ctx->max_width = ngx_http_image_filter_get_value(r, conf->wcv, conf->width);
-    if (ctx->max_width == 0) {
+    if (ngx_http_image_params(r, ctx) != NGX_OK) {
         return NULL;
     }
 
-    ctx->max_height = ngx_http_image_filter_get_value(r, conf->hcv,
-                                                      conf->height);
-    if (ctx->max_height == 0) {
-        return NULL;
+    if (conf->filter == NGX_HTTP_IMAGE_ROTATE) {
+        return ngx_http_image_resize(r, ctx);
     }
 
     if (rc == NGX_OK
@@ -746,37 +926,152 @@ ngx_http_image_size(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
 }
 
 
+static ngx_int_t
+ngx_http_image_params(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
+{
+    ngx_http_image_filter_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
+
+    ctx->angle = ngx_http_image_filter_get_value(r, conf->acv, conf->angle);
+
+    if (conf->filter == NGX_HTTP_IMAGE_ROTATE) {
+
+        if (ctx->angle != 90 && ctx->angle != 180 && ctx->angle != 270) {
+            return NGX_ERROR;
+        }
+
+    } else {
+
+        ctx->max_width = ngx_http_image_filter_get_value(r, conf->wcv,
+                                                         conf->width);
+        if (ctx->max_width == 0) {
+            return NGX_ERROR;
+        }
+
+        ctx->max_height = ngx_http_image_filter_get_value(r, conf->hcv,
+                                                          conf->height);
+        if (ctx->max_height == 0) {
+            return NGX_ERROR;
+        }
+    }
+
+    ctx->jpeg_quality = ngx_http_image_filter_get_value(r, conf->jqcv,
+                                                        conf->jpeg_quality);
+    ctx->sharpen = ngx_http_image_filter_get_value(r, conf->shcv,
+                                                   conf->sharpen);
+
+    return NGX_OK;
+}
+
+
 static ngx_buf_t *
 ngx_http_image_resize(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
 {
-    int                            sx, sy, dx, dy, ox, oy, ax, ay, size,
-                                   colors, palette, transparent, sharpen,
-                                   red, green, blue, t;
-    u_char                        *out;
-    ngx_buf_t                     *b;
-    ngx_uint_t                     resize;
-    gdImagePtr                     src, dst;
     ngx_pool_cleanup_t            *cln;
     ngx_http_image_filter_conf_t  *conf;
 
-    src = ngx_http_image_source(r, ctx);
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_http_image_cleanup;
+    cln->data = ctx;
 
-    if (src == NULL) {
+#if (NGX_THREADS)
+    if (conf->thread_pool && ngx_http_image_thread(r, ctx, conf) == NGX_OK) {
+        return NULL;
+    }
+#endif
+
+    ctx->status = ngx_http_image_transform(ctx, conf, r->connection->log);
+
+    return ngx_http_image_result(r, ctx);
+}
+
+
+static ngx_buf_t *
+ngx_http_image_result(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
+{
+    ngx_buf_t  *b;
+
+    if (ctx->status == NGX_DECLINED) {
+        return ngx_http_image_asis(r, ctx);
+    }
+
+    ngx_pfree(r->pool, ctx->image);
+
+    if (ctx->status != NGX_OK) {
+
+        if (ctx->failed) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, ctx->failed);
+        }
+
+        return NULL;
+    }
+
+    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
+    if (b == NULL) {
         return NULL;
     }
 
+    b->pos = ctx->out;
+    b->last = ctx->out + ctx->size;
+    b->memory = 1;
+    b->last_buf = 1;
+
+    ngx_http_image_length(r, b);
+    ngx_http_weak_etag(r);
+
+    if (ctx->cacheable) {
+        ngx_http_image_cache_put(r, ctx, b);
+    }
+
+    return b;
+}
+
+
+/*
+ * ngx_http_image_transform() may run in a thread: it uses neither
+ * the request nor its pool, and reports errors in ctx->failed
+ */
+
+static ngx_int_t
+ngx_http_image_transform(ngx_http_image_filter_ctx_t *ctx,
+    ngx_http_image_filter_conf_t *conf, ngx_log_t *log)
+{
+    int          sx, sy, dx, dy, ox, oy, ax, ay, colors, palette,
+                 transparent, sharpen, red, green, blue, t;
+    ngx_int_t    rc;
+    ngx_uint_t   resize;
+    gdImagePtr   src, dst;
+
+    ctx->scale = 1;
+
+#if (NGX_HAVE_LIBJPEG)
+    ctx->scale = ngx_http_image_jpeg_scale(ctx, conf);
+#endif
+
+    src = ngx_http_image_source(ctx, log);
+
+    if (src == NULL) {
+        return NGX_ERROR;
+    }
+
     sx = gdImageSX(src);
     sy = gdImageSY(src);
 
-    conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
-
     if (!ctx->force
+        && ctx->scale == 1
         && ctx->angle == 0
         && (ngx_uint_t) sx <= ctx->max_width
         && (ngx_uint_t) sy <= ctx->max_height)
     {
         gdImageDestroy(src);
-        return ngx_http_image_asis(r, ctx);
+        return NGX_DECLINED;
     }
 
     colors = gdImageColorsTotal(src);
@@ -850,10 +1145,10 @@ transparent:
     }
 
     if (resize) {
-        dst = ngx_http_image_new(r, dx, dy, palette);
+        dst = ngx_http_image_new(ctx, dx, dy, palette);
         if (dst == NULL) {
             gdImageDestroy(src);
-            return NULL;
+            return NGX_ERROR;
         }
 
         if (colors == 0) {
@@ -883,10 +1178,10 @@ transparent:
 
         case 90:
         case 270:
-            dst = ngx_http_image_new(r, dy, dx, palette);
+            dst = ngx_http_image_new(ctx, dy, dx, palette);
             if (dst == NULL) {
                 gdImageDestroy(src);
-                return NULL;
+                return NGX_ERROR;
             }
             if (ctx->angle == 90) {
                 ox = dy / 2 + ay;
@@ -907,10 +1202,10 @@ transparent:
             break;
 
         case 180:
-            dst = ngx_http_image_new(r, dx, dy, palette);
+            dst = ngx_http_image_new(ctx, dx, dy, palette);
             if (dst == NULL) {
                 gdImageDestroy(src);
-                return NULL;
+                return NGX_ERROR;
             }
             gdImageCopyRotated(dst, src, dx / 2 - ax, dy / 2 - ay, 0, 0,
                                dx + ax, dy + ay, ctx->angle);
@@ -939,17 +1234,17 @@ transparent:
 
         if (ox || oy) {
 
-            dst = ngx_http_image_new(r, dx - ox, dy - oy, colors);
+            dst = ngx_http_image_new(ctx, dx - ox, dy - oy, colors);
 
             if (dst == NULL) {
                 gdImageDestroy(src);
-                return NULL;
+                return NGX_ERROR;
             }
 
             ox /= 2;
             oy /= 2;
 
-            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, log, 0,
                            "image crop: %d x %d @ %d x %d",
                            dx, dy, ox, oy);
 
@@ -972,54 +1267,26 @@ transparent:
         gdImageColorTransparent(dst, gdImageColorExact(dst, red, green, blue));
     }
 
-    sharpen = ngx_http_image_filter_get_value(r, conf->shcv, conf->sharpen);
+    sharpen = ctx->sharpen;
     if (sharpen > 0) {
         gdImageSharpen(dst, sharpen);
     }
 
     gdImageInterlace(dst, (int) conf->interlace);
 
-    out = ngx_http_image_out(r, ctx->type, dst, &size);
+    rc = ngx_http_image_out(ctx, dst);
 
-    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, log, 0,
                    "image: %d x %d %d", sx, sy, colors);
 
     gdImageDestroy(dst);
-    ngx_pfree(r->pool, ctx->image);
-
-    if (out == NULL) {
-        return NULL;
-    }
-
-    cln = ngx_pool_cleanup_add(r->pool, 0);
-    if (cln == NULL) {
-        gdFree(out);
-        return NULL;
-    }
-
-    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
-    if (b == NULL) {
-        gdFree(out);
-        return NULL;
-    }
-
-    cln->handler = ngx_http_image_cleanup;
-    cln->data = out;
 
-    b->pos = out;
-    b->last = out + size;
-    b->memory = 1;
-    b->last_buf = 1;
-
-    ngx_http_image_length(r, b);
-    ngx_http_weak_etag(r);
-
-    return b;
+    return rc;
 }
 
 
 static gdImagePtr
-ngx_http_image_source(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
+ngx_http_image_source(ngx_http_image_filter_ctx_t *ctx, ngx_log_t *log)
 {
     char        *failed;
     gdImagePtr   img;
@@ -1029,6 +1296,21 @@ ngx_http_image_source(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
     switch (ctx->type) {
 
     case NGX_HTTP_IMAGE_JPEG:
+
+#if (NGX_HAVE_LIBJPEG)
+        if (ctx->scale > 1) {
+            img = ngx_http_image_jpeg_source(ctx, log);
+
+            if (img) {
+                return img;
+            }
+
+            /* fall back to the full size decoding */
+
+            ctx->scale = 1;
+        }
+#endif
+
         img = gdImageCreateFromJpegPtr(ctx->length, ctx->image);
         failed = "gdImageCreateFromJpegPtr() failed";
         break;
@@ -1049,7 +1331,7 @@ ngx_http_image_source(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
     }
 
     if (img == NULL) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, failed);
+        ctx->failed = failed;
     }
 
     return img;
@@ -1057,7 +1339,7 @@ ngx_http_image_source(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
 
 
 static gdImagePtr
-ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
+ngx_http_image_new(ngx_http_image_filter_ctx_t *ctx, int w, int h, int colors)
 {
     gdImagePtr  img;
 
@@ -1065,8 +1347,7 @@ ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
         img = gdImageCreateTrueColor(w, h);
 
         if (img == NULL) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "gdImageCreateTrueColor() failed");
+            ctx->failed = "gdImageCreateTrueColor() failed";
             return NULL;
         }
 
@@ -1074,8 +1355,7 @@ ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
         img = gdImageCreate(w, h);
 
         if (img == NULL) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "gdImageCreate() failed");
+            ctx->failed = "gdImageCreate() failed";
             return NULL;
         }
     }
@@ -1084,38 +1364,35 @@ ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
 }
 
 
-static u_char *
-ngx_http_image_out(ngx_http_request_t *r, ngx_uint_t type, gdImagePtr img,
-    int *size)
+static ngx_int_t
+ngx_http_image_out(ngx_http_image_filter_ctx_t *ctx, gdImagePtr img)
 {
-    char                          *failed;
-    u_char                        *out;
-    ngx_int_t                      jq;
-    ngx_http_image_filter_conf_t  *conf;
+    char       *failed;
+    u_char     *out;
+    ngx_int_t   jq;
 
     out = NULL;
 
-    switch (type) {
+    switch (ctx->type) {
 
     case NGX_HTTP_IMAGE_JPEG:
-        conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
 
-        jq = ngx_http_image_filter_get_value(r, conf->jqcv, conf->jpeg_quality);
+        jq = ctx->jpeg_quality;
         if (jq <= 0) {
-            return NULL;
+            return NGX_ERROR;
         }
 
-        out = gdImageJpegPtr(img, size, jq);
+        out = gdImageJpegPtr(img, &ctx->size, jq);
         failed = "gdImageJpegPtr() failed";
         break;
 
     case NGX_HTTP_IMAGE_GIF:
-        out = gdImageGifPtr(img, size);
+        out = gdImageGifPtr(img, &ctx->size);
         failed = "gdImageGifPtr() failed";
         break;
 
     case NGX_HTTP_IMAGE_PNG:
-        out = gdImagePngPtr(img, size);
+        out = gdImagePngPtr(img, &ctx->size);
         failed = "gdImagePngPtr() failed";
         break;
 
@@ -1125,32 +1402,583 @@ ngx_http_image_out(ngx_http_request_t *r, ngx_uint_t type, gdImagePtr img,
     }
 
     if (out == NULL) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, failed);
+        ctx->failed = failed;
+        return NGX_ERROR;
     }
 
-    return out;
+    ctx->out = out;
+
+    return NGX_OK;
 }
 
 
 static void
 ngx_http_image_cleanup(void *data)
 {
-    gdFree(data);
+    ngx_http_image_filter_ctx_t  *ctx = data;
+
+    if (ctx->out) {
+        gdFree(ctx->out);
+    }
 }
 
 
+#if (NGX_HAVE_LIBJPEG)
+
+/*
+ * libjpeg is able to scale a JPEG image down by 1/2, 1/4, or 1/8 while
+ * decoding it, choose the smallest scale which is still not less than
+ * the resulting size, so that the resampling is left to gd
+ */
+
 static ngx_uint_t
-ngx_http_image_filter_get_value(ngx_http_request_t *r,
-    ngx_http_complex_value_t *cv, ngx_uint_t v)
+ngx_http_image_jpeg_scale(ngx_http_image_filter_ctx_t *ctx,
+    ngx_http_image_filter_conf_t *conf)
 {
-    ngx_str_t  val;
+    ngx_uint_t  scale, w, h;
 
-    if (cv == NULL) {
-        return v;
+    if (ctx->type != NGX_HTTP_IMAGE_JPEG
+        || ctx->width == 0
+        || ctx->height == 0)
+    {
+        return 1;
     }
 
-    if (ngx_http_complex_value(r, cv, &val) != NGX_OK) {
-        return 0;
+    for (scale = 8; scale > 1; scale /= 2) {
+        w = ctx->width / scale;
+        h = ctx->height / scale;
+
+        if (conf->filter == NGX_HTTP_IMAGE_RESIZE) {
+            if (w >= ctx->max_width || h >= ctx->max_height) {
+                break;
+            }
+
+        } else if (conf->filter == NGX_HTTP_IMAGE_CROP) {
+            if (w >= ctx->max_width && h >= ctx->max_height) {
+                break;
+            }
+
+        } else {
+            return 1;
+        }
+    }
+
+    return scale;
+}
+
+
+static gdImagePtr
+ngx_http_image_jpeg_source(ngx_http_image_filter_ctx_t *ctx, ngx_log_t *log)
+{
+    u_char                         *p;
+    JSAMPARRAY                      row;
+    JDIMENSION                      x, y;
+    gdImagePtr volatile             img;
+    ngx_http_image_jpeg_error_t     jerr;
+    struct jpeg_decompress_struct   cinfo;
+
+    img = NULL;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = ngx_http_image_jpeg_error_exit;
+    jerr.pub.output_message = ngx_http_image_jpeg_output_message;
+
+    if (setjmp(jerr.jmp)) {
+        jpeg_destroy_decompress(&cinfo);
+
+        if (img) {
+            gdImageDestroy(img);
+        }
+
+        return NULL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, ctx->image, ctx->last - ctx->image);
+
+    jpeg_read_header(&cinfo, TRUE);
+
+    if (cinfo.jpeg_color_space == JCS_CMYK
+        || cinfo.jpeg_color_space == JCS_YCCK)
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+
+    cinfo.out_color_space = JCS_RGB;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = ctx->scale;
+
+    jpeg_start_decompress(&cinfo);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "image jpeg scale 1/%ui: %ud x %ud",
+                   ctx->scale, cinfo.output_width, cinfo.output_height);
+
+    img = gdImageCreateTrueColor(cinfo.output_width, cinfo.output_height);
+    if (img == NULL) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+
+    row = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE,
+                                     cinfo.output_width
+                                     * cinfo.output_components, 1);
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+        y = cinfo.output_scanline;
+
+        jpeg_read_scanlines(&cinfo, row, 1);
+
+        p = row[0];
+
+        for (x = 0; x < cinfo.output_width; x++) {
+            img->tpixels[y][x] = gdTrueColor(p[0], p[1], p[2]);
+            p += 3;
+        }
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    return img;
+}
+
+
+static void
+ngx_http_image_jpeg_error_exit(j_common_ptr cinfo)
+{
+    ngx_http_image_jpeg_error_t  *jerr;
+
+    jerr = (ngx_http_image_jpeg_error_t *) cinfo->err;
+
+    longjmp(jerr->jmp, 1);
+}
+
+
+static void
+ngx_http_image_jpeg_output_message(j_common_ptr cinfo)
+{
+    /* warnings are ignored as gd does */
+}
+
+#endif
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_image_thread(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx,
+    ngx_http_image_filter_conf_t *conf)
+{
+    ngx_thread_task_t            *task;
+    ngx_http_image_thread_ctx_t  *tctx;
+
+    task = ngx_thread_task_alloc(r->pool, sizeof(ngx_http_image_thread_ctx_t));
+    if (task == NULL) {
+        return NGX_ERROR;
+    }
+
+    tctx = task->ctx;
+
+    tctx->ctx = ctx;
+    tctx->conf = conf;
+
+    task->handler = ngx_http_image_thread_handler;
+    task->event.data = r;
+    task->event.handler = ngx_http_image_thread_event_handler;
+
+    if (ngx_thread_task_post(conf->thread_pool, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    r->connection->buffered |= NGX_HTTP_IMAGE_BUFFERED;
+    ctx->phase = NGX_HTTP_IMAGE_THREAD;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_image_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_image_thread_ctx_t *tctx = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "image filter thread handler");
+
+    tctx->ctx->status = ngx_http_image_transform(tctx->ctx, tctx->conf, log);
+}
+
+
+static void
+ngx_http_image_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    r->connection->write->handler(r->connection->write);
+}
+
+#endif
+
+
+static void
+ngx_http_image_skip(ngx_chain_t *in)
+{
+    ngx_chain_t  *cl;
+
+    for (cl = in; cl; cl = cl->next) {
+        cl->buf->pos = cl->buf->last;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_image_cache_key(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx)
+{
+    u_char                        *p;
+    ngx_md5_t                      md5;
+    ngx_table_elt_t               *etag;
+    ngx_http_image_filter_conf_t  *conf;
+    u_char                         buf[NGX_OFF_T_LEN + NGX_TIME_T_LEN
+                                       + 9 * NGX_INT_T_LEN + 10];
+
+    etag = r->headers_out.etag;
+
+    /* a source without validators may change unnoticed */
+
+    if (r->headers_out.last_modified_time == -1 && etag == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_http_image_params(r, ctx) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
+
+    p = ngx_sprintf(buf, "%O:%T:%ui:%ui:%ui:%ui:%ui:%ui:%ui:%i:%i",
+                    r->headers_out.content_length_n,
+                    r->headers_out.last_modified_time,
+                    conf->filter, ctx->type, ctx->max_width, ctx->max_height,
+                    ctx->angle, ctx->jpeg_quality, ctx->sharpen,
+                    conf->interlace, conf->transparency);
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, r->headers_in.server.data, r->headers_in.server.len);
+    ngx_md5_update(&md5, r->uri.data, r->uri.len);
+    ngx_md5_update(&md5, "?", 1);
+    ngx_md5_update(&md5, r->args.data, r->args.len);
+    ngx_md5_update(&md5, buf, p - buf);
+
+    if (etag) {
+        ngx_md5_update(&md5, etag->value.data, etag->value.len);
+    }
+
+    ngx_md5_final(ctx->key, &md5);
+
+    ctx->cacheable = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_buf_t *
+ngx_http_image_cache_get(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx)
+{
+    u_char                        *p;
+    size_t                         len;
+    ngx_buf_t                     *b;
+    ngx_http_image_cache_t        *cache;
+    ngx_http_image_cache_node_t   *icn;
+    ngx_http_image_filter_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
+
+    cache = conf->cache->data;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    icn = ngx_http_image_cache_lookup(cache, ctx->key);
+
+    if (icn == NULL || icn->type != ctx->type) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "image cache miss");
+        return NULL;
+    }
+
+    ngx_queue_remove(&icn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &icn->queue);
+
+    len = icn->len;
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p) {
+        ngx_memcpy(p, icn->data, len);
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (p == NULL) {
+        return NULL;
+    }
+
+    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->pos = p;
+    b->last = p + len;
+    b->memory = 1;
+    b->last_buf = 1;
+
+    ngx_http_image_length(r, b);
+    ngx_http_weak_etag(r);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "image cache hit: %uz", len);
+
+    return b;
+}
+
+
+static void
+ngx_http_image_cache_put(ngx_http_request_t *r,
+    ngx_http_image_filter_ctx_t *ctx, ngx_buf_t *b)
+{
+    size_t                         len;
+    ngx_queue_t                   *q;
+    ngx_http_image_cache_t        *cache;
+    ngx_http_image_cache_node_t   *icn, *old;
+    ngx_http_image_filter_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
+
+    len = b->last - b->pos;
+
+    /* a single variant should not flush the whole zone */
+
+    if (len > conf->cache->shm.size / 8) {
+        return;
+    }
+
+    cache = conf->cache->data;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (ngx_http_image_cache_lookup(cache, ctx->key)) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
+
+    for ( ;; ) {
+        icn = ngx_slab_alloc_locked(cache->shpool,
+                               offsetof(ngx_http_image_cache_node_t, data) + len);
+        if (icn) {
+            break;
+        }
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return;
+        }
+
+        /* evict the least recently used variant */
+
+        q = ngx_queue_last(&cache->sh->queue);
+        old = ngx_queue_data(q, ngx_http_image_cache_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->sh->rbtree, &old->node);
+        ngx_slab_free_locked(cache->shpool, old);
+    }
+
+    ngx_memcpy((u_char *) &icn->node.key, ctx->key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(icn->key, &ctx->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_IMAGE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    icn->type = ctx->type;
+    icn->len = len;
+    ngx_memcpy(icn->data, b->pos, len);
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &icn->node);
+    ngx_queue_insert_head(&cache->sh->queue, &icn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "image cache store: %uz", len);
+}
+
+
+static ngx_http_image_cache_node_t *
+ngx_http_image_cache_lookup(ngx_http_image_cache_t *cache, u_char *key)
+{
+    ngx_int_t                     rc;
+    ngx_rbtree_key_t              node_key;
+    ngx_rbtree_node_t            *node, *sentinel;
+    ngx_http_image_cache_node_t  *icn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        icn = (ngx_http_image_cache_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], icn->key,
+                        NGX_HTTP_IMAGE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return icn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static void
+ngx_http_image_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t            **p;
+    ngx_http_image_cache_node_t   *icn, *icnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            icn = (ngx_http_image_cache_node_t *) node;
+            icnt = (ngx_http_image_cache_node_t *) temp;
+
+            p = (ngx_memcmp(icn->key, icnt->key,
+                            NGX_HTTP_IMAGE_KEY_LEN - sizeof(ngx_rbtree_key_t))
+                 < 0)
+                    ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_http_image_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_image_cache_t  *ocache = data;
+
+    size_t                   len;
+    ngx_http_image_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_http_image_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_http_image_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in image_filter_cache zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in image_filter_cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* eviction handles allocation failures */
+
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_image_filter_get_value(ngx_http_request_t *r,
+    ngx_http_complex_value_t *cv, ngx_uint_t v)
+{
+    ngx_str_t  val;
+
+    if (cv == NULL) {
+        return v;
+    }
+
+    if (ngx_http_complex_value(r, cv, &val) != NGX_OK) {
+        return 0;
     }
 
     return ngx_http_image_filter_value(&val);
@@ -1205,6 +2033,11 @@ ngx_http_image_filter_create_conf(ngx_conf_t *cf)
     conf->transparency = NGX_CONF_UNSET;
     conf->interlace = NGX_CONF_UNSET;
     conf->buffer_size = NGX_CONF_UNSET_SIZE;
+    conf->cache = NGX_CONF_UNSET_PTR;
+
+#if (NGX_THREADS)
+    conf->thread_pool = NGX_CONF_UNSET_PTR;
+#endif
 
     return conf;
 }
@@ -1257,6 +2090,12 @@ ngx_http_image_filter_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->buffer_size, prev->buffer_size,
                               1 * 1024 * 1024);
 
+    ngx_conf_merge_ptr_value(conf->cache, prev->cache, NULL);
+
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif
+
     return NGX_CONF_OK;
 }
 
@@ -1508,6 +2347,136 @@ ngx_http_image_filter_sharpen(ngx_conf_t *cf, ngx_command_t *cmd,
 }
 
 
+static char *
+ngx_http_image_filter_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    u_char                  *p;
+    ssize_t                  size;
+    ngx_str_t               *value, name, s;
+    ngx_shm_zone_t          *shm_zone;
+    ngx_http_image_cache_t  *cache;
+
+    value = cf->args->elts;
+
+    p = (u_char *) ngx_strchr(value[1].data, ':');
+
+    if (p == NULL || p == value[1].data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.data = value[1].data;
+    name.len = p - name.data;
+
+    s.data = p + 1;
+    s.len = value[1].data + value[1].len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_image_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_image_filter_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_image_cache_init_zone;
+    shm_zone->data = cache;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_image_filter_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_image_filter_conf_t *imcf = conf;
+
+    ngx_str_t  *value;
+
+    if (imcf->cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        imcf->cache = NULL;
+        return NGX_CONF_OK;
+    }
+
+    imcf->cache = ngx_shared_memory_add(cf, &value[1], 0,
+                                        &ngx_http_image_filter_module);
+    if (imcf->cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_image_filter_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+#if (NGX_THREADS)
+    ngx_http_image_filter_conf_t *imcf = conf;
+
+    ngx_str_t  *value;
+
+    if (imcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        imcf->thread_pool = NULL;
+        return NGX_CONF_OK;
+    }
+
+    imcf->thread_pool = ngx_thread_pool_add(cf, &value[1]);
+    if (imcf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+
+#else
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"image_filter_thread_pool\" is unsupported "
+                       "on this platform");
+    return NGX_CONF_ERROR;
+
+#endif
+}
+
+
 static ngx_int_t
 ngx_http_image_filter_init(ngx_conf_t *cf)
 {
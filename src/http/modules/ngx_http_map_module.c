@@ -8,11 +8,13 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_md5.h>
 
 
 typedef struct {
     ngx_uint_t                  hash_max_size;
     ngx_uint_t                  hash_bucket_size;
+    ngx_array_t                 refresh;
 } ngx_http_map_conf_t;
 
 
@@ -27,7 +29,15 @@ typedef struct {
 
     ngx_http_variable_value_t  *default_value;
     ngx_conf_t                 *cf;
-    ngx_uint_t                  hostnames;      /* unsigned  hostnames:1 */
+    ngx_conf_file_t            *conf_file;
+    ngx_msec_t                  refresh;
+    ngx_str_t                   include_name;
+    ngx_uint_t                  includes;
+
+    unsigned                    hostnames:1;
+    unsigned                    outside_entries:1;
+    unsigned                    included_params:1;
+    unsigned                    refreshing:1;
 } ngx_http_map_conf_ctx_t;
 
 
@@ -36,6 +46,12 @@ typedef struct {
     ngx_http_complex_value_t    value;
     ngx_http_variable_value_t  *default_value;
     ngx_uint_t                  hostnames;      /* unsigned  hostnames:1 */
+
+    ngx_str_t                   name;
+    off_t                       size;
+    u_char                      md5[16];
+    ngx_msec_t                  refresh;
+    ngx_pool_t                 *pool;
 } ngx_http_map_ctx_t;
 
 
@@ -44,6 +60,15 @@ static int ngx_libc_cdecl ngx_http_map_cmp_dns_wildcards(const void *one,
 static void *ngx_http_map_create_conf(ngx_conf_t *cf);
 static char *ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_http_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf);
+static ngx_int_t ngx_http_map_init_hash(ngx_http_map_conf_ctx_t *ctx,
+    ngx_http_map_conf_t *mcf, ngx_http_map_t *map, ngx_pool_t *pool,
+    ngx_pool_t *temp_pool);
+static ngx_int_t ngx_http_map_file_md5(u_char *name, off_t *size,
+    u_char *md5, ngx_uint_t level, ngx_log_t *log);
+static void ngx_http_map_cleanup(void *data);
+static ngx_int_t ngx_http_map_init_process(ngx_cycle_t *cycle);
+static void ngx_http_map_refresh_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_map_refresh(ngx_http_map_ctx_t *map, ngx_log_t *log);
 
 
 static ngx_command_t  ngx_http_map_commands[] = {
@@ -95,7 +120,7 @@ ngx_module_t  ngx_http_map_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_map_init_process,             /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -110,6 +135,7 @@ ngx_http_map_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 {
     ngx_http_map_ctx_t  *map = (ngx_http_map_ctx_t *) data;
 
+    u_char                     *p;
     ngx_str_t                   val;
     ngx_http_variable_value_t  *value;
 
@@ -140,6 +166,16 @@ ngx_http_map_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 
     *v = *value;
 
+    if (map->refresh && v->len) {
+        p = ngx_pnalloc(r->pool, v->len);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(p, v->data, v->len);
+        v->data = p;
+    }
+
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http map: \"%V\" \"%v\"", &val, v);
 
@@ -160,6 +196,13 @@ ngx_http_map_create_conf(ngx_conf_t *cf)
     mcf->hash_max_size = NGX_CONF_UNSET_UINT;
     mcf->hash_bucket_size = NGX_CONF_UNSET_UINT;
 
+    if (ngx_array_init(&mcf->refresh, cf->pool, 1,
+                       sizeof(ngx_http_map_ctx_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
     return mcf;
 }
 
@@ -173,8 +216,8 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_str_t                         *value, name;
     ngx_conf_t                         save;
     ngx_pool_t                        *pool;
-    ngx_hash_init_t                    hash;
-    ngx_http_map_ctx_t                *map;
+    ngx_pool_cleanup_t                *cln;
+    ngx_http_map_ctx_t                *map, **m;
     ngx_http_variable_t               *var;
     ngx_http_map_conf_ctx_t            ctx;
     ngx_http_compile_complex_value_t   ccv;
@@ -265,7 +308,13 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ctx.default_value = NULL;
     ctx.cf = &save;
+    ctx.conf_file = cf->conf_file;
+    ctx.refresh = 0;
+    ctx.includes = 0;
     ctx.hostnames = 0;
+    ctx.outside_entries = 0;
+    ctx.included_params = 0;
+    ctx.refreshing = 0;
 
     save = *cf;
     cf->pool = pool;
@@ -282,81 +331,169 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return rv;
     }
 
+    if (ctx.refresh && ctx.includes == 1) {
+
+        /* the include parameter is allocated in the temporary pool */
+
+        map->name.len = ctx.include_name.len;
+        map->name.data = ngx_pnalloc(cf->pool, map->name.len + 1);
+        if (map->name.data == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_cpystrn(map->name.data, ctx.include_name.data, map->name.len + 1);
+    }
+
     map->default_value = ctx.default_value ? ctx.default_value:
                                              &ngx_http_variable_null_value;
 
     map->hostnames = ctx.hostnames;
 
+    if (ngx_http_map_init_hash(&ctx, mcf, &map->map, cf->pool, pool)
+        != NGX_OK)
+    {
+        ngx_destroy_pool(pool);
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_destroy_pool(pool);
+
+    if (ctx.refresh == 0) {
+        return NGX_CONF_OK;
+    }
+
+    if (ctx.includes != 1 || ctx.outside_entries || ctx.included_params) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"refresh\" requires the only \"include\" "
+                           "without other entries");
+        return NGX_CONF_ERROR;
+    }
+
+    if (ctx.var_values.nelts
+#if (NGX_PCRE)
+        || ctx.regexes.nelts
+#endif
+       )
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"refresh\" cannot be used with variables "
+                           "and regular expressions");
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, &map->name, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (strpbrk((char *) map->name.data, "*?[") != NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"refresh\" cannot be used with a mask "
+                           "in \"include\"");
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_map_file_md5(map->name.data, &map->size, map->md5,
+                              NGX_LOG_EMERG, cf->log)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    map->refresh = ctx.refresh;
+
+    /* the data of the first refresh are freed with the cycle pool */
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_http_map_cleanup;
+    cln->data = map;
+
+    m = ngx_array_push(&mcf->refresh);
+    if (m == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *m = map;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_map_init_hash(ngx_http_map_conf_ctx_t *ctx, ngx_http_map_conf_t *mcf,
+    ngx_http_map_t *map, ngx_pool_t *pool, ngx_pool_t *temp_pool)
+{
+    ngx_hash_init_t  hash;
+
     hash.key = ngx_hash_key_lc;
     hash.max_size = mcf->hash_max_size;
     hash.bucket_size = mcf->hash_bucket_size;
     hash.name = "map_hash";
-    hash.pool = cf->pool;
+    hash.pool = pool;
 
-    if (ctx.keys.keys.nelts) {
-        hash.hash = &map->map.hash.hash;
+    if (ctx->keys.keys.nelts) {
+        hash.hash = &map->hash.hash;
         hash.temp_pool = NULL;
 
-        if (ngx_hash_init(&hash, ctx.keys.keys.elts, ctx.keys.keys.nelts)
+        if (ngx_hash_init(&hash, ctx->keys.keys.elts, ctx->keys.keys.nelts)
             != NGX_OK)
         {
-            ngx_destroy_pool(pool);
-            return NGX_CONF_ERROR;
+            return NGX_ERROR;
         }
     }
 
-    if (ctx.keys.dns_wc_head.nelts) {
+    if (ctx->keys.dns_wc_head.nelts) {
 
-        ngx_qsort(ctx.keys.dns_wc_head.elts,
-                  (size_t) ctx.keys.dns_wc_head.nelts,
+        ngx_qsort(ctx->keys.dns_wc_head.elts,
+                  (size_t) ctx->keys.dns_wc_head.nelts,
                   sizeof(ngx_hash_key_t), ngx_http_map_cmp_dns_wildcards);
 
         hash.hash = NULL;
-        hash.temp_pool = pool;
+        hash.temp_pool = temp_pool;
 
-        if (ngx_hash_wildcard_init(&hash, ctx.keys.dns_wc_head.elts,
-                                   ctx.keys.dns_wc_head.nelts)
+        if (ngx_hash_wildcard_init(&hash, ctx->keys.dns_wc_head.elts,
+                                   ctx->keys.dns_wc_head.nelts)
             != NGX_OK)
         {
-            ngx_destroy_pool(pool);
-            return NGX_CONF_ERROR;
+            return NGX_ERROR;
         }
 
-        map->map.hash.wc_head = (ngx_hash_wildcard_t *) hash.hash;
+        map->hash.wc_head = (ngx_hash_wildcard_t *) hash.hash;
     }
 
-    if (ctx.keys.dns_wc_tail.nelts) {
+    if (ctx->keys.dns_wc_tail.nelts) {
 
-        ngx_qsort(ctx.keys.dns_wc_tail.elts,
-                  (size_t) ctx.keys.dns_wc_tail.nelts,
+        ngx_qsort(ctx->keys.dns_wc_tail.elts,
+                  (size_t) ctx->keys.dns_wc_tail.nelts,
                   sizeof(ngx_hash_key_t), ngx_http_map_cmp_dns_wildcards);
 
         hash.hash = NULL;
-        hash.temp_pool = pool;
+        hash.temp_pool = temp_pool;
 
-        if (ngx_hash_wildcard_init(&hash, ctx.keys.dns_wc_tail.elts,
-                                   ctx.keys.dns_wc_tail.nelts)
+        if (ngx_hash_wildcard_init(&hash, ctx->keys.dns_wc_tail.elts,
+                                   ctx->keys.dns_wc_tail.nelts)
             != NGX_OK)
         {
-            ngx_destroy_pool(pool);
-            return NGX_CONF_ERROR;
+            return NGX_ERROR;
         }
 
-        map->map.hash.wc_tail = (ngx_hash_wildcard_t *) hash.hash;
+        map->hash.wc_tail = (ngx_hash_wildcard_t *) hash.hash;
     }
 
 #if (NGX_PCRE)
 
-    if (ctx.regexes.nelts) {
-        map->map.regex = ctx.regexes.elts;
-        map->map.nregex = ctx.regexes.nelts;
+    if (ctx->regexes.nelts) {
+        map->regex = ctx->regexes.elts;
+        map->nregex = ctx->regexes.nelts;
     }
 
 #endif
 
-    ngx_destroy_pool(pool);
-
-    return rv;
+    return NGX_OK;
 }
 
 
@@ -377,6 +514,7 @@ ngx_http_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
 {
     ngx_int_t                   rv, index;
     ngx_str_t                  *value, name;
+    ngx_msec_t                  refresh;
     ngx_uint_t                  i, key;
     ngx_http_map_conf_ctx_t    *ctx;
     ngx_http_variable_value_t  *var, **vp;
@@ -388,6 +526,10 @@ ngx_http_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
     if (cf->args->nelts == 1
         && ngx_strcmp(value[0].data, "hostnames") == 0)
     {
+        if (cf->conf_file != ctx->conf_file) {
+            ctx->included_params = 1;
+        }
+
         ctx->hostnames = 1;
         return NGX_CONF_OK;
 
@@ -397,7 +539,47 @@ ngx_http_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    refresh = 0;
+
+    if (ngx_strcmp(value[0].data, "refresh") == 0) {
+
+        /* "refresh" with a value other than time is an ordinary entry */
+
+        refresh = ngx_parse_time(&value[1], 0);
+
+        if (refresh == (ngx_msec_t) NGX_ERROR) {
+            refresh = 0;
+        }
+    }
+
+    if (ctx->refreshing
+        && (ngx_strcmp(value[0].data, "include") == 0
+            || ngx_strcmp(value[0].data, "default") == 0
+            || refresh
+            || value[0].data[0] == '~'
+            || value[1].data[0] == '$'))
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "only plain entries can be used in refreshed map "
+                           "file, \"%V %V\" found", &value[0], &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (refresh) {
+
+        if (cf->conf_file != ctx->conf_file) {
+            ctx->included_params = 1;
+        }
+
+        ctx->refresh = refresh;
+
+        return NGX_CONF_OK;
+    }
+
     if (ngx_strcmp(value[0].data, "include") == 0) {
+        ctx->include_name = value[1];
+        ctx->includes++;
+
         return ngx_conf_include(cf, dummy, conf);
     }
 
@@ -491,6 +673,10 @@ found:
 
     if (ngx_strcmp(value[0].data, "default") == 0) {
 
+        if (cf->conf_file != ctx->conf_file) {
+            ctx->included_params = 1;
+        }
+
         if (ctx->default_value) {
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                "duplicate default map parameter");
@@ -546,6 +732,10 @@ found:
         value[0].data++;
     }
 
+    if (cf->conf_file == ctx->conf_file) {
+        ctx->outside_entries = 1;
+    }
+
     rv = ngx_hash_add_key(&ctx->keys, &value[0], var,
                           (ctx->hostnames) ? NGX_HASH_WILDCARD_KEY : 0);
 
@@ -565,3 +755,268 @@ found:
 
     return NGX_CONF_ERROR;
 }
+
+
+static ngx_int_t
+ngx_http_map_file_md5(u_char *name, off_t *size, u_char *md5,
+    ngx_uint_t level, ngx_log_t *log)
+{
+    u_char     buf[4096];
+    ssize_t    n;
+    ngx_fd_t   fd;
+    ngx_int_t  rc;
+    ngx_md5_t  ctx;
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(level, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        return NGX_ERROR;
+    }
+
+    ngx_md5_init(&ctx);
+
+    *size = 0;
+    rc = NGX_OK;
+
+    for ( ;; ) {
+        n = ngx_read_fd(fd, buf, 4096);
+
+        if (n == -1) {
+            ngx_log_error(level, log, ngx_errno,
+                          ngx_read_fd_n " \"%s\" failed", name);
+            rc = NGX_ERROR;
+            break;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        ngx_md5_update(&ctx, buf, n);
+        *size += n;
+    }
+
+    ngx_md5_final(md5, &ctx);
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    return rc;
+}
+
+
+static void
+ngx_http_map_cleanup(void *data)
+{
+    ngx_http_map_ctx_t  *map = data;
+
+    if (map->pool) {
+        ngx_destroy_pool(map->pool);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_map_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t             i;
+    ngx_event_t           *ev;
+    ngx_http_map_ctx_t   **map;
+    ngx_http_map_conf_t   *mcf;
+
+    mcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_map_module);
+
+    if (mcf == NULL) {
+        return NGX_OK;
+    }
+
+    map = mcf->refresh.elts;
+
+    for (i = 0; i < mcf->refresh.nelts; i++) {
+        ev = ngx_pcalloc(cycle->pool, sizeof(ngx_event_t));
+        if (ev == NULL) {
+            return NGX_ERROR;
+        }
+
+        ev->handler = ngx_http_map_refresh_handler;
+        ev->data = map[i];
+        ev->log = cycle->log;
+        ev->cancelable = 1;
+
+        ngx_add_timer(ev, map[i]->refresh);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_map_refresh_handler(ngx_event_t *ev)
+{
+    ngx_http_map_ctx_t  *map = ev->data;
+
+    off_t   size;
+    u_char  md5[16];
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    ngx_add_timer(ev, map->refresh);
+
+    /*
+     * the content is compared rather than the modification time,
+     * since the file may be rewritten in place within a second
+     */
+
+    if (ngx_http_map_file_md5(map->name.data, &size, md5, NGX_LOG_ERR,
+                              ev->log)
+        != NGX_OK)
+    {
+        return;
+    }
+
+    if (size == map->size && ngx_memcmp(md5, map->md5, 16) == 0) {
+        return;
+    }
+
+    /* the file is remembered even if it is broken, not to parse it again */
+
+    map->size = size;
+    ngx_memcpy(map->md5, md5, 16);
+
+    if (ngx_http_map_refresh(map, ev->log) != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, ev->log, 0,
+                      "map \"%s\" is not refreshed, previous data are used",
+                      map->name.data);
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, ev->log, 0,
+                  "map \"%s\" refreshed", map->name.data);
+}
+
+
+static ngx_int_t
+ngx_http_map_refresh(ngx_http_map_ctx_t *map, ngx_log_t *log)
+{
+    char                     *rv;
+    ngx_int_t                 rc;
+    ngx_conf_t                cf;
+    ngx_pool_t               *pool, *temp_pool;
+    ngx_cycle_t              *cycle;
+    ngx_http_map_t            hmap;
+    ngx_http_map_conf_t      *mcf;
+    ngx_http_map_conf_ctx_t   ctx;
+
+    mcf = ngx_http_cycle_get_module_main_conf(ngx_cycle, ngx_http_map_module);
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    temp_pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+    if (temp_pool == NULL) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    /*
+     * the file is parsed in the context of a copy of the cycle,
+     * so the configuration dump does not grow the cycle pool
+     */
+
+    cycle = ngx_palloc(temp_pool, sizeof(ngx_cycle_t));
+    if (cycle == NULL) {
+        goto failed;
+    }
+
+    *cycle = *(ngx_cycle_t *) ngx_cycle;
+    cycle->pool = temp_pool;
+
+    if (ngx_array_init(&cycle->config_dump, temp_pool, 1,
+                       sizeof(ngx_conf_dump_t))
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    ngx_memzero(&ctx, sizeof(ngx_http_map_conf_ctx_t));
+
+    ctx.keys.pool = pool;
+    ctx.keys.temp_pool = temp_pool;
+
+    if (ngx_hash_keys_array_init(&ctx.keys, NGX_HASH_LARGE) != NGX_OK) {
+        goto failed;
+    }
+
+    ctx.values_hash = ngx_pcalloc(temp_pool,
+                                  sizeof(ngx_array_t) * ctx.keys.hsize);
+    if (ctx.values_hash == NULL) {
+        goto failed;
+    }
+
+    ctx.hostnames = map->hostnames;
+    ctx.refreshing = 1;
+
+    ngx_memzero(&cf, sizeof(ngx_conf_t));
+
+    cf.args = ngx_array_create(temp_pool, 10, sizeof(ngx_str_t));
+    if (cf.args == NULL) {
+        goto failed;
+    }
+
+    cf.cycle = cycle;
+    cf.pool = temp_pool;
+    cf.temp_pool = temp_pool;
+    cf.log = log;
+    cf.ctx = &ctx;
+    cf.module_type = NGX_HTTP_MODULE;
+    cf.cmd_type = NGX_HTTP_MAIN_CONF;
+    cf.handler = ngx_http_map;
+    cf.handler_conf = (char *) mcf;
+
+    rv = ngx_conf_parse(&cf, &map->name);
+
+    if (rv != NGX_CONF_OK) {
+        goto failed;
+    }
+
+    ngx_memzero(&hmap, sizeof(ngx_http_map_t));
+
+    if (ngx_http_map_init_hash(&ctx, mcf, &hmap, pool, temp_pool) != NGX_OK) {
+        goto failed;
+    }
+
+    /*
+     * values are copied to requests when the map can be refreshed,
+     * so the previous data are not referenced anymore
+     */
+
+    if (map->pool) {
+        ngx_destroy_pool(map->pool);
+    }
+
+    map->map = hmap;
+    map->pool = pool;
+
+    pool = NULL;
+    rc = NGX_OK;
+
+failed:
+
+    ngx_destroy_pool(temp_pool);
+
+    if (pool) {
+        ngx_destroy_pool(pool);
+    }
+
+    return rc;
+}
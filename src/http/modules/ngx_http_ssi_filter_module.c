@@ -8,11 +8,15 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_md5.h>
 
 #define NGX_HTTP_SSI_ERROR          1
 
 #define NGX_HTTP_SSI_DATE_LEN       2048
 
+/* as much as the default output_buffers */
+#define NGX_HTTP_SSI_COPY_MAX       65536
+
 #define NGX_HTTP_SSI_ADD_PREFIX     1
 #define NGX_HTTP_SSI_ADD_ZERO       2
 
@@ -46,6 +50,52 @@ typedef struct {
 } ngx_http_ssi_block_t;
 
 
+typedef struct {
+    ngx_msec_int_t               time;
+    ngx_http_post_subrequest_t  *post_subrequest;
+} ngx_http_ssi_include_t;
+
+
+/* an SSI command found at the [start, end) bytes of a source */
+
+typedef struct {
+    off_t                 start;
+    off_t                 end;
+
+    ngx_uint_t            key;
+    ngx_str_t             command;
+    ngx_uint_t            nparams;
+    ngx_table_elt_t      *params;
+} ngx_http_ssi_item_t;
+
+
+/*
+ * the commands of an SSI source kept by a worker, so that a response
+ * with the same validators is not parsed again
+ */
+
+typedef struct {
+    ngx_rbtree_node_t     node;
+    ngx_queue_t           queue;
+    u_char                key[16];
+
+    ngx_pool_t           *pool;
+    ngx_uint_t            count;
+    ngx_uint_t            expired;
+
+    ngx_uint_t            nitems;
+    ngx_http_ssi_item_t  *items;
+} ngx_http_ssi_template_t;
+
+
+typedef struct {
+    ngx_array_t           items;
+    off_t                 end;
+    off_t                 text;
+    u_char                key[16];
+} ngx_http_ssi_record_t;
+
+
 typedef enum {
     ssi_start_state = 0,
     ssi_tag_state,
@@ -76,6 +126,18 @@ static void ngx_http_ssi_buffered(ngx_http_request_t *r,
     ngx_http_ssi_ctx_t *ctx);
 static ngx_int_t ngx_http_ssi_parse(ngx_http_request_t *r,
     ngx_http_ssi_ctx_t *ctx);
+static ngx_int_t ngx_http_ssi_replay(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx);
+static ngx_int_t ngx_http_ssi_record(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx);
+static ngx_int_t ngx_http_ssi_template_lookup(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx, ngx_http_ssi_loc_conf_t *slcf);
+static ngx_http_ssi_template_t *ngx_http_ssi_template_find(u_char *key);
+static ngx_int_t ngx_http_ssi_template_store(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx);
+static void ngx_http_ssi_template_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static void ngx_http_ssi_template_cleanup(void *data);
 static ngx_str_t *ngx_http_ssi_get_variable(ngx_http_request_t *r,
     ngx_str_t *name, ngx_uint_t key);
 static ngx_int_t ngx_http_ssi_evaluate_string(ngx_http_request_t *r,
@@ -89,6 +151,8 @@ static ngx_int_t ngx_http_ssi_stub_output(ngx_http_request_t *r, void *data,
     ngx_int_t rc);
 static ngx_int_t ngx_http_ssi_set_variable(ngx_http_request_t *r, void *data,
     ngx_int_t rc);
+static ngx_int_t ngx_http_ssi_include_done(ngx_http_request_t *r, void *data,
+    ngx_int_t rc);
 static ngx_int_t ngx_http_ssi_echo(ngx_http_request_t *r,
     ngx_http_ssi_ctx_t *ctx, ngx_str_t **params);
 static ngx_int_t ngx_http_ssi_config(ngx_http_request_t *r,
@@ -108,6 +172,8 @@ static ngx_int_t ngx_http_ssi_endblock(ngx_http_request_t *r,
 
 static ngx_int_t ngx_http_ssi_date_gmt_local_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t gmt);
+static ngx_int_t ngx_http_ssi_include_time_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 
 static ngx_int_t ngx_http_ssi_preconfiguration(ngx_conf_t *cf);
 static void *ngx_http_ssi_create_main_conf(ngx_conf_t *cf);
@@ -170,6 +236,13 @@ static ngx_command_t  ngx_http_ssi_filter_commands[] = {
       offsetof(ngx_http_ssi_loc_conf_t, last_modified),
       NULL },
 
+    { ngx_string("ssi_template_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_ssi_main_conf_t, templates),
+      NULL },
+
       ngx_null_command
 };
 
@@ -212,6 +285,11 @@ static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
 
 static u_char ngx_http_ssi_string[] = "<!--";
 
+static ngx_rbtree_t       ngx_http_ssi_templates;
+static ngx_rbtree_node_t  ngx_http_ssi_templates_sentinel;
+static ngx_queue_t        ngx_http_ssi_templates_queue;
+static ngx_uint_t         ngx_http_ssi_ntemplates;
+
 static ngx_str_t ngx_http_ssi_none = ngx_string("(none)");
 static ngx_str_t ngx_http_ssi_timefmt = ngx_string("%A, %d-%b-%Y %H:%M:%S %Z");
 static ngx_str_t ngx_http_ssi_null_string = ngx_null_string;
@@ -321,6 +399,9 @@ static ngx_http_variable_t  ngx_http_ssi_vars[] = {
     { ngx_string("date_gmt"), NULL, ngx_http_ssi_date_gmt_local_variable, 1,
       NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("ssi_include_time"), NULL,
+      ngx_http_ssi_include_time_variable, 0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
     { ngx_null_string, NULL, NULL, 0, 0, 0 }
 };
 
@@ -329,8 +410,9 @@ static ngx_http_variable_t  ngx_http_ssi_vars[] = {
 static ngx_int_t
 ngx_http_ssi_header_filter(ngx_http_request_t *r)
 {
-    ngx_http_ssi_ctx_t       *ctx;
-    ngx_http_ssi_loc_conf_t  *slcf;
+    ngx_http_ssi_ctx_t        *ctx;
+    ngx_http_ssi_loc_conf_t   *slcf;
+    ngx_http_ssi_main_conf_t  *smcf;
 
     slcf = ngx_http_get_module_loc_conf(r, ngx_http_ssi_filter_module);
 
@@ -351,6 +433,7 @@ ngx_http_ssi_header_filter(ngx_http_request_t *r)
 
     ctx->value_len = slcf->value_len;
     ctx->last_out = &ctx->out;
+    ctx->last_busy = &ctx->busy;
 
     ctx->encoding = NGX_HTTP_SSI_ENTITY_ENCODING;
     ctx->output = 1;
@@ -364,6 +447,14 @@ ngx_http_ssi_header_filter(ngx_http_request_t *r)
     ngx_str_set(&ctx->errmsg,
                 "[an error occurred while processing the directive]");
 
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_ssi_filter_module);
+
+    if (smcf->templates
+        && ngx_http_ssi_template_lookup(r, ctx, slcf) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
     r->filter_need_in_memory = 1;
 
     if (r == r->main) {
@@ -386,6 +477,7 @@ ngx_http_ssi_header_filter(ngx_http_request_t *r)
 static ngx_int_t
 ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
+    u_char                    *p, *pos;
     size_t                     len;
     ngx_int_t                  rc;
     ngx_buf_t                 *b;
@@ -395,6 +487,7 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     ngx_http_ssi_ctx_t        *ctx, *mctx;
     ngx_http_ssi_block_t      *bl;
     ngx_http_ssi_param_t      *prm;
+    ngx_http_ssi_record_t     *rec;
     ngx_http_ssi_command_t    *cmd;
     ngx_http_ssi_loc_conf_t   *slcf;
     ngx_http_ssi_main_conf_t  *smcf;
@@ -456,6 +549,7 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             ctx->buf = ctx->in->buf;
             ctx->in = ctx->in->next;
             ctx->pos = ctx->buf->pos;
+            ctx->referenced = 0;
         }
 
         if (ctx->state == ssi_start_state) {
@@ -470,7 +564,16 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "saved: %uz state: %ui", ctx->saved, ctx->state);
 
-            rc = ngx_http_ssi_parse(r, ctx);
+            pos = ctx->pos;
+
+            if (ctx->template) {
+                rc = ngx_http_ssi_replay(r, ctx);
+
+            } else {
+                rc = ngx_http_ssi_parse(r, ctx);
+            }
+
+            ctx->offset += ctx->pos - pos;
 
             ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "parse: %i, looked: %uz %p-%p",
@@ -480,8 +583,18 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
                 return rc;
             }
 
+            if (rc == NGX_HTTP_SSI_ERROR) {
+                ctx->record = NULL;
+            }
+
             if (ctx->copy_start != ctx->copy_end) {
 
+                if (ctx->record) {
+                    rec = ctx->record;
+                    rec->text += ctx->saved
+                                 + (ctx->copy_end - ctx->copy_start);
+                }
+
                 if (ctx->output) {
 
                     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -558,6 +671,40 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
                         }
                     }
 
+                    if ((r != r->connection->data || r->postponed)
+                        && ctx->copied + (b->last - b->pos)
+                           <= NGX_HTTP_SSI_COPY_MAX)
+                    {
+                        /*
+                         * the text waits for the preceding subrequests,
+                         * so it is copied to let the source buffer be
+                         * reused while they are in progress; above the
+                         * limit the source is referenced, and reading
+                         * stops when its buffers are exhausted
+                         */
+
+                        ctx->copied += b->last - b->pos;
+
+                        p = ngx_pnalloc(r->pool, b->last - b->pos);
+                        if (p == NULL) {
+                            return NGX_ERROR;
+                        }
+
+                        b->start = p;
+                        b->end = ngx_cpymem(p, b->pos, b->last - b->pos);
+                        b->pos = b->start;
+                        b->last = b->end;
+
+                        b->temporary = 1;
+                        b->memory = 0;
+                        b->mmap = 0;
+                        b->in_file = 0;
+                        b->file = NULL;
+
+                    } else {
+                        ctx->referenced = 1;
+                    }
+
                     cl->next = NULL;
                     *ctx->last_out = cl;
                     ctx->last_out = &cl->next;
@@ -626,6 +773,10 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
             if (rc == NGX_OK) {
 
+                if (ctx->record && ngx_http_ssi_record(r, ctx) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+
                 smcf = ngx_http_get_module_main_conf(r,
                                                    ngx_http_ssi_filter_module);
 
@@ -889,10 +1040,22 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             }
 
             b->last_buf = ctx->buf->last_buf;
-            b->shadow = ctx->buf;
 
-            if (slcf->ignore_recycled_buffers == 0)  {
-                b->recycled = ctx->buf->recycled;
+            if (ctx->referenced) {
+                b->shadow = ctx->buf;
+
+                if (slcf->ignore_recycled_buffers == 0)  {
+                    b->recycled = ctx->buf->recycled;
+                }
+
+            } else {
+                ctx->buf->pos = ctx->buf->last;
+            }
+        }
+
+        if (ctx->record && (ctx->buf->last_buf || ctx->buf->last_in_chain)) {
+            if (ngx_http_ssi_template_store(r, ctx) != NGX_OK) {
+                return NGX_ERROR;
             }
         }
 
@@ -933,12 +1096,9 @@ ngx_http_ssi_output(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
 
     rc = ngx_http_next_body_filter(r, ctx->out);
 
-    if (ctx->busy == NULL) {
-        ctx->busy = ctx->out;
-
-    } else {
-        for (cl = ctx->busy; cl->next; cl = cl->next) { /* void */ }
-        cl->next = ctx->out;
+    if (ctx->out) {
+        *ctx->last_busy = ctx->out;
+        ctx->last_busy = ctx->last_out;
     }
 
     ctx->out = NULL;
@@ -959,6 +1119,10 @@ ngx_http_ssi_output(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
 
         ctx->busy = cl->next;
 
+        if (ctx->busy == NULL) {
+            ctx->last_busy = &ctx->busy;
+        }
+
         if (ngx_buf_in_memory(b) || b->in_file) {
             /* add data bufs only to the free buf chain */
 
@@ -1550,6 +1714,465 @@ ngx_http_ssi_parse(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
 }
 
 
+static ngx_int_t
+ngx_http_ssi_replay(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    off_t                     size;
+    size_t                    len;
+    ngx_uint_t                i;
+    ngx_table_elt_t          *param;
+    ngx_http_ssi_item_t      *item;
+    ngx_http_ssi_template_t  *tpl;
+
+    tpl = ctx->template;
+    size = ctx->buf->last - ctx->pos;
+
+    ctx->looked = 0;
+    ctx->copy_start = ctx->pos;
+    ctx->copy_end = ctx->pos;
+
+    item = (ctx->item < tpl->nitems) ? &tpl->items[ctx->item] : NULL;
+
+    if (item == NULL || ctx->offset < item->start) {
+
+        /* the text up to the next command */
+
+        if (item && item->start - ctx->offset < size) {
+            size = item->start - ctx->offset;
+        }
+
+        ctx->state = ssi_start_state;
+        ctx->pos += size;
+        ctx->copy_end = ctx->pos;
+
+        return NGX_AGAIN;
+    }
+
+    if (ctx->offset == item->start) {
+        len = (size < 5) ? (size_t) size : 5;
+
+        if (ngx_strncmp(ctx->pos, "<!--#", len) != 0) {
+            ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                          "SSI template does not match \"%V\"", &r->uri);
+
+            ctx->template = NULL;
+            ctx->state = ssi_start_state;
+
+            return NGX_AGAIN;
+        }
+    }
+
+    if (item->end - ctx->offset > size) {
+        ctx->state = ssi_command_state;
+        ctx->pos = ctx->buf->last;
+
+        return NGX_AGAIN;
+    }
+
+    ctx->state = ssi_start_state;
+    ctx->pos += item->end - ctx->offset;
+    ctx->item++;
+
+    ctx->key = item->key;
+    ctx->command = item->command;
+    ctx->params.nelts = 0;
+
+    for (i = 0; i < item->nparams; i++) {
+        param = ngx_array_push(&ctx->params);
+        if (param == NULL) {
+            return NGX_ERROR;
+        }
+
+        *param = item->params[i];
+
+        /* commands may change the values in place */
+
+        param->value.data = ngx_pnalloc(r->pool, param->value.len);
+        if (param->value.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(param->value.data, item->params[i].value.data,
+                   param->value.len);
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "ssi replay: \"%V\"", &ctx->command);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_ssi_record(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    ngx_uint_t              i;
+    ngx_table_elt_t        *param;
+    ngx_http_ssi_item_t    *item;
+    ngx_http_ssi_record_t  *rec;
+
+    if (ctx->saved) {
+
+        /* the saved "<!--" is output after the command, do not cache */
+
+        ctx->record = NULL;
+        return NGX_OK;
+    }
+
+    rec = ctx->record;
+
+    item = ngx_array_push(&rec->items);
+    if (item == NULL) {
+        return NGX_ERROR;
+    }
+
+    item->start = rec->end + rec->text;
+    item->end = ctx->offset;
+    item->key = ctx->key;
+
+    item->command.len = ctx->command.len;
+    item->command.data = ngx_pstrdup(r->pool, &ctx->command);
+    if (item->command.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    item->nparams = ctx->params.nelts;
+    item->params = ngx_palloc(r->pool,
+                              item->nparams * sizeof(ngx_table_elt_t));
+    if (item->params == NULL) {
+        return NGX_ERROR;
+    }
+
+    param = ctx->params.elts;
+
+    for (i = 0; i < item->nparams; i++) {
+        item->params[i] = param[i];
+
+        item->params[i].key.data = ngx_pstrdup(r->pool, &param[i].key);
+        if (item->params[i].key.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        item->params[i].value.data = ngx_pstrdup(r->pool, &param[i].value);
+        if (item->params[i].value.data == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    rec->end = ctx->offset;
+    rec->text = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_ssi_template_lookup(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
+    ngx_http_ssi_loc_conf_t *slcf)
+{
+    u_char                    key[16];
+    ngx_md5_t                 md5;
+    ngx_pool_cleanup_t       *cln;
+    ngx_http_ssi_record_t    *rec;
+    ngx_http_ssi_template_t  *tpl;
+
+    if (r->headers_out.last_modified_time == -1
+        && r->headers_out.etag == NULL)
+    {
+        return NGX_OK;
+    }
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, &slcf, sizeof(ngx_http_ssi_loc_conf_t *));
+    ngx_md5_update(&md5, r->headers_in.server.data, r->headers_in.server.len);
+    ngx_md5_update(&md5, r->uri.data, r->uri.len);
+    ngx_md5_update(&md5, "?", 1);
+    ngx_md5_update(&md5, r->args.data, r->args.len);
+    ngx_md5_update(&md5, &r->headers_out.content_length_n, sizeof(off_t));
+    ngx_md5_update(&md5, &r->headers_out.last_modified_time, sizeof(time_t));
+
+    if (r->headers_out.etag) {
+        ngx_md5_update(&md5, r->headers_out.etag->value.data,
+                       r->headers_out.etag->value.len);
+    }
+
+    ngx_md5_final(key, &md5);
+
+    if (ngx_http_ssi_templates.root == NULL) {
+        ngx_rbtree_init(&ngx_http_ssi_templates,
+                        &ngx_http_ssi_templates_sentinel,
+                        ngx_http_ssi_template_insert_value);
+        ngx_queue_init(&ngx_http_ssi_templates_queue);
+    }
+
+    tpl = ngx_http_ssi_template_find(key);
+
+    if (tpl) {
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_ssi_template_cleanup;
+        cln->data = tpl;
+
+        tpl->count++;
+
+        ngx_queue_remove(&tpl->queue);
+        ngx_queue_insert_head(&ngx_http_ssi_templates_queue, &tpl->queue);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "ssi template: %p, items: %ui", tpl, tpl->nitems);
+
+        ctx->template = tpl;
+
+        return NGX_OK;
+    }
+
+    rec = ngx_palloc(r->pool, sizeof(ngx_http_ssi_record_t));
+    if (rec == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_array_init(&rec->items, r->pool, 8, sizeof(ngx_http_ssi_item_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    rec->end = 0;
+    rec->text = 0;
+    ngx_memcpy(rec->key, key, 16);
+
+    ctx->record = rec;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_ssi_template_t *
+ngx_http_ssi_template_find(u_char *key)
+{
+    ngx_int_t                 rc;
+    ngx_rbtree_key_t          node_key;
+    ngx_rbtree_node_t        *node, *sentinel;
+    ngx_http_ssi_template_t  *tpl;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = ngx_http_ssi_templates.root;
+    sentinel = ngx_http_ssi_templates.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        tpl = (ngx_http_ssi_template_t *) node;
+
+        rc = ngx_memcmp(key, tpl->key, 16);
+
+        if (rc == 0) {
+            return tpl;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_ssi_template_store(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    size_t                     size;
+    ngx_uint_t                 i, j;
+    ngx_pool_t                *pool;
+    ngx_queue_t               *q;
+    ngx_table_elt_t           *param;
+    ngx_http_ssi_item_t       *item, *items;
+    ngx_http_ssi_record_t     *rec;
+    ngx_http_ssi_template_t   *tpl;
+    ngx_http_ssi_main_conf_t  *smcf;
+
+    rec = ctx->record;
+    ctx->record = NULL;
+
+    /* the text is not accounted exactly, if a tag was split oddly */
+
+    if (rec->end + rec->text != ctx->offset
+        || ngx_http_ssi_template_find(rec->key))
+    {
+        return NGX_OK;
+    }
+
+    items = rec->items.elts;
+
+    size = sizeof(ngx_pool_t) + sizeof(ngx_http_ssi_template_t)
+           + rec->items.nelts * sizeof(ngx_http_ssi_item_t)
+           + (rec->items.nelts + 2) * NGX_ALIGNMENT;
+
+    for (i = 0; i < rec->items.nelts; i++) {
+        size += items[i].command.len
+                + items[i].nparams * sizeof(ngx_table_elt_t);
+
+        for (j = 0; j < items[i].nparams; j++) {
+            size += items[i].params[j].key.len + items[i].params[j].value.len;
+        }
+    }
+
+    pool = ngx_create_pool(size, ngx_cycle->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    tpl = ngx_palloc(pool, sizeof(ngx_http_ssi_template_t));
+    if (tpl == NULL) {
+        goto failed;
+    }
+
+    tpl->items = ngx_palloc(pool,
+                            rec->items.nelts * sizeof(ngx_http_ssi_item_t));
+    if (tpl->items == NULL) {
+        goto failed;
+    }
+
+    for (i = 0; i < rec->items.nelts; i++) {
+        item = &tpl->items[i];
+        *item = items[i];
+
+        item->command.data = ngx_pstrdup(pool, &items[i].command);
+        if (item->command.data == NULL) {
+            goto failed;
+        }
+
+        item->params = ngx_palloc(pool,
+                                  item->nparams * sizeof(ngx_table_elt_t));
+        if (item->params == NULL) {
+            goto failed;
+        }
+
+        for (j = 0; j < item->nparams; j++) {
+            param = &item->params[j];
+            *param = items[i].params[j];
+
+            param->key.data = ngx_pstrdup(pool, &items[i].params[j].key);
+            if (param->key.data == NULL) {
+                goto failed;
+            }
+
+            param->value.data = ngx_pstrdup(pool, &items[i].params[j].value);
+            if (param->value.data == NULL) {
+                goto failed;
+            }
+        }
+    }
+
+    tpl->pool = pool;
+    tpl->count = 0;
+    tpl->expired = 0;
+    tpl->nitems = rec->items.nelts;
+
+    ngx_memcpy(tpl->key, rec->key, 16);
+    ngx_memcpy((u_char *) &tpl->node.key, tpl->key, sizeof(ngx_rbtree_key_t));
+
+    ngx_rbtree_insert(&ngx_http_ssi_templates, &tpl->node);
+    ngx_queue_insert_head(&ngx_http_ssi_templates_queue, &tpl->queue);
+    ngx_http_ssi_ntemplates++;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "ssi template store: %p, items: %ui", tpl, tpl->nitems);
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_ssi_filter_module);
+
+    while (ngx_http_ssi_ntemplates > smcf->templates) {
+        q = ngx_queue_last(&ngx_http_ssi_templates_queue);
+        tpl = ngx_queue_data(q, ngx_http_ssi_template_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&ngx_http_ssi_templates, &tpl->node);
+        ngx_http_ssi_ntemplates--;
+
+        if (tpl->count) {
+            tpl->expired = 1;
+
+        } else {
+            ngx_destroy_pool(tpl->pool);
+        }
+    }
+
+    return NGX_OK;
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_http_ssi_template_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t        **p;
+    ngx_http_ssi_template_t   *tpl, *tplt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            tpl = (ngx_http_ssi_template_t *) node;
+            tplt = (ngx_http_ssi_template_t *) temp;
+
+            p = (ngx_memcmp(tpl->key, tplt->key, 16) < 0)
+                    ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static void
+ngx_http_ssi_template_cleanup(void *data)
+{
+    ngx_http_ssi_template_t  *tpl = data;
+
+    if (--tpl->count == 0 && tpl->expired) {
+        ngx_destroy_pool(tpl->pool);
+    }
+}
+
+
 static ngx_str_t *
 ngx_http_ssi_get_variable(ngx_http_request_t *r, ngx_str_t *name,
     ngx_uint_t key)
@@ -1995,6 +2618,7 @@ ngx_http_ssi_include(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
     ngx_http_ssi_var_t          *var;
     ngx_http_ssi_ctx_t          *mctx;
     ngx_http_ssi_block_t        *bl;
+    ngx_http_ssi_include_t      *inc;
     ngx_http_post_subrequest_t  *psr;
 
     uri = params[NGX_HTTP_SSI_INCLUDE_VIRTUAL];
@@ -2176,6 +2800,30 @@ ngx_http_ssi_include(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
         flags |= NGX_HTTP_SUBREQUEST_IN_MEMORY|NGX_HTTP_SUBREQUEST_WAITED;
     }
 
+    if (mctx->includes == NULL) {
+        mctx->includes = ngx_list_create(r->pool, 4,
+                                         sizeof(ngx_http_ssi_include_t));
+        if (mctx->includes == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    inc = ngx_list_push(mctx->includes);
+    if (inc == NULL) {
+        return NGX_ERROR;
+    }
+
+    inc->time = -1;
+    inc->post_subrequest = psr;
+
+    psr = ngx_palloc(r->pool, sizeof(ngx_http_post_subrequest_t));
+    if (psr == NULL) {
+        return NGX_ERROR;
+    }
+
+    psr->handler = ngx_http_ssi_include_done;
+    psr->data = inc;
+
     if (ngx_http_subrequest(r, uri, &args, &sr, psr, flags) != NGX_OK) {
         return NGX_HTTP_SSI_ERROR;
     }
@@ -2240,6 +2888,31 @@ ngx_http_ssi_set_variable(ngx_http_request_t *r, void *data, ngx_int_t rc)
 }
 
 
+static ngx_int_t
+ngx_http_ssi_include_done(ngx_http_request_t *r, void *data, ngx_int_t rc)
+{
+    ngx_http_ssi_include_t  *inc = data;
+
+    ngx_time_t      *tp;
+    ngx_msec_int_t   ms;
+
+    if (inc->time == -1) {
+        tp = ngx_timeofday();
+
+        ms = (ngx_msec_int_t)
+                 ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+        inc->time = ngx_max(ms, 0);
+    }
+
+    if (inc->post_subrequest) {
+        return inc->post_subrequest->handler(r, inc->post_subrequest->data,
+                                             rc);
+    }
+
+    return rc;
+}
+
+
 static ngx_int_t
 ngx_http_ssi_echo(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
     ngx_str_t **params)
@@ -2774,6 +3447,74 @@ ngx_http_ssi_date_gmt_local_variable(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_ssi_include_time_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char                  *p;
+    ngx_uint_t               i, n;
+    ngx_list_part_t         *part;
+    ngx_http_ssi_ctx_t      *mctx;
+    ngx_http_ssi_include_t  *inc;
+
+    mctx = ngx_http_get_module_ctx(r->main, ngx_http_ssi_filter_module);
+
+    if (mctx == NULL || mctx->includes == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    n = 0;
+
+    for (part = &mctx->includes->part; part; part = part->next) {
+        n += part->nelts;
+    }
+
+    p = ngx_pnalloc(r->pool, n * (NGX_TIME_T_LEN + 4 + 2));
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->data = p;
+
+    part = &mctx->includes->part;
+    inc = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            inc = part->elts;
+            i = 0;
+        }
+
+        if (p != v->data) {
+            *p++ = ',';
+            *p++ = ' ';
+        }
+
+        if (inc[i].time == -1) {
+            *p++ = '-';
+            continue;
+        }
+
+        p = ngx_sprintf(p, "%T.%03M",
+                        (time_t) inc[i].time / 1000, inc[i].time % 1000);
+    }
+
+    v->len = p - v->data;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_ssi_preconfiguration(ngx_conf_t *cf)
 {
@@ -2827,6 +3568,8 @@ ngx_http_ssi_create_main_conf(ngx_conf_t *cf)
     smcf->commands.pool = cf->pool;
     smcf->commands.temp_pool = cf->temp_pool;
 
+    smcf->templates = NGX_CONF_UNSET_UINT;
+
     if (ngx_hash_keys_array_init(&smcf->commands, NGX_HASH_SMALL) != NGX_OK) {
         return NULL;
     }
@@ -2842,6 +3585,8 @@ ngx_http_ssi_init_main_conf(ngx_conf_t *cf, void *conf)
 
     ngx_hash_init_t  hash;
 
+    ngx_conf_init_uint_value(smcf->templates, 0);
+
     hash.hash = &smcf->hash;
     hash.key = ngx_hash_key;
     hash.max_size = 1024;
@@ -33,6 +33,7 @@
 typedef struct {
     ngx_hash_t                hash;
     ngx_hash_keys_arrays_t    commands;
+    ngx_uint_t                templates;
 } ngx_http_ssi_main_conf_t;
 
 
@@ -53,17 +54,25 @@ typedef struct {
     ngx_chain_t              *out;
     ngx_chain_t             **last_out;
     ngx_chain_t              *busy;
+    ngx_chain_t             **last_busy;
     ngx_chain_t              *free;
 
     ngx_uint_t                state;
     ngx_uint_t                saved_state;
     size_t                    saved;
     size_t                    looked;
+    size_t                    copied;
 
     size_t                    value_len;
 
     ngx_list_t               *variables;
     ngx_array_t              *blocks;
+    ngx_list_t               *includes;
+
+    off_t                     offset;
+    void                     *template;
+    ngx_uint_t                item;
+    void                     *record;
 
 #if (NGX_PCRE)
     ngx_uint_t                ncaptures;
@@ -76,6 +85,7 @@ typedef struct {
     unsigned                  block:1;
     unsigned                  output:1;
     unsigned                  output_chosen:1;
+    unsigned                  referenced:1;
 
     ngx_http_request_t       *wait;
     void                     *value_buf;
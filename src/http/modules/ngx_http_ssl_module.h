@@ -21,6 +21,12 @@ typedef struct {
 
     ngx_flag_t                      prefer_server_ciphers;
 
+    ngx_flag_t                      ktls;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t              *handshake_thread_pool;
+#endif
+
     ngx_uint_t                      protocols;
 
     ngx_uint_t                      verify;
@@ -53,6 +59,7 @@ typedef struct {
     ngx_flag_t                      stapling_verify;
     ngx_str_t                       stapling_file;
     ngx_str_t                       stapling_responder;
+    ngx_str_t                       stapling_store;
 
     u_char                         *file;
     ngx_uint_t                      line;
@@ -22,12 +22,46 @@ typedef struct {
 } ngx_http_sub_match_t;
 
 
+#define NGX_HTTP_SUB_NONE  255
+
+
+typedef struct {
+    ngx_uint_t                 depth;
+    ngx_uint_t                 fail;
+    ngx_uint_t                 dict;
+    u_char                     match;
+    u_char                     lowest;
+} ngx_http_sub_node_t;
+
+
+/*
+ * the Aho-Corasick automaton for a static set of patterns: a complete
+ * transition table over the classes of bytes found in the patterns,
+ * "dict" is the nearest node on the failure chain that ends a pattern,
+ * "lowest" and "extends" are the patterns longer than a node's prefix,
+ * and "same" links patterns with identical strings
+ */
+
+typedef struct {
+    ngx_uint_t                 nclasses;
+    u_char                     classes[256];
+
+    uint32_t                  *next;
+    ngx_http_sub_node_t       *nodes;
+    u_char                    *extends;
+
+    u_char                     same[255];
+} ngx_http_sub_automaton_t;
+
+
 typedef struct {
     ngx_uint_t                 min_match_len;
     ngx_uint_t                 max_match_len;
 
     u_char                     index[257];
     u_char                     shift[256];
+
+    ngx_http_sub_automaton_t  *automaton;
 } ngx_http_sub_tables_t;
 
 
@@ -84,6 +118,10 @@ static ngx_int_t ngx_http_sub_output(ngx_http_request_t *r,
     ngx_http_sub_ctx_t *ctx);
 static ngx_int_t ngx_http_sub_parse(ngx_http_request_t *r,
     ngx_http_sub_ctx_t *ctx, ngx_uint_t flush);
+static ngx_int_t ngx_http_sub_parse_automaton(ngx_http_request_t *r,
+    ngx_http_sub_ctx_t *ctx);
+static ngx_uint_t ngx_http_sub_pending(ngx_http_sub_ctx_t *ctx,
+    ngx_http_sub_loc_conf_t *slcf, ngx_uint_t n, ngx_uint_t limit);
 static ngx_int_t ngx_http_sub_match(ngx_http_sub_ctx_t *ctx, ngx_int_t start,
     ngx_str_t *m);
 
@@ -95,6 +133,8 @@ static char *ngx_http_sub_merge_conf(ngx_conf_t *cf,
 static void ngx_http_sub_init_tables(ngx_http_sub_tables_t *tables,
     ngx_http_sub_match_t *match, ngx_uint_t n);
 static ngx_int_t ngx_http_sub_cmp_matches(const void *one, const void *two);
+static ngx_int_t ngx_http_sub_init_automaton(ngx_conf_t *cf,
+    ngx_http_sub_tables_t *tables, ngx_http_sub_match_t *match, ngx_uint_t n);
 static ngx_int_t ngx_http_sub_filter_init(ngx_conf_t *cf);
 
 
@@ -615,8 +655,13 @@ ngx_http_sub_parse(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx,
     ngx_http_sub_tables_t    *tables;
     ngx_http_sub_loc_conf_t  *slcf;
 
-    slcf = ngx_http_get_module_loc_conf(r, ngx_http_sub_filter_module);
     tables = ctx->tables;
+
+    if (tables->automaton) {
+        return ngx_http_sub_parse_automaton(r, ctx);
+    }
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_sub_filter_module);
     match = ctx->matches->elts;
 
     offset = ctx->offset;
@@ -740,6 +785,182 @@ done:
 }
 
 
+static ngx_int_t
+ngx_http_sub_parse_automaton(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx)
+{
+    u_char                     *p;
+    ngx_int_t                   offset, start, next, end, len, best_start, rc;
+    ngx_uint_t                  state, n, i, best;
+    ngx_http_sub_node_t        *node;
+    ngx_http_sub_match_t       *match;
+    ngx_http_sub_loc_conf_t    *slcf;
+    ngx_http_sub_automaton_t   *ac;
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_sub_filter_module);
+    ac = ctx->tables->automaton;
+    match = ctx->matches->elts;
+
+    end = ctx->buf->last - ctx->pos;
+
+    if (ctx->once) {
+        start = end;
+        next = end;
+        rc = NGX_AGAIN;
+        goto done;
+    }
+
+    /*
+     * the text is scanned from the start of the looked part, the earliest
+     * match wins, and of the matches at the same position the one first
+     * in the sorted order, as in ngx_http_sub_parse()
+     */
+
+    state = 0;
+    node = &ac->nodes[0];
+
+    best = NGX_HTTP_SUB_NONE;
+    best_start = 0;
+
+    for (offset = - (ngx_int_t) ctx->looked.len; offset < end; offset++) {
+
+        p = offset < 0 ? &ctx->looked.data[ctx->looked.len + offset]
+                       : &ctx->pos[offset];
+
+        state = ac->next[state * ac->nclasses + ac->classes[*p]];
+        node = &ac->nodes[state];
+
+        for (n = (node->match != NGX_HTTP_SUB_NONE) ? state : node->dict;
+             n;
+             n = ac->nodes[n].dict)
+        {
+            for (i = ac->nodes[n].match;
+                 i != NGX_HTTP_SUB_NONE;
+                 i = ac->same[i])
+            {
+                if (slcf->once && ctx->sub && ctx->sub[i].data) {
+                    continue;
+                }
+
+                start = offset + 1 - (ngx_int_t) match[i].match.len;
+
+                if (best == NGX_HTTP_SUB_NONE
+                    || start < best_start
+                    || (start == best_start && i < best))
+                {
+                    best = i;
+                    best_start = start;
+                }
+
+                break;
+            }
+        }
+
+        if (best == NGX_HTTP_SUB_NONE) {
+            continue;
+        }
+
+        /*
+         * wait while a match in progress starts before the best one,
+         * or at the same position with a pattern earlier in the order
+         */
+
+        for (n = state; /* void */ ; n = ac->nodes[n].fail) {
+            start = offset + 1 - (ngx_int_t) ac->nodes[n].depth;
+
+            if (start > best_start) {
+                break;
+            }
+
+            if (ngx_http_sub_pending(ctx, slcf, n, (start < best_start)
+                                                   ? NGX_HTTP_SUB_NONE : best))
+            {
+                break;
+            }
+        }
+
+        if (start > best_start) {
+
+            ctx->index = best;
+
+            start = best_start;
+            next = best_start + (ngx_int_t) match[best].match.len;
+            end = ngx_max(next, 0);
+            rc = NGX_OK;
+
+            goto done;
+        }
+    }
+
+    /* keep the longest suffix that is a prefix of a pattern yet to match */
+
+    for (n = state; n; n = ac->nodes[n].fail) {
+        if (ngx_http_sub_pending(ctx, slcf, n, NGX_HTTP_SUB_NONE)) {
+            break;
+        }
+    }
+
+    start = end - (ngx_int_t) ac->nodes[n].depth;
+    next = start;
+    rc = NGX_AGAIN;
+
+done:
+
+    /* send [ - looked.len, start ] to client */
+
+    ctx->saved.len = ctx->looked.len + ngx_min(start, 0);
+    ngx_memcpy(ctx->saved.data, ctx->looked.data, ctx->saved.len);
+
+    ctx->copy_start = ctx->pos;
+    ctx->copy_end = ctx->pos + ngx_max(start, 0);
+
+    /* save [ next, end ] in looked */
+
+    len = ngx_min(next, 0);
+    p = ctx->looked.data;
+    p = ngx_movemem(p, p + ctx->looked.len + len, - len);
+
+    len = ngx_max(next, 0);
+    p = ngx_cpymem(p, ctx->pos + len, end - len);
+    ctx->looked.len = p - ctx->looked.data;
+
+    /* update position */
+
+    ctx->pos += end;
+
+    return rc;
+}
+
+
+static ngx_uint_t
+ngx_http_sub_pending(ngx_http_sub_ctx_t *ctx, ngx_http_sub_loc_conf_t *slcf,
+    ngx_uint_t n, ngx_uint_t limit)
+{
+    u_char                    *bits;
+    ngx_uint_t                 i;
+    ngx_http_sub_automaton_t  *ac;
+
+    ac = ctx->tables->automaton;
+
+    if (ac->nodes[n].lowest >= limit) {
+        return 0;
+    }
+
+    if (!slcf->once || ctx->sub == NULL) {
+        return 1;
+    }
+
+    bits = &ac->extends[n * 32];
+
+    for (i = ac->nodes[n].lowest; i < limit; i++) {
+        if ((bits[i >> 3] & (1 << (i & 7))) && ctx->sub[i].data == NULL) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
 static ngx_int_t
 ngx_http_sub_match(ngx_http_sub_ctx_t *ctx, ngx_int_t start, ngx_str_t *m)
 {
@@ -938,6 +1159,20 @@ ngx_http_sub_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 
         ngx_http_sub_init_tables(conf->tables, conf->matches->elts,
                                  conf->matches->nelts);
+
+        /*
+         * the shift table skips faster through the text for a few
+         * patterns, the automaton scales better with many
+         */
+
+        if (n >= 8
+            && ngx_http_sub_init_automaton(cf, conf->tables,
+                                           conf->matches->elts,
+                                           conf->matches->nelts)
+               != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
     }
 
     return NGX_CONF_OK;
@@ -961,6 +1196,7 @@ ngx_http_sub_init_tables(ngx_http_sub_tables_t *tables,
 
     tables->min_match_len = min;
     tables->max_match_len = max;
+    tables->automaton = NULL;
 
     ngx_http_sub_cmp_index = tables->min_match_len - 1;
     ngx_sort(match, n, sizeof(ngx_http_sub_match_t), ngx_http_sub_cmp_matches);
@@ -1005,6 +1241,183 @@ ngx_http_sub_cmp_matches(const void *one, const void *two)
 }
 
 
+static ngx_int_t
+ngx_http_sub_init_automaton(ngx_conf_t *cf, ngx_http_sub_tables_t *tables,
+    ngx_http_sub_match_t *match, ngx_uint_t n)
+{
+    u_char                     c;
+    uint32_t                  *row, *frow;
+    ngx_uint_t                 i, j, k, a, u, v, f, nnodes, head, *queue;
+    ngx_array_t                nodes, next;
+    ngx_http_sub_node_t       *node;
+    ngx_http_sub_automaton_t  *ac;
+
+    ac = ngx_pcalloc(cf->pool, sizeof(ngx_http_sub_automaton_t));
+    if (ac == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* byte classes, the patterns are already in lower case */
+
+    ac->nclasses = 1;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < match[i].match.len; j++) {
+            c = match[i].match.data[j];
+
+            if (ac->classes[c] == 0) {
+                ac->classes[c] = (u_char) ac->nclasses++;
+            }
+        }
+    }
+
+    for (k = 0; k < 256; k++) {
+        ac->classes[k] = ac->classes[ngx_tolower(k)];
+    }
+
+    /* the trie */
+
+    if (ngx_array_init(&nodes, cf->temp_pool, 64, sizeof(ngx_http_sub_node_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_array_init(&next, cf->temp_pool, 64 * ac->nclasses,
+                       sizeof(uint32_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    node = ngx_array_push(&nodes);
+    row = ngx_array_push_n(&next, ac->nclasses);
+    if (node == NULL || row == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(node, sizeof(ngx_http_sub_node_t));
+    ngx_memzero(row, ac->nclasses * sizeof(uint32_t));
+    node->match = NGX_HTTP_SUB_NONE;
+    node->lowest = NGX_HTTP_SUB_NONE;
+
+    ngx_memset(ac->same, NGX_HTTP_SUB_NONE, sizeof(ac->same));
+
+    for (i = 0; i < n; i++) {
+        u = 0;
+
+        for (j = 0; j < match[i].match.len; j++) {
+            a = ac->classes[match[i].match.data[j]];
+            v = ((uint32_t *) next.elts)[u * ac->nclasses + a];
+
+            if (v == 0) {
+                v = nodes.nelts;
+
+                node = ngx_array_push(&nodes);
+                row = ngx_array_push_n(&next, ac->nclasses);
+                if (node == NULL || row == NULL) {
+                    return NGX_ERROR;
+                }
+
+                ngx_memzero(node, sizeof(ngx_http_sub_node_t));
+                ngx_memzero(row, ac->nclasses * sizeof(uint32_t));
+                node->depth = j + 1;
+                node->match = NGX_HTTP_SUB_NONE;
+                node->lowest = NGX_HTTP_SUB_NONE;
+
+                ((uint32_t *) next.elts)[u * ac->nclasses + a] = (uint32_t) v;
+            }
+
+            u = v;
+        }
+
+        node = &((ngx_http_sub_node_t *) nodes.elts)[u];
+
+        if (node->match == NGX_HTTP_SUB_NONE) {
+            node->match = (u_char) i;
+
+        } else {
+            k = node->match;
+
+            while (ac->same[k] != NGX_HTTP_SUB_NONE) {
+                k = ac->same[k];
+            }
+
+            ac->same[k] = (u_char) i;
+        }
+    }
+
+    nnodes = nodes.nelts;
+
+    ac->nodes = ngx_palloc(cf->pool, nnodes * sizeof(ngx_http_sub_node_t));
+    ac->next = ngx_palloc(cf->pool, nnodes * ac->nclasses * sizeof(uint32_t));
+    ac->extends = ngx_pcalloc(cf->pool, nnodes * 32);
+    queue = ngx_palloc(cf->temp_pool, nnodes * sizeof(ngx_uint_t));
+
+    if (ac->nodes == NULL || ac->next == NULL || ac->extends == NULL
+        || queue == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(ac->nodes, nodes.elts, nnodes * sizeof(ngx_http_sub_node_t));
+    ngx_memcpy(ac->next, next.elts, nnodes * ac->nclasses * sizeof(uint32_t));
+
+    /* the patterns extending each node */
+
+    for (i = 0; i < n; i++) {
+        u = 0;
+
+        for (j = 0; j < match[i].match.len; j++) {
+            ac->extends[u * 32 + (i >> 3)] |= 1 << (i & 7);
+
+            if (ac->nodes[u].lowest > i) {
+                ac->nodes[u].lowest = (u_char) i;
+            }
+
+            a = ac->classes[match[i].match.data[j]];
+            u = ac->next[u * ac->nclasses + a];
+        }
+    }
+
+    /* failure links and the complete transition table, breadth first */
+
+    queue[0] = 0;
+    k = 1;
+
+    for (head = 0; head < k; head++) {
+        u = queue[head];
+        row = &ac->next[u * ac->nclasses];
+        frow = &ac->next[ac->nodes[u].fail * ac->nclasses];
+
+        for (a = 0; a < ac->nclasses; a++) {
+            v = row[a];
+
+            if (v == 0) {
+                row[a] = (u == 0) ? 0 : frow[a];
+                continue;
+            }
+
+            f = (u == 0) ? 0 : frow[a];
+
+            ac->nodes[v].fail = f;
+            ac->nodes[v].dict = (ac->nodes[f].match != NGX_HTTP_SUB_NONE)
+                                ? f : ac->nodes[f].dict;
+
+            queue[k++] = v;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "sub filter automaton: %ui nodes, %ui classes",
+                   nnodes, ac->nclasses);
+
+    tables->automaton = ac;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_sub_filter_init(ngx_conf_t *cf)
 {
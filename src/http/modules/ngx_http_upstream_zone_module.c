@@ -207,6 +207,11 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
         ngx_memcpy(peer, *peerp, sizeof(ngx_http_upstream_rr_peer_t));
 
+#if (NGX_HTTP_SSL)
+        /* the original peer keeps a worker-local copy of the session */
+        peer->local = *peerp;
+#endif
+
         *peerp = peer;
     }
 
@@ -233,6 +238,11 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
         ngx_memcpy(peer, *peerp, sizeof(ngx_http_upstream_rr_peer_t));
 
+#if (NGX_HTTP_SSL)
+        /* the original peer keeps a worker-local copy of the session */
+        peer->local = *peerp;
+#endif
+
         *peerp = peer;
     }
 
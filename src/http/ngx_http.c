@@ -10,6 +10,21 @@
 #include <ngx_http.h>
 
 
+/* a prefix trie of static locations, built before ngx_http_location_tree */
+
+typedef struct ngx_http_location_trie_s  ngx_http_location_trie_t;
+
+struct ngx_http_location_trie_s {
+    u_char                          *name;
+    size_t                           len;
+
+    ngx_http_core_loc_conf_t        *exact;
+    ngx_http_core_loc_conf_t        *inclusive;
+
+    ngx_array_t                      children;
+};
+
+
 static char *ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static ngx_int_t ngx_http_init_phases(ngx_conf_t *cf,
     ngx_http_core_main_conf_t *cmcf);
@@ -41,11 +56,15 @@ static ngx_int_t ngx_http_cmp_locations(const ngx_queue_t *one,
     const ngx_queue_t *two);
 static ngx_int_t ngx_http_join_exact_locations(ngx_conf_t *cf,
     ngx_queue_t *locations);
-static void ngx_http_create_locations_list(ngx_queue_t *locations,
-    ngx_queue_t *q);
-static ngx_http_location_tree_node_t *
-    ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations,
-    size_t prefix);
+static ngx_int_t ngx_http_location_trie_insert(ngx_conf_t *cf,
+    ngx_http_location_trie_t *node, ngx_http_location_queue_t *lq);
+static ngx_http_location_trie_t *ngx_http_location_trie_node(ngx_conf_t *cf,
+    u_char *name, size_t len);
+static size_t ngx_http_location_trie_size(ngx_http_location_trie_t *node);
+static ngx_http_location_tree_node_t *ngx_http_location_trie_freeze(
+    ngx_http_location_trie_t *node, u_char **p);
+static int ngx_libc_cdecl ngx_http_cmp_location_trie(const void *one,
+    const void *two);
 
 static ngx_int_t ngx_http_optimize_servers(ngx_conf_t *cf,
     ngx_http_core_main_conf_t *cmcf, ngx_array_t *ports);
@@ -797,8 +816,11 @@ static ngx_int_t
 ngx_http_init_static_location_trees(ngx_conf_t *cf,
     ngx_http_core_loc_conf_t *pclcf)
 {
+    u_char                     *p;
+    size_t                      size;
     ngx_queue_t                *q, *locations;
     ngx_http_core_loc_conf_t   *clcf;
+    ngx_http_location_trie_t   *root;
     ngx_http_location_queue_t  *lq;
 
     locations = pclcf->locations;
@@ -828,13 +850,38 @@ ngx_http_init_static_location_trees(ngx_conf_t *cf,
         return NGX_ERROR;
     }
 
-    ngx_http_create_locations_list(locations, ngx_queue_head(locations));
+    root = ngx_http_location_trie_node(cf, NULL, 0);
+    if (root == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (q = ngx_queue_head(locations);
+         q != ngx_queue_sentinel(locations);
+         q = ngx_queue_next(q))
+    {
+        lq = (ngx_http_location_queue_t *) q;
+
+        if (ngx_http_location_trie_insert(cf, root, lq) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    /*
+     * the trie is copied into a single block, nodes are laid out
+     * in depth-first order and each node starts on a cache line
+     */
+
+    size = ngx_http_location_trie_size(root);
 
-    pclcf->static_locations = ngx_http_create_locations_tree(cf, locations, 0);
-    if (pclcf->static_locations == NULL) {
+    p = ngx_palloc(cf->pool, size + ngx_cacheline_size);
+    if (p == NULL) {
         return NGX_ERROR;
     }
 
+    p = ngx_align_ptr(p, ngx_cacheline_size);
+
+    pclcf->static_locations = ngx_http_location_trie_freeze(root, &p);
+
     return NGX_OK;
 }
 
@@ -878,8 +925,6 @@ ngx_http_add_location(ngx_conf_t *cf, ngx_queue_t **locations,
     lq->file_name = cf->conf_file->file.name.data;
     lq->line = cf->conf_file->line;
 
-    ngx_queue_init(&lq->list);
-
     ngx_queue_insert_tail(*locations, &lq->queue);
 
     return NGX_OK;
@@ -1000,143 +1045,208 @@ ngx_http_join_exact_locations(ngx_conf_t *cf, ngx_queue_t *locations)
 }
 
 
-static void
-ngx_http_create_locations_list(ngx_queue_t *locations, ngx_queue_t *q)
+static ngx_int_t
+ngx_http_location_trie_insert(ngx_conf_t *cf, ngx_http_location_trie_t *node,
+    ngx_http_location_queue_t *lq)
 {
     u_char                     *name;
-    size_t                      len;
-    ngx_queue_t                *x, tail;
-    ngx_http_location_queue_t  *lq, *lx;
+    size_t                      len, n;
+    ngx_uint_t                  i;
+    ngx_http_location_trie_t   *child, *split, **children;
 
-    if (q == ngx_queue_last(locations)) {
-        return;
-    }
+    name = lq->name->data;
+    len = lq->name->len;
 
-    lq = (ngx_http_location_queue_t *) q;
+    for ( ;; ) {
 
-    if (lq->inclusive == NULL) {
-        ngx_http_create_locations_list(locations, ngx_queue_next(q));
-        return;
-    }
+        if (len == 0) {
+            node->exact = lq->exact;
+            node->inclusive = lq->inclusive;
 
-    len = lq->name->len;
-    name = lq->name->data;
+            return NGX_OK;
+        }
 
-    for (x = ngx_queue_next(q);
-         x != ngx_queue_sentinel(locations);
-         x = ngx_queue_next(x))
-    {
-        lx = (ngx_http_location_queue_t *) x;
+        children = node->children.elts;
 
-        if (len > lx->name->len
-            || ngx_filename_cmp(name, lx->name->data, len) != 0)
-        {
-            break;
+        for (i = 0; i < node->children.nelts; i++) {
+            if (ngx_http_location_char(children[i]->name[0])
+                == ngx_http_location_char(name[0]))
+            {
+                break;
+            }
         }
-    }
 
-    q = ngx_queue_next(q);
+        if (i == node->children.nelts) {
+            child = ngx_http_location_trie_node(cf, name, len);
+            if (child == NULL) {
+                return NGX_ERROR;
+            }
 
-    if (q == x) {
-        ngx_http_create_locations_list(locations, x);
-        return;
+            children = ngx_array_push(&node->children);
+            if (children == NULL) {
+                return NGX_ERROR;
+            }
+
+            *children = child;
+
+            node = child;
+            len = 0;
+
+            continue;
+        }
+
+        child = children[i];
+
+        for (n = 1; n < child->len && n < len; n++) {
+            if (ngx_http_location_char(child->name[n])
+                != ngx_http_location_char(name[n]))
+            {
+                break;
+            }
+        }
+
+        if (n < child->len) {
+
+            /* split the node name at the first mismatch */
+
+            split = ngx_http_location_trie_node(cf, child->name, n);
+            if (split == NULL) {
+                return NGX_ERROR;
+            }
+
+            children[i] = split;
+
+            children = ngx_array_push(&split->children);
+            if (children == NULL) {
+                return NGX_ERROR;
+            }
+
+            *children = child;
+
+            child->name += n;
+            child->len -= n;
+
+            child = split;
+        }
+
+        node = child;
+        name += n;
+        len -= n;
     }
+}
+
 
-    ngx_queue_split(locations, q, &tail);
-    ngx_queue_add(&lq->list, &tail);
+static ngx_http_location_trie_t *
+ngx_http_location_trie_node(ngx_conf_t *cf, u_char *name, size_t len)
+{
+    ngx_http_location_trie_t  *node;
 
-    if (x == ngx_queue_sentinel(locations)) {
-        ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
-        return;
+    node = ngx_pcalloc(cf->temp_pool, sizeof(ngx_http_location_trie_t));
+    if (node == NULL) {
+        return NULL;
     }
 
-    ngx_queue_split(&lq->list, x, &tail);
-    ngx_queue_add(locations, &tail);
+    node->name = name;
+    node->len = len;
 
-    ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
+    if (ngx_array_init(&node->children, cf->temp_pool, 2,
+                       sizeof(ngx_http_location_trie_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
 
-    ngx_http_create_locations_list(locations, x);
+    return node;
 }
 
 
-/*
- * to keep cache locality for left leaf nodes, allocate nodes in following
- * order: node, left subtree, right subtree, inclusive subtree
- */
+static size_t
+ngx_http_location_trie_size(ngx_http_location_trie_t *node)
+{
+    size_t                      size;
+    ngx_uint_t                  i, n;
+    ngx_http_location_trie_t  **children;
+
+    n = node->children.nelts;
+
+    size = offsetof(ngx_http_location_tree_node_t, name) + node->len + n;
+    size = ngx_align(size, sizeof(void *)) + n * sizeof(void *);
+    size = ngx_align(size, ngx_cacheline_size);
+
+    children = node->children.elts;
+
+    for (i = 0; i < n; i++) {
+        size += ngx_http_location_trie_size(children[i]);
+    }
+
+    return size;
+}
+
 
 static ngx_http_location_tree_node_t *
-ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations,
-    size_t prefix)
+ngx_http_location_trie_freeze(ngx_http_location_trie_t *trie, u_char **p)
 {
-    size_t                          len;
-    ngx_queue_t                    *q, tail;
-    ngx_http_location_queue_t      *lq;
+    u_char                         *m;
+    ngx_uint_t                      i, n;
+    ngx_http_location_trie_t      **children;
     ngx_http_location_tree_node_t  *node;
 
-    q = ngx_queue_middle(locations);
-
-    lq = (ngx_http_location_queue_t *) q;
-    len = lq->name->len - prefix;
+    n = trie->children.nelts;
+    children = trie->children.elts;
 
-    node = ngx_palloc(cf->pool,
-                      offsetof(ngx_http_location_tree_node_t, name) + len);
-    if (node == NULL) {
-        return NULL;
-    }
+    ngx_qsort(children, n, sizeof(ngx_http_location_trie_t *),
+              ngx_http_cmp_location_trie);
 
-    node->left = NULL;
-    node->right = NULL;
-    node->tree = NULL;
-    node->exact = lq->exact;
-    node->inclusive = lq->inclusive;
+    node = (ngx_http_location_tree_node_t *) *p;
 
-    node->auto_redirect = (u_char) ((lq->exact && lq->exact->auto_redirect)
-                           || (lq->inclusive && lq->inclusive->auto_redirect));
+    node->exact = trie->exact;
+    node->inclusive = trie->inclusive;
 
-    node->len = (u_char) len;
-    ngx_memcpy(node->name, &lq->name->data[prefix], len);
+    node->auto_redirect = (u_char) ((trie->exact && trie->exact->auto_redirect)
+                          || (trie->inclusive && trie->inclusive->auto_redirect));
 
-    ngx_queue_split(locations, q, &tail);
+    node->len = (u_short) trie->len;
+    node->nchildren = (u_short) n;
 
-    if (ngx_queue_empty(locations)) {
-        /*
-         * ngx_queue_split() insures that if left part is empty,
-         * then right one is empty too
-         */
-        goto inclusive;
+    for (i = 0; i < trie->len; i++) {
+        node->name[i] = ngx_http_location_char(trie->name[i]);
     }
 
-    node->left = ngx_http_create_locations_tree(cf, locations, prefix);
-    if (node->left == NULL) {
-        return NULL;
-    }
+    m = node->name + trie->len;
 
-    ngx_queue_remove(q);
+    node->keys = m;
 
-    if (ngx_queue_empty(&tail)) {
-        goto inclusive;
+    for (i = 0; i < n; i++) {
+        m[i] = ngx_http_location_char(children[i]->name[0]);
     }
 
-    node->right = ngx_http_create_locations_tree(cf, &tail, prefix);
-    if (node->right == NULL) {
-        return NULL;
-    }
+    m = ngx_align_ptr(m + n, sizeof(void *));
 
-inclusive:
+    node->children = (ngx_http_location_tree_node_t **) m;
 
-    if (ngx_queue_empty(&lq->list)) {
-        return node;
-    }
+    *p = ngx_align_ptr(m + n * sizeof(void *), ngx_cacheline_size);
 
-    node->tree = ngx_http_create_locations_tree(cf, &lq->list, prefix + len);
-    if (node->tree == NULL) {
-        return NULL;
+    for (i = 0; i < n; i++) {
+        node->children[i] = ngx_http_location_trie_freeze(children[i], p);
     }
 
     return node;
 }
 
 
+static int ngx_libc_cdecl
+ngx_http_cmp_location_trie(const void *one, const void *two)
+{
+    ngx_http_location_trie_t  *first, *second;
+
+    first = *(ngx_http_location_trie_t **) one;
+    second = *(ngx_http_location_trie_t **) two;
+
+    return (int) ngx_http_location_char(first->name[0])
+           - (int) ngx_http_location_char(second->name[0]);
+}
+
+
 ngx_int_t
 ngx_http_add_listen(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     ngx_http_listen_opt_t *lsopt)
@@ -1390,7 +1500,6 @@ static ngx_int_t
 ngx_http_add_server(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     ngx_http_conf_addr_t *addr)
 {
-    ngx_uint_t                  i;
     ngx_http_core_srv_conf_t  **server;
 
     if (addr->servers.elts == NULL) {
@@ -1402,13 +1511,18 @@ ngx_http_add_server(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
         }
 
     } else {
+
+        /*
+         * all "listen" directives of a server are parsed before the next
+         * server, so only the last server of the address can be the same
+         */
+
         server = addr->servers.elts;
-        for (i = 0; i < addr->servers.nelts; i++) {
-            if (server[i] == cscf) {
-                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                                   "a duplicate listen %s", addr->opt.addr);
-                return NGX_ERROR;
-            }
+
+        if (server[addr->servers.nelts - 1] == cscf) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "a duplicate listen %s", addr->opt.addr);
+            return NGX_ERROR;
         }
     }
 
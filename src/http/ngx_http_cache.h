@@ -88,6 +88,8 @@ struct ngx_http_cache_s {
 
     ngx_buf_t                       *buf;
 
+    ngx_temp_file_t                 *encoded;
+
     ngx_http_file_cache_t           *file_cache;
     ngx_http_file_cache_node_t      *node;
 
@@ -173,6 +175,8 @@ void ngx_http_file_cache_create_key(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_open(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf);
 void ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf);
+ngx_int_t ngx_http_file_cache_write_encoded(ngx_http_request_t *r,
+    ngx_chain_t *in);
 void ngx_http_file_cache_update_header(ngx_http_request_t *r);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
 void ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf);
@@ -24,6 +24,9 @@ typedef struct {
 static ngx_int_t ngx_http_core_find_location(ngx_http_request_t *r);
 static ngx_int_t ngx_http_core_find_static_location(ngx_http_request_t *r,
     ngx_http_location_tree_node_t *node);
+static ngx_inline ngx_http_location_tree_node_t *
+    ngx_http_core_location_child(ngx_http_location_tree_node_t *node,
+    u_char c);
 
 static ngx_int_t ngx_http_core_preconfiguration(ngx_conf_t *cf);
 static ngx_int_t ngx_http_core_postconfiguration(ngx_conf_t *cf);
@@ -74,7 +77,8 @@ static char *ngx_http_core_internal(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_http_core_resolver(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 #if (NGX_HTTP_GZIP)
-static ngx_int_t ngx_http_gzip_accept_encoding(ngx_str_t *ae);
+static ngx_int_t ngx_http_gzip_accept_encoding(ngx_str_t *ae,
+    ngx_str_t *encoding);
 static ngx_uint_t ngx_http_gzip_quantity(u_char *p, u_char *last);
 static char *ngx_http_gzip_disable(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -1539,12 +1543,19 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 #if (NGX_PCRE)
 
     if (noregex == 0 && pclcf->regex_locations) {
+        ngx_regex_filter_t  filter;
+
+        filter.tried = 0;
 
         for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
 
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "test location: ~ \"%V\"", &(*clcfp)->name);
 
+            if (!ngx_regex_filter(&filter, (*clcfp)->regex->regex, &r->uri)) {
+                continue;
+            }
+
             n = ngx_http_regex_exec(r, (*clcfp)->regex, &r->uri);
 
             if (n == NGX_OK) {
@@ -1581,79 +1592,115 @@ static ngx_int_t
 ngx_http_core_find_static_location(ngx_http_request_t *r,
     ngx_http_location_tree_node_t *node)
 {
-    u_char     *uri;
-    size_t      len, n;
-    ngx_int_t   rc, rv;
+    u_char                         *uri, *last;
+    size_t                          len, i;
+    ngx_int_t                       rv;
+    ngx_http_location_tree_node_t  *child;
+
+    if (node == NULL) {
+        return NGX_DECLINED;
+    }
 
-    len = r->uri.len;
     uri = r->uri.data;
+    last = uri + r->uri.len;
 
     rv = NGX_DECLINED;
 
     for ( ;; ) {
 
-        if (node == NULL) {
-            return rv;
-        }
+        /* the uri is matched up to the end of the node name */
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "test location: \"%*s\"",
-                       (size_t) node->len, node->name);
+        if (uri == last) {
+
+            if (node->exact) {
+                r->loc_conf = node->exact->loc_conf;
+                return NGX_OK;
+            }
 
-        n = (len <= (size_t) node->len) ? len : node->len;
+            if (node->inclusive) {
+                r->loc_conf = node->inclusive->loc_conf;
+                return NGX_AGAIN;
+            }
 
-        rc = ngx_filename_cmp(uri, node->name, n);
+            child = ngx_http_core_location_child(node, '/');
 
-        if (rc != 0) {
-            node = (rc < 0) ? node->left : node->right;
+            if (child && child->len == 1 && child->auto_redirect) {
+                goto auto_redirect;
+            }
 
-            continue;
+            return rv;
+        }
+
+        if (node->inclusive) {
+            r->loc_conf = node->inclusive->loc_conf;
+            rv = NGX_AGAIN;
         }
 
-        if (len > (size_t) node->len) {
+        child = ngx_http_core_location_child(node, *uri);
 
-            if (node->inclusive) {
+        if (child == NULL) {
+            return rv;
+        }
 
-                r->loc_conf = node->inclusive->loc_conf;
-                rv = NGX_AGAIN;
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "test location: \"%*s\"",
+                       (size_t) child->len, child->name);
 
-                node = node->tree;
-                uri += n;
-                len -= n;
+        len = last - uri;
 
-                continue;
+        for (i = 1; i < child->len && i < len; i++) {
+            if (ngx_http_location_char(uri[i]) != child->name[i]) {
+                return rv;
             }
+        }
 
-            /* exact only */
+        if (len < child->len) {
 
-            node = node->right;
+            if (len + 1 == child->len && child->auto_redirect) {
+                goto auto_redirect;
+            }
 
-            continue;
+            return rv;
         }
 
-        if (len == (size_t) node->len) {
+        uri += child->len;
+        node = child;
+    }
 
-            if (node->exact) {
-                r->loc_conf = node->exact->loc_conf;
-                return NGX_OK;
+auto_redirect:
 
-            } else {
-                r->loc_conf = node->inclusive->loc_conf;
-                return NGX_AGAIN;
-            }
-        }
+    r->loc_conf = (child->exact) ? child->exact->loc_conf:
+                                   child->inclusive->loc_conf;
+    return NGX_DONE;
+}
 
-        /* len < node->len */
 
-        if (len + 1 == (size_t) node->len && node->auto_redirect) {
+static ngx_inline ngx_http_location_tree_node_t *
+ngx_http_core_location_child(ngx_http_location_tree_node_t *node, u_char c)
+{
+    ngx_uint_t  left, right, middle;
 
-            r->loc_conf = (node->exact) ? node->exact->loc_conf:
-                                          node->inclusive->loc_conf;
-            rv = NGX_DONE;
+    c = ngx_http_location_char(c);
+
+    left = 0;
+    right = node->nchildren;
+
+    while (left < right) {
+        middle = (left + right) / 2;
+
+        if (node->keys[middle] == c) {
+            return node->children[middle];
         }
 
-        node = node->left;
+        if (node->keys[middle] < c) {
+            left = middle + 1;
+
+        } else {
+            right = middle;
+        }
     }
+
+    return NULL;
 }
 
 
@@ -2128,14 +2175,31 @@ ngx_http_auth_basic_user(ngx_http_request_t *r)
 ngx_int_t
 ngx_http_gzip_ok(ngx_http_request_t *r)
 {
-    time_t                     date, expires;
-    ngx_uint_t                 p;
-    ngx_array_t               *cc;
-    ngx_table_elt_t           *e, *d, *ae;
-    ngx_http_core_loc_conf_t  *clcf;
+    static ngx_str_t  gzip = ngx_string("gzip");
 
     r->gzip_tested = 1;
 
+    if (ngx_http_gzip_encoding_ok(r, &gzip) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    r->gzip_ok = 1;
+
+    return NGX_OK;
+}
+
+
+/*
+ * the tests of the request only: Accept-Encoding, gzip_http_version,
+ * and gzip_disable; gzip_proxied also depends on the response
+ */
+
+ngx_int_t
+ngx_http_gzip_client_ok(ngx_http_request_t *r, ngx_str_t *encoding)
+{
+    ngx_table_elt_t           *ae;
+    ngx_http_core_loc_conf_t  *clcf;
+
     if (r != r->main) {
         return NGX_DECLINED;
     }
@@ -2145,7 +2209,7 @@ ngx_http_gzip_ok(ngx_http_request_t *r)
         return NGX_DECLINED;
     }
 
-    if (ae->value.len < sizeof("gzip") - 1) {
+    if (ae->value.len < encoding->len) {
         return NGX_DECLINED;
     }
 
@@ -2158,8 +2222,10 @@ ngx_http_gzip_ok(ngx_http_request_t *r)
      *   Opera:   "gzip, deflate"
      */
 
-    if (ngx_memcmp(ae->value.data, "gzip,", 5) != 0
-        && ngx_http_gzip_accept_encoding(&ae->value) != NGX_OK)
+    if ((ae->value.len == encoding->len
+         || ae->value.data[encoding->len] != ','
+         || ngx_memcmp(ae->value.data, encoding->data, encoding->len) != 0)
+        && ngx_http_gzip_accept_encoding(&ae->value, encoding) != NGX_OK)
     {
         return NGX_DECLINED;
     }
@@ -2174,6 +2240,45 @@ ngx_http_gzip_ok(ngx_http_request_t *r)
         return NGX_DECLINED;
     }
 
+#if (NGX_PCRE)
+
+    if (clcf->gzip_disable && r->headers_in.user_agent) {
+
+        if (ngx_regex_exec_array(clcf->gzip_disable,
+                                 &r->headers_in.user_agent->value,
+                                 r->connection->log)
+            != NGX_DECLINED)
+        {
+            return NGX_DECLINED;
+        }
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+/*
+ * the same tests as for gzip, including gzip_http_version, gzip_proxied,
+ * and gzip_disable, for other content codings, e.g., "br"
+ */
+
+ngx_int_t
+ngx_http_gzip_encoding_ok(ngx_http_request_t *r, ngx_str_t *encoding)
+{
+    time_t                     date, expires;
+    ngx_uint_t                 p;
+    ngx_array_t               *cc;
+    ngx_table_elt_t           *e, *d;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    if (ngx_http_gzip_client_ok(r, encoding) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
     if (r->headers_in.via == NULL) {
         goto ok;
     }
@@ -2265,23 +2370,6 @@ ngx_http_gzip_ok(ngx_http_request_t *r)
 
 ok:
 
-#if (NGX_PCRE)
-
-    if (clcf->gzip_disable && r->headers_in.user_agent) {
-
-        if (ngx_regex_exec_array(clcf->gzip_disable,
-                                 &r->headers_in.user_agent->value,
-                                 r->connection->log)
-            != NGX_DECLINED)
-        {
-            return NGX_DECLINED;
-        }
-    }
-
-#endif
-
-    r->gzip_ok = 1;
-
     return NGX_OK;
 }
 
@@ -2294,7 +2382,7 @@ ok:
  */
 
 static ngx_int_t
-ngx_http_gzip_accept_encoding(ngx_str_t *ae)
+ngx_http_gzip_accept_encoding(ngx_str_t *ae, ngx_str_t *encoding)
 {
     u_char  *p, *start, *last;
 
@@ -2302,7 +2390,7 @@ ngx_http_gzip_accept_encoding(ngx_str_t *ae)
     last = start + ae->len;
 
     for ( ;; ) {
-        p = ngx_strcasestrn(start, "gzip", 4 - 1);
+        p = ngx_strcasestrn(start, (char *) encoding->data, encoding->len - 1);
         if (p == NULL) {
             return NGX_DECLINED;
         }
@@ -2311,10 +2399,10 @@ ngx_http_gzip_accept_encoding(ngx_str_t *ae)
             break;
         }
 
-        start = p + 4;
+        start = p + encoding->len;
     }
 
-    p += 4;
+    p += encoding->len;
 
     while (p < last) {
         switch (*p++) {
@@ -471,24 +471,36 @@ typedef struct {
     ngx_str_t                       *name;
     u_char                          *file_name;
     ngx_uint_t                       line;
-    ngx_queue_t                      list;
 } ngx_http_location_queue_t;
 
 
-struct ngx_http_location_tree_node_s {
-    ngx_http_location_tree_node_t   *left;
-    ngx_http_location_tree_node_t   *right;
-    ngx_http_location_tree_node_t   *tree;
+/*
+ * static locations are looked up in a compressed prefix trie:
+ * each node holds the part of a location name after its parent,
+ * and its children are sorted by the first byte of their names
+ */
 
+struct ngx_http_location_tree_node_s {
     ngx_http_core_loc_conf_t        *exact;
     ngx_http_core_loc_conf_t        *inclusive;
 
+    ngx_http_location_tree_node_t  **children;
+    u_char                          *keys;
+
+    u_short                          nchildren;
+    u_short                          len;
     u_char                           auto_redirect;
-    u_char                           len;
     u_char                           name[1];
 };
 
 
+#if (NGX_HAVE_CASELESS_FILESYSTEM)
+#define ngx_http_location_char(c)  ngx_tolower(c)
+#else
+#define ngx_http_location_char(c)  (c)
+#endif
+
+
 void ngx_http_core_run_phases(ngx_http_request_t *r);
 ngx_int_t ngx_http_core_generic_phase(ngx_http_request_t *r,
     ngx_http_phase_handler_t *ph);
@@ -520,6 +532,9 @@ u_char *ngx_http_map_uri_to_path(ngx_http_request_t *r, ngx_str_t *name,
 ngx_int_t ngx_http_auth_basic_user(ngx_http_request_t *r);
 #if (NGX_HTTP_GZIP)
 ngx_int_t ngx_http_gzip_ok(ngx_http_request_t *r);
+ngx_int_t ngx_http_gzip_client_ok(ngx_http_request_t *r, ngx_str_t *encoding);
+ngx_int_t ngx_http_gzip_encoding_ok(ngx_http_request_t *r,
+    ngx_str_t *encoding);
 #endif
 
 
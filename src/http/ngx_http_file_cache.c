@@ -1419,6 +1419,83 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 }
 
 
+/*
+ * the compressed variant of a response is written by the gzip filter
+ * as it is produced; the entry is committed on the last buffer
+ */
+
+ngx_int_t
+ngx_http_file_cache_write_encoded(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    ssize_t            n;
+    ngx_uint_t         last;
+    ngx_chain_t       *cl, *ln, *out, **ll;
+    ngx_temp_file_t   *tf;
+    ngx_http_cache_t  *c;
+
+    c = r->cache;
+    tf = c->encoded;
+
+    out = NULL;
+    ll = &out;
+    last = 0;
+
+    for (cl = in; cl; cl = cl->next) {
+
+        if (cl->buf->last_buf) {
+            last = 1;
+        }
+
+        if (ngx_buf_special(cl->buf) || !ngx_buf_in_memory(cl->buf)) {
+            continue;
+        }
+
+        ln = ngx_alloc_chain_link(r->pool);
+        if (ln == NULL) {
+            goto failed;
+        }
+
+        ln->buf = cl->buf;
+        *ll = ln;
+        ll = &ln->next;
+    }
+
+    *ll = NULL;
+
+    if (out) {
+        n = ngx_write_chain_to_temp_file(tf, out);
+
+        for (cl = out; cl; cl = ln) {
+            ln = cl->next;
+            ngx_free_chain(r->pool, cl);
+        }
+
+        if (n == NGX_ERROR) {
+            goto failed;
+        }
+
+        tf->offset += n;
+    }
+
+    if (last) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache encoded: %O", tf->offset);
+
+        c->encoded = NULL;
+        ngx_http_file_cache_update(r, tf);
+    }
+
+    return NGX_OK;
+
+failed:
+
+    c->encoded = NULL;
+    ngx_http_file_cache_free(c, tf);
+
+    return NGX_ERROR;
+}
+
+
 void
 ngx_http_file_cache_update_header(ngx_http_request_t *r)
 {
@@ -1679,6 +1756,15 @@ ngx_http_file_cache_cleanup(void *data)
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
                    "http file cache cleanup");
 
+    if (c->encoded) {
+
+        /* the compressed variant was not completed */
+
+        ngx_http_file_cache_free(c, c->encoded);
+        c->encoded = NULL;
+        return;
+    }
+
     if (c->updating) {
         ngx_log_error(NGX_LOG_ALERT, c->file.log, 0,
                       "stalled cache updating, error:%ui", c->error);
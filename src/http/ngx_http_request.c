@@ -523,6 +523,8 @@ ngx_http_create_request(ngx_connection_t *c)
         return NULL;
     }
 
+    ngx_pool_set_type(pool, NGX_POOL_REQUEST);
+
     r = ngx_pcalloc(pool, sizeof(ngx_http_request_t));
     if (r == NULL) {
         ngx_destroy_pool(pool);
@@ -571,7 +573,7 @@ ngx_http_create_request(ngx_connection_t *c)
     }
 
 #if (NGX_HTTP_SSL)
-    if (c->ssl) {
+    if (c->ssl && !c->ssl->sendfile) {
         r->main_filter_need_in_memory = 1;
     }
 #endif
@@ -2112,10 +2114,13 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
     if (host->len && virtual_names->nregex) {
         ngx_int_t                n;
         ngx_uint_t               i;
+        ngx_regex_filter_t       filter;
         ngx_http_server_name_t  *sn;
 
         sn = virtual_names->regex;
 
+        filter.tried = 0;
+
 #if (NGX_HTTP_SSL && defined SSL_CTRL_SET_TLSEXT_HOSTNAME)
 
         if (r == NULL) {
@@ -2123,6 +2128,10 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
 
             for (i = 0; i < virtual_names->nregex; i++) {
 
+                if (!ngx_regex_filter(&filter, sn[i].regex->regex, host)) {
+                    continue;
+                }
+
                 n = ngx_regex_exec(sn[i].regex->regex, host, NULL, 0);
 
                 if (n == NGX_REGEX_NO_MATCHED) {
@@ -2152,6 +2161,10 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
 
         for (i = 0; i < virtual_names->nregex; i++) {
 
+            if (!ngx_regex_filter(&filter, sn[i].regex->regex, host)) {
+                continue;
+            }
+
             n = ngx_http_regex_exec(r, sn[i].regex, host);
 
             if (n == NGX_DECLINED) {
@@ -3045,6 +3058,19 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
     c->idle = 1;
     ngx_reusable_connection(c, 1);
 
+    /*
+     * an idle connection without TLS state and proxy protocol header
+     * may be passed to a new worker process on reconfiguration
+     */
+
+    c->handoff = !hc->addr_conf->proxy_protocol;
+
+#if (NGX_HTTP_SSL)
+    if (c->ssl) {
+        c->handoff = 0;
+    }
+#endif
+
     ngx_add_timer(rev, clcf->keepalive_timeout);
 
     if (rev->ready) {
@@ -3166,6 +3192,7 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
     c->log->action = "reading client request line";
 
     c->idle = 0;
+    c->handoff = 0;
     ngx_reusable_connection(c, 0);
 
     c->data = ngx_http_create_request(c);
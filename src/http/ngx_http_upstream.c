@@ -17,6 +17,10 @@ static ngx_int_t ngx_http_upstream_cache_get(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_http_file_cache_t **cache);
 static ngx_int_t ngx_http_upstream_cache_send(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+#if (NGX_HTTP_GZIP)
+static ngx_int_t ngx_http_upstream_cache_encoded(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+#endif
 static ngx_int_t ngx_http_upstream_cache_status(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_upstream_cache_last_modified(ngx_http_request_t *r,
@@ -768,9 +772,15 @@ found:
 static ngx_int_t
 ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
-    ngx_int_t               rc;
-    ngx_http_cache_t       *c;
-    ngx_http_file_cache_t  *cache;
+    ngx_int_t                  rc;
+    ngx_str_t                 *key;
+    ngx_http_cache_t          *c;
+    ngx_http_file_cache_t     *cache;
+#if (NGX_HTTP_GZIP)
+    ngx_http_core_loc_conf_t  *clcf;
+
+    static ngx_str_t  gzip = ngx_string("gzip");
+#endif
 
     c = r->cache;
 
@@ -800,6 +810,33 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
         /* TODO: add keys */
 
+#if (NGX_HTTP_GZIP)
+
+        /*
+         * gzip capable clients use a separate, compressed entry; the response
+         * headers are not known yet, so gzip_proxied is only tested for "off",
+         * the gzip filter makes its own decision later
+         */
+
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        if (u->conf->cache_gzip
+            && ngx_http_gzip_client_ok(r, &gzip) == NGX_OK
+            && (r->headers_in.via == NULL
+                || !(clcf->gzip_proxied & NGX_HTTP_GZIP_PROXIED_OFF)))
+        {
+            key = ngx_array_push(&r->cache->keys);
+            if (key == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_str_set(key, "gzip");
+
+            u->cache_gzip = 1;
+        }
+
+#endif
+
         ngx_http_file_cache_create_key(r);
 
         if (r->cache->header_start + 256 >= u->conf->buffer_size) {
@@ -1000,6 +1037,21 @@ ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
             return NGX_DONE;
         }
 
+#if (NGX_HTTP_GZIP)
+
+        if (u->cache_gzip && u->headers_in.content_encoding) {
+
+            /* the gzip filter does not run for a stored compressed variant */
+
+            r->gzip_vary = 1;
+
+            if (r->headers_out.content_length_n == -1) {
+                r->headers_out.content_length_n = c->length - c->body_start;
+            }
+        }
+
+#endif
+
         return ngx_http_cache_send(r);
     }
 
@@ -1014,6 +1066,143 @@ ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
     return rc;
 }
 
+
+#if (NGX_HTTP_GZIP)
+
+static ngx_int_t
+ngx_http_upstream_cache_encoded(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    u_char            *p, *pos, *last, *eol;
+    size_t             len;
+    ssize_t            n;
+    ngx_buf_t         *b;
+    ngx_chain_t        out;
+    ngx_table_elt_t   *h;
+    ngx_temp_file_t   *tf;
+    ngx_http_cache_t  *c;
+
+    h = r->headers_out.content_encoding;
+
+    if (u->headers_in.content_encoding || h == NULL || h->value.len == 0) {
+
+        /* the response is stored as is */
+
+        if (r->header_only && u->headers_in.content_encoding == NULL) {
+            u->cacheable = 0;
+        }
+
+        return NGX_DECLINED;
+    }
+
+    if (h->value.len != 4
+        || ngx_strncasecmp(h->value.data, (u_char *) "gzip", 4) != 0)
+    {
+        /* some other filter has encoded the response */
+
+        u->cacheable = 0;
+        return NGX_DECLINED;
+    }
+
+    /*
+     * the stored header is the upstream one with "Content-Length" removed,
+     * the entity tag made weak, and "Content-Encoding: gzip" added
+     */
+
+    c = r->cache;
+
+    pos = u->buffer.start + c->header_start;
+    last = u->buffer.pos;
+
+    len = c->header_start + (last - pos)
+          + sizeof("W/") - 1 + sizeof("Content-Encoding: gzip" CRLF) - 1;
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = b->start + c->header_start;
+
+    while (pos < last) {
+
+        eol = ngx_strlchr(pos, last, LF);
+        eol = eol ? eol + 1 : last;
+
+        if (*pos == CR || *pos == LF) {
+            p = ngx_cpymem(p, "Content-Encoding: gzip" CRLF,
+                           sizeof("Content-Encoding: gzip" CRLF) - 1);
+            p = ngx_cpymem(p, pos, last - pos);
+            break;
+        }
+
+        if (eol - pos > 15
+            && ngx_strncasecmp(pos, (u_char *) "Content-Length:", 15) == 0)
+        {
+            pos = eol;
+            continue;
+        }
+
+        if (eol - pos > 5
+            && ngx_strncasecmp(pos, (u_char *) "ETag:", 5) == 0)
+        {
+            p = ngx_cpymem(p, pos, 5);
+            pos += 5;
+
+            while (pos < eol && *pos == ' ') {
+                *p++ = *pos++;
+            }
+
+            if (pos < eol && *pos == '"') {
+                p = ngx_cpymem(p, "W/", 2);
+            }
+        }
+
+        p = ngx_cpymem(p, pos, eol - pos);
+        pos = eol;
+    }
+
+    b->last = p;
+
+    c->body_start = b->last - b->start;
+
+    if (ngx_http_file_cache_set_header(r, b->start) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    tf = ngx_pcalloc(r->pool, sizeof(ngx_temp_file_t));
+    if (tf == NULL) {
+        return NGX_ERROR;
+    }
+
+    tf->file.fd = NGX_INVALID_FILE;
+    tf->file.log = r->connection->log;
+    tf->path = c->file_cache->temp_path ? c->file_cache->temp_path
+                                        : u->conf->temp_path;
+    tf->pool = r->pool;
+    tf->persistent = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    n = ngx_write_chain_to_temp_file(tf, &out);
+
+    if (n == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    tf->offset += n;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream cache encoded: \"%V\"", &tf->file.name);
+
+    c->encoded = tf;
+    u->cache_encoded = 1;
+
+    return NGX_OK;
+}
+
+#endif
+
 #endif
 
 
@@ -1165,6 +1354,16 @@ ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
             }
         }
 
+#if (NGX_HTTP_CACHE)
+
+        /* the compressed variant cannot be completed without the client */
+
+        if (u->cache_encoded) {
+            u->cacheable = 0;
+        }
+
+#endif
+
         if (!u->cacheable) {
             ngx_http_upstream_finalize_request(r, u,
                                                NGX_HTTP_CLIENT_CLOSED_REQUEST);
@@ -1194,6 +1393,12 @@ ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
             ev->error = 1;
         }
 
+#if (NGX_HTTP_CACHE)
+        if (u->cache_encoded) {
+            u->cacheable = 0;
+        }
+#endif
+
         if (!u->cacheable && u->peer.connection) {
             ngx_log_error(NGX_LOG_INFO, ev->log, ev->kq_errno,
                           "kevent() reported that client prematurely closed "
@@ -1243,6 +1448,12 @@ ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
             ev->error = 1;
         }
 
+#if (NGX_HTTP_CACHE)
+        if (u->cache_encoded) {
+            u->cacheable = 0;
+        }
+#endif
+
         if (!u->cacheable && u->peer.connection) {
             ngx_log_error(NGX_LOG_INFO, ev->log, err,
                         "epoll_wait() reported that client prematurely closed "
@@ -1306,6 +1517,12 @@ ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
     ev->eof = 1;
     c->error = 1;
 
+#if (NGX_HTTP_CACHE)
+    if (u->cache_encoded) {
+        u->cacheable = 0;
+    }
+#endif
+
     if (!u->cacheable && u->peer.connection) {
         ngx_log_error(NGX_LOG_INFO, ev->log, err,
                       "client prematurely closed connection, "
@@ -1399,6 +1616,8 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
                                                NGX_HTTP_INTERNAL_SERVER_ERROR);
             return;
         }
+
+        ngx_pool_set_type(c->pool, NGX_POOL_UPSTREAM);
     }
 
     c->log = r->connection->log;
@@ -2851,7 +3070,19 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
                 ngx_str_null(&r->cache->etag);
             }
 
-            if (ngx_http_file_cache_set_header(r, u->buffer.start) != NGX_OK) {
+            rc = NGX_DECLINED;
+
+#if (NGX_HTTP_GZIP)
+            if (u->cache_gzip) {
+                rc = ngx_http_upstream_cache_encoded(r, u);
+            }
+#endif
+
+            if (rc == NGX_ERROR
+                || (rc == NGX_DECLINED && u->cacheable
+                    && ngx_http_file_cache_set_header(r, u->buffer.start)
+                       != NGX_OK))
+            {
                 ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
                 return;
             }
@@ -2891,6 +3122,13 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     p->cacheable = u->cacheable || u->store;
 
+#if (NGX_HTTP_CACHE)
+    if (u->cache_encoded) {
+        /* the compressed variant is written by the gzip filter */
+        p->cacheable = u->store;
+    }
+#endif
+
     p->temp_file = ngx_pcalloc(r->pool, sizeof(ngx_temp_file_t));
     if (p->temp_file == NULL) {
         ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
@@ -2939,7 +3177,7 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     p->preread_size = u->buffer.last - u->buffer.pos;
 
-    if (u->cacheable) {
+    if (u->cacheable && p->cacheable) {
 
         p->buf_to_file = ngx_calloc_buf(r->pool);
         if (p->buf_to_file == NULL) {
@@ -3784,7 +4022,7 @@ ngx_http_upstream_process_request(ngx_http_request_t *r,
 
 #if (NGX_HTTP_CACHE)
 
-        if (u->cacheable) {
+        if (u->cacheable && !u->cache_encoded) {
 
             if (p->upstream_done) {
                 ngx_http_file_cache_update(r, p->temp_file);
@@ -3836,6 +4074,12 @@ ngx_http_upstream_process_request(ngx_http_request_t *r,
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "http upstream downstream error");
 
+#if (NGX_HTTP_CACHE)
+        if (u->cache_encoded) {
+            u->cacheable = 0;
+        }
+#endif
+
         if (!u->cacheable && !u->store && u->peer.connection) {
             ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
         }
@@ -4183,7 +4427,9 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
             }
         }
 
-        ngx_http_file_cache_free(r->cache, u->pipe->temp_file);
+        if (!u->cache_encoded) {
+            ngx_http_file_cache_free(r->cache, u->pipe->temp_file);
+        }
     }
 
 #endif
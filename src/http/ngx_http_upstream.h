@@ -195,6 +195,7 @@ typedef struct {
 
     ngx_flag_t                       cache_revalidate;
     ngx_flag_t                       cache_convert_head;
+    ngx_flag_t                       cache_gzip;
 
     ngx_array_t                     *cache_valid;
     ngx_array_t                     *cache_bypass;
@@ -364,6 +365,8 @@ struct ngx_http_upstream_s {
     unsigned                         ssl:1;
 #if (NGX_HTTP_CACHE)
     unsigned                         cache_status:3;
+    unsigned                         cache_gzip:1;
+    unsigned                         cache_encoded:1;
 #endif
 
     unsigned                         buffering:1;
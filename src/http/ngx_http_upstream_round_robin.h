@@ -46,6 +46,10 @@ struct ngx_http_upstream_rr_peer_s {
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_atomic_t                    lock;
+#if (NGX_HTTP_SSL)
+    ngx_http_upstream_rr_peer_t    *local;
+    ngx_atomic_uint_t               ssl_session_generation;
+#endif
 #endif
 };
 
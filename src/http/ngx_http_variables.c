@@ -2261,12 +2261,19 @@ ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map, ngx_str_t *match)
     if (len && map->nregex) {
         ngx_int_t              n;
         ngx_uint_t             i;
+        ngx_regex_filter_t     filter;
         ngx_http_map_regex_t  *reg;
 
         reg = map->regex;
 
+        filter.tried = 0;
+
         for (i = 0; i < map->nregex; i++) {
 
+            if (!ngx_regex_filter(&filter, reg[i].regex->regex, match)) {
+                continue;
+            }
+
             n = ngx_http_regex_exec(r, reg[i].regex, match);
 
             if (n == NGX_OK) {
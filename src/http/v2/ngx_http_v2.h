@@ -26,6 +26,8 @@
 
 #define NGX_HTTP_V2_FRAME_HEADER_SIZE    9
 
+#define NGX_HTTP_V2_FRAME_HEADERS_SLAB   16
+
 /* frame types */
 #define NGX_HTTP_V2_DATA_FRAME           0x0
 #define NGX_HTTP_V2_HEADERS_FRAME        0x1
@@ -131,6 +133,7 @@ struct ngx_http_v2_connection_s {
     ngx_pool_t                      *pool;
 
     ngx_http_v2_out_frame_t         *free_frames;
+    ngx_chain_t                     *free_frame_headers;
     ngx_connection_t                *free_fake_connections;
 
     ngx_http_v2_node_t             **streams_index;
@@ -180,7 +183,6 @@ struct ngx_http_v2_stream_s {
     ngx_buf_t                       *preread;
 
     ngx_http_v2_out_frame_t         *free_frames;
-    ngx_chain_t                     *free_frame_headers;
     ngx_chain_t                     *free_bufs;
 
     ngx_queue_t                      queue;
@@ -66,6 +66,8 @@ static ngx_chain_t *ngx_http_v2_filter_get_shadow(
 static ngx_http_v2_out_frame_t *ngx_http_v2_filter_get_data_frame(
     ngx_http_v2_stream_t *stream, size_t len, ngx_chain_t *first,
     ngx_chain_t *last);
+static ngx_chain_t *ngx_http_v2_filter_get_frame_header(
+    ngx_http_v2_connection_t *h2c);
 
 static ngx_inline ngx_int_t ngx_http_v2_flow_control(
     ngx_http_v2_connection_t *h2c, ngx_http_v2_stream_t *stream);
@@ -1024,28 +1026,13 @@ ngx_http_v2_filter_get_data_frame(ngx_http_v2_stream_t *stream,
                    "http2:%ui create DATA frame %p: len:%uz flags:%ui",
                    stream->node->id, frame, len, (ngx_uint_t) flags);
 
-    cl = ngx_chain_get_free_buf(stream->request->pool,
-                                &stream->free_frame_headers);
+    cl = ngx_http_v2_filter_get_frame_header(stream->connection);
     if (cl == NULL) {
         return NULL;
     }
 
     buf = cl->buf;
 
-    if (!buf->start) {
-        buf->start = ngx_palloc(stream->request->pool,
-                                NGX_HTTP_V2_FRAME_HEADER_SIZE);
-        if (buf->start == NULL) {
-            return NULL;
-        }
-
-        buf->end = buf->start + NGX_HTTP_V2_FRAME_HEADER_SIZE;
-        buf->last = buf->end;
-
-        buf->tag = (ngx_buf_tag_t) &ngx_http_v2_module;
-        buf->memory = 1;
-    }
-
     buf->pos = buf->start;
     buf->last = buf->pos;
 
@@ -1072,6 +1059,65 @@ ngx_http_v2_filter_get_data_frame(ngx_http_v2_stream_t *stream,
 }
 
 
+static ngx_chain_t *
+ngx_http_v2_filter_get_frame_header(ngx_http_v2_connection_t *h2c)
+{
+    u_char       *p;
+    ngx_buf_t    *buf;
+    ngx_uint_t    i;
+    ngx_chain_t  *cl;
+
+    /*
+     * DATA frame headers are carved out of the connection pool in slabs
+     * and recycled across streams, so a DATA frame costs no allocations
+     * beyond the chain links pointing to the response buffers
+     */
+
+    cl = h2c->free_frame_headers;
+
+    if (cl) {
+        h2c->free_frame_headers = cl->next;
+        cl->next = NULL;
+        return cl;
+    }
+
+    cl = ngx_pcalloc(h2c->pool, NGX_HTTP_V2_FRAME_HEADERS_SLAB
+                                * (sizeof(ngx_chain_t) + sizeof(ngx_buf_t)
+                                   + NGX_HTTP_V2_FRAME_HEADER_SIZE));
+    if (cl == NULL) {
+        return NULL;
+    }
+
+    buf = (ngx_buf_t *) &cl[NGX_HTTP_V2_FRAME_HEADERS_SLAB];
+    p = (u_char *) &buf[NGX_HTTP_V2_FRAME_HEADERS_SLAB];
+
+    for (i = 0; i < NGX_HTTP_V2_FRAME_HEADERS_SLAB; i++) {
+        buf[i].start = p;
+        buf[i].pos = p;
+        buf[i].last = p;
+        buf[i].end = p + NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+        buf[i].tag = (ngx_buf_tag_t) &ngx_http_v2_module;
+        buf[i].memory = 1;
+
+        cl[i].buf = &buf[i];
+
+        p += NGX_HTTP_V2_FRAME_HEADER_SIZE;
+    }
+
+    for (i = 1; i < NGX_HTTP_V2_FRAME_HEADERS_SLAB; i++) {
+        cl[i].next = h2c->free_frame_headers;
+        h2c->free_frame_headers = &cl[i];
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 frame headers slab: %p n:%ui",
+                   cl, (ngx_uint_t) NGX_HTTP_V2_FRAME_HEADERS_SLAB);
+
+    return cl;
+}
+
+
 static ngx_inline ngx_int_t
 ngx_http_v2_filter_send(ngx_connection_t *fc, ngx_http_v2_stream_t *stream)
 {
@@ -1170,14 +1216,8 @@ ngx_http_v2_headers_frame_handler(ngx_http_v2_connection_t *h2c,
 
         ln = cl->next;
 
-        if (cl->buf->tag == (ngx_buf_tag_t) &ngx_http_v2_module) {
-            cl->next = stream->free_frame_headers;
-            stream->free_frame_headers = cl;
-
-        } else {
-            cl->next = stream->free_bufs;
-            stream->free_bufs = cl;
-        }
+        cl->next = stream->free_bufs;
+        stream->free_bufs = cl;
 
         if (cl == frame->last) {
             break;
@@ -1222,8 +1262,8 @@ ngx_http_v2_data_frame_handler(ngx_http_v2_connection_t *h2c,
 
         ln = cl->next;
 
-        cl->next = stream->free_frame_headers;
-        stream->free_frame_headers = cl;
+        cl->next = h2c->free_frame_headers;
+        h2c->free_frame_headers = cl;
 
         if (cl == frame->last) {
             goto done;
@@ -1351,6 +1391,7 @@ ngx_http_v2_filter_cleanup(void *data)
     size_t                     window;
     ngx_event_t               *wev;
     ngx_queue_t               *q;
+    ngx_chain_t               *cl, *ln;
     ngx_http_v2_out_frame_t   *frame, **fn;
     ngx_http_v2_connection_t  *h2c;
 
@@ -1379,6 +1420,24 @@ ngx_http_v2_filter_cleanup(void *data)
 
             window += frame->length;
 
+            /* DATA frame headers belong to the connection, reuse them */
+
+            if (frame->handler == ngx_http_v2_data_frame_handler) {
+
+                for (cl = frame->first; /* void */ ; cl = ln) {
+                    ln = cl->next;
+
+                    if (cl->buf->tag == (ngx_buf_tag_t) &ngx_http_v2_module) {
+                        cl->next = h2c->free_frame_headers;
+                        h2c->free_frame_headers = cl;
+                    }
+
+                    if (cl == frame->last) {
+                        break;
+                    }
+                }
+            }
+
             if (--stream->queued == 0) {
                 break;
             }
@@ -150,7 +150,9 @@ ngx_read_channel(ngx_socket_t s, ngx_channel_t *ch, size_t size, ngx_log_t *log)
 
 #if (NGX_HAVE_MSGHDR_MSG_CONTROL)
 
-    if (ch->command == NGX_CMD_OPEN_CHANNEL) {
+    if (ch->command == NGX_CMD_OPEN_CHANNEL
+        || ch->command == NGX_CMD_PASS_CONNECTION)
+    {
 
         if (cmsg.cm.cmsg_len < (socklen_t) CMSG_LEN(sizeof(int))) {
             ngx_log_error(NGX_LOG_ALERT, log, 0,
@@ -179,7 +181,9 @@ ngx_read_channel(ngx_socket_t s, ngx_channel_t *ch, size_t size, ngx_log_t *log)
 
 #else
 
-    if (ch->command == NGX_CMD_OPEN_CHANNEL) {
+    if (ch->command == NGX_CMD_OPEN_CHANNEL
+        || ch->command == NGX_CMD_PASS_CONNECTION)
+    {
         if (msg.msg_accrightslen != sizeof(int)) {
             ngx_log_error(NGX_LOG_ALERT, log, 0,
                           "recvmsg() returned no ancillary data");
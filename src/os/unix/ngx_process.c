@@ -33,6 +33,7 @@ char           **ngx_os_argv;
 ngx_int_t        ngx_process_slot;
 ngx_socket_t     ngx_channel;
 ngx_int_t        ngx_last_process;
+ngx_uint_t       ngx_generation;
 ngx_process_t    ngx_processes[NGX_MAX_PROCESSES];
 
 
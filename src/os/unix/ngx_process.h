@@ -28,6 +28,8 @@ typedef struct {
     void               *data;
     char               *name;
 
+    ngx_uint_t          generation;
+
     unsigned            respawn:1;
     unsigned            just_spawn:1;
     unsigned            detached:1;
@@ -82,6 +84,7 @@ extern ngx_pid_t      ngx_pid;
 extern ngx_socket_t   ngx_channel;
 extern ngx_int_t      ngx_process_slot;
 extern ngx_int_t      ngx_last_process;
+extern ngx_uint_t     ngx_generation;
 extern ngx_process_t  ngx_processes[NGX_MAX_PROCESSES];
 
 
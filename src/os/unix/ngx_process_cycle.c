@@ -19,10 +19,12 @@ static void ngx_pass_open_channel(ngx_cycle_t *cycle, ngx_channel_t *ch);
 static void ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo);
 static ngx_uint_t ngx_reap_children(ngx_cycle_t *cycle);
 static void ngx_master_process_exit(ngx_cycle_t *cycle);
+static void ngx_shared_memory_stat(ngx_cycle_t *cycle);
 static void ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data);
 static void ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker);
 static void ngx_worker_process_exit(ngx_cycle_t *cycle);
 static void ngx_channel_handler(ngx_event_t *ev);
+static void ngx_pass_idle_connections(ngx_cycle_t *cycle);
 static void ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data);
 static void ngx_cache_manager_process_handler(ngx_event_t *ev);
 static void ngx_cache_loader_process_handler(ngx_event_t *ev);
@@ -266,6 +268,7 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
             ngx_reopen_files(cycle, ccf->user);
             ngx_signal_worker_processes(cycle,
                                         ngx_signal_value(NGX_REOPEN_SIGNAL));
+            ngx_shared_memory_stat(cycle);
         }
 
         if (ngx_change_binary) {
@@ -294,6 +297,8 @@ ngx_single_process_cycle(ngx_cycle_t *cycle)
         exit(2);
     }
 
+    ngx_pool_cache_init(cycle);
+
     for (i = 0; cycle->modules[i]; i++) {
         if (cycle->modules[i]->init_process) {
             if (cycle->modules[i]->init_process(cycle) == NGX_ERROR) {
@@ -336,6 +341,11 @@ ngx_single_process_cycle(ngx_cycle_t *cycle)
             ngx_reopen = 0;
             ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "reopening logs");
             ngx_reopen_files(cycle, (ngx_uid_t) -1);
+            ngx_shared_memory_stat(cycle);
+
+#if (NGX_PALLOC_PROFILE)
+            ngx_pool_profile_log(cycle->log);
+#endif
         }
     }
 }
@@ -352,12 +362,15 @@ ngx_start_worker_processes(ngx_cycle_t *cycle, ngx_int_t n, ngx_int_t type)
     ngx_memzero(&ch, sizeof(ngx_channel_t));
 
     ch.command = NGX_CMD_OPEN_CHANNEL;
+    ch.generation = ++ngx_generation;
 
     for (i = 0; i < n; i++) {
 
         ngx_spawn_process(cycle, ngx_worker_process_cycle,
                           (void *) (intptr_t) i, "worker process", type);
 
+        ngx_processes[ngx_process_slot].generation = ngx_generation;
+
         ch.pid = ngx_processes[ngx_process_slot].pid;
         ch.slot = ngx_process_slot;
         ch.fd = ngx_processes[ngx_process_slot].channel[0];
@@ -397,6 +410,8 @@ ngx_start_cache_manager_processes(ngx_cycle_t *cycle, ngx_uint_t respawn)
                       &ngx_cache_manager_ctx, "cache manager process",
                       respawn ? NGX_PROCESS_JUST_RESPAWN : NGX_PROCESS_RESPAWN);
 
+    ngx_processes[ngx_process_slot].generation = 0;
+
     ngx_memzero(&ch, sizeof(ngx_channel_t));
 
     ch.command = NGX_CMD_OPEN_CHANNEL;
@@ -414,6 +429,8 @@ ngx_start_cache_manager_processes(ngx_cycle_t *cycle, ngx_uint_t respawn)
                       &ngx_cache_loader_ctx, "cache loader process",
                       respawn ? NGX_PROCESS_JUST_SPAWN : NGX_PROCESS_NORESPAWN);
 
+    ngx_processes[ngx_process_slot].generation = 0;
+
     ch.command = NGX_CMD_OPEN_CHANNEL;
     ch.pid = ngx_processes[ngx_process_slot].pid;
     ch.slot = ngx_process_slot;
@@ -634,6 +651,7 @@ ngx_reap_children(ngx_cycle_t *cycle)
                 ch.pid = ngx_processes[ngx_process_slot].pid;
                 ch.slot = ngx_process_slot;
                 ch.fd = ngx_processes[ngx_process_slot].channel[0];
+                ch.generation = ngx_processes[ngx_process_slot].generation;
 
                 ngx_pass_open_channel(cycle, &ch);
 
@@ -723,6 +741,33 @@ ngx_master_process_exit(ngx_cycle_t *cycle)
 }
 
 
+static void
+ngx_shared_memory_stat(ngx_cycle_t *cycle)
+{
+    ngx_uint_t        i;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_list_part_t  *part;
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        ngx_slab_stat((ngx_slab_pool_t *) shm_zone[i].shm.addr,
+                      &shm_zone[i].shm.name, cycle->log);
+    }
+}
+
+
 static void
 ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
 {
@@ -767,6 +812,7 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
             if (!ngx_exiting) {
                 ngx_exiting = 1;
                 ngx_close_listening_sockets(cycle);
+                ngx_pass_idle_connections(cycle);
                 ngx_close_idle_connections(cycle);
             }
         }
@@ -775,6 +821,10 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
             ngx_reopen = 0;
             ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "reopening logs");
             ngx_reopen_files(cycle, -1);
+
+#if (NGX_PALLOC_PROFILE)
+            ngx_pool_profile_log(cycle->log);
+#endif
         }
     }
 }
@@ -895,6 +945,8 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
         ls[i].previous = NULL;
     }
 
+    ngx_pool_cache_init(cycle);
+
     for (i = 0; cycle->modules[i]; i++) {
         if (cycle->modules[i]->init_process) {
             if (cycle->modules[i]->init_process(cycle) == NGX_ERROR) {
@@ -977,6 +1029,8 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
         }
     }
 
+    ngx_pool_cache_log(cycle->log);
+
     /*
      * Copy ngx_cycle->log related data to the special static exit cycle,
      * log, and log file structures enough to allow a signal handler to log.
@@ -1071,6 +1125,29 @@ ngx_channel_handler(ngx_event_t *ev)
 
             ngx_processes[ch.slot].pid = ch.pid;
             ngx_processes[ch.slot].channel[0] = ch.fd;
+            ngx_processes[ch.slot].generation = ch.generation;
+
+            if (ch.slot >= ngx_last_process) {
+                ngx_last_process = ch.slot + 1;
+            }
+
+            break;
+
+        case NGX_CMD_PASS_CONNECTION:
+
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "get connection fd:%d from pid:%P", ch.fd, ch.pid);
+
+            if (ngx_exiting || ngx_terminate) {
+                if (ngx_close_socket(ch.fd) == -1) {
+                    ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_socket_errno,
+                                  ngx_close_socket_n " failed");
+                }
+
+                break;
+            }
+
+            ngx_event_accept_passed(ch.fd, ev->log);
             break;
 
         case NGX_CMD_CLOSE_CHANNEL:
@@ -1092,6 +1169,98 @@ ngx_channel_handler(ngx_event_t *ev)
 }
 
 
+static void
+ngx_pass_idle_connections(ngx_cycle_t *cycle)
+{
+    ngx_int_t          s, next;
+    ngx_uint_t         i, n, passed;
+    ngx_int_t          slots[NGX_MAX_PROCESSES];
+    ngx_channel_t      ch;
+    ngx_connection_t  *c;
+    ngx_core_conf_t   *ccf;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (!ccf->handoff) {
+        return;
+    }
+
+    /* the workers started after us */
+
+    n = 0;
+
+    for (s = 0; s < ngx_last_process; s++) {
+
+        if (s == ngx_process_slot
+            || ngx_processes[s].pid == -1
+            || ngx_processes[s].channel[0] == -1
+            || ngx_processes[s].generation <= ngx_generation)
+        {
+            continue;
+        }
+
+        slots[n++] = s;
+    }
+
+    if (n == 0) {
+        return;
+    }
+
+    ngx_memzero(&ch, sizeof(ngx_channel_t));
+
+    ch.command = NGX_CMD_PASS_CONNECTION;
+    ch.pid = ngx_pid;
+    ch.slot = ngx_process_slot;
+    ch.generation = ngx_generation;
+
+    next = 0;
+    passed = 0;
+
+    c = cycle->connections;
+
+    for (i = 0; i < cycle->connection_n; i++) {
+
+        if (c[i].fd == (ngx_socket_t) -1 || !c[i].idle || !c[i].handoff) {
+            continue;
+        }
+
+        s = slots[next++ % n];
+
+        ch.fd = c[i].fd;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                       "pass connection fd:%d to s:%i pid:%P",
+                       ch.fd, s, ngx_processes[s].pid);
+
+        if (ngx_write_channel(ngx_processes[s].channel[0], &ch,
+                              sizeof(ngx_channel_t), cycle->log)
+            != NGX_OK)
+        {
+            continue;
+        }
+
+        /*
+         * the socket now belongs to the new worker, close our copy;
+         * epoll keeps the registration while the socket is open anywhere
+         */
+
+        if (ngx_event_flags & NGX_USE_EPOLL_EVENT) {
+            ngx_del_conn(&c[i], 0);
+        }
+
+        c[i].close = 1;
+        c[i].read->handler(c[i].read);
+
+        passed++;
+    }
+
+    if (passed) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "%ui idle connections passed to new workers", passed);
+    }
+}
+
+
 static void
 ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
 {
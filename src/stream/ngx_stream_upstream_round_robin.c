@@ -547,6 +547,8 @@ ngx_stream_upstream_set_round_robin_peer_session(ngx_peer_connection_t *pc,
     const
 #endif
     u_char                          *p;
+    ngx_atomic_uint_t                generation;
+    ngx_stream_upstream_rr_peer_t   *local;
     ngx_stream_upstream_rr_peers_t  *peers;
     u_char                           buf[NGX_SSL_MAX_SESSION_SIZE];
 #endif
@@ -557,6 +559,25 @@ ngx_stream_upstream_set_round_robin_peer_session(ngx_peer_connection_t *pc,
     peers = rrp->peers;
 
     if (peers->shpool) {
+
+        /* the worker-local session is valid while no session was saved */
+
+        local = peer->local;
+
+        if (local->ssl_session
+            && local->ssl_session_generation
+               == ngx_slab_generation(peers->shpool))
+        {
+            ssl_session = local->ssl_session;
+
+            rc = ngx_ssl_set_session(pc->connection, ssl_session);
+
+            ngx_log_debug1(NGX_LOG_DEBUG_STREAM, pc->log, 0,
+                           "set local session: %p", ssl_session);
+
+            return rc;
+        }
+
         ngx_stream_upstream_rr_peers_rlock(peers);
         ngx_stream_upstream_rr_peer_lock(peers, peer);
 
@@ -566,6 +587,8 @@ ngx_stream_upstream_set_round_robin_peer_session(ngx_peer_connection_t *pc,
             return NGX_OK;
         }
 
+        generation = ngx_slab_generation(peers->shpool);
+
         len = peer->ssl_session_len;
 
         ngx_memcpy(buf, peer->ssl_session, len);
@@ -581,7 +604,12 @@ ngx_stream_upstream_set_round_robin_peer_session(ngx_peer_connection_t *pc,
         ngx_log_debug1(NGX_LOG_DEBUG_STREAM, pc->log, 0,
                        "set session: %p", ssl_session);
 
-        ngx_ssl_free_session(ssl_session);
+        if (local->ssl_session) {
+            ngx_ssl_free_session(local->ssl_session);
+        }
+
+        local->ssl_session = ssl_session;
+        local->ssl_session_generation = generation;
 
         return rc;
     }
@@ -609,6 +637,8 @@ ngx_stream_upstream_save_round_robin_peer_session(ngx_peer_connection_t *pc,
 #if (NGX_STREAM_UPSTREAM_ZONE)
     int                              len;
     u_char                          *p;
+    ngx_atomic_uint_t                generation;
+    ngx_stream_upstream_rr_peer_t   *local;
     ngx_stream_upstream_rr_peers_t  *peers;
     u_char                           buf[NGX_SSL_MAX_SESSION_SIZE];
 #endif
@@ -618,6 +648,10 @@ ngx_stream_upstream_save_round_robin_peer_session(ngx_peer_connection_t *pc,
 
     if (peers->shpool) {
 
+        if (SSL_session_reused(pc->connection->ssl->connection)) {
+            return;
+        }
+
         ssl_session = SSL_get0_session(pc->connection->ssl->connection);
 
         if (ssl_session == NULL) {
@@ -667,9 +701,20 @@ ngx_stream_upstream_save_round_robin_peer_session(ngx_peer_connection_t *pc,
 
         ngx_memcpy(peer->ssl_session, buf, len);
 
+        generation = ngx_slab_update_generation(peers->shpool);
+
         ngx_stream_upstream_rr_peer_unlock(peers, peer);
         ngx_stream_upstream_rr_peers_unlock(peers);
 
+        local = peer->local;
+
+        if (local->ssl_session) {
+            ngx_ssl_free_session(local->ssl_session);
+        }
+
+        local->ssl_session = ngx_ssl_get_session(pc->connection);
+        local->ssl_session_generation = generation;
+
         return;
     }
 #endif
@@ -46,6 +46,10 @@ struct ngx_stream_upstream_rr_peer_s {
 
 #if (NGX_STREAM_UPSTREAM_ZONE)
     ngx_atomic_t                     lock;
+#if (NGX_STREAM_SSL)
+    ngx_stream_upstream_rr_peer_t   *local;
+    ngx_atomic_uint_t                ssl_session_generation;
+#endif
 #endif
 };
 
@@ -203,6 +203,11 @@ ngx_stream_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
         ngx_memcpy(peer, *peerp, sizeof(ngx_stream_upstream_rr_peer_t));
 
+#if (NGX_STREAM_SSL)
+        /* the original peer keeps a worker-local copy of the session */
+        peer->local = *peerp;
+#endif
+
         *peerp = peer;
     }
 
@@ -229,6 +234,11 @@ ngx_stream_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
         ngx_memcpy(peer, *peerp, sizeof(ngx_stream_upstream_rr_peer_t));
 
+#if (NGX_STREAM_SSL)
+        /* the original peer keeps a worker-local copy of the session */
+        peer->local = *peerp;
+#endif
+
         *peerp = peer;
     }
 